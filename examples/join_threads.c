@@ -0,0 +1,168 @@
+/**
+ * @file join_threads.c
+ * @brief Several joiners on one thread, and fan-in with a wait group
+ *
+ * Exits with status 1 if any round goes wrong, so it doubles as a quick
+ * check of the join paths.
+ */
+
+#include <lwthread/lwthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define JOINERS 8
+#define ROUNDS 50
+#define TASKS 100
+
+static atomic_int joined;
+static atomic_int finished;
+
+/* Target thread: sleeps so that every joiner is waiting when it ends */
+static void target_thread(void* arg) {
+    (void)arg;
+    lwt_sleep(2);
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Joins the target and counts itself */
+static void joiner_thread(void* arg) {
+    lwt_join((lwt_thread_t*)arg);
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Joins the target, then releases it while other joiners may still wait */
+static void freeing_joiner_thread(void* arg) {
+    lwt_thread_t* target = (lwt_thread_t*)arg;
+    lwt_join(target);
+    lwt_thread_free(target);
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Detaches the target while the main thread is joining it */
+static void detaching_thread(void* arg) {
+    lwt_detach((lwt_thread_t*)arg);
+}
+
+/* One task of the fan-in */
+static void task_thread(void* arg) {
+    lwt_waitgroup_t* wg = (lwt_waitgroup_t*)arg;
+    lwt_yield();
+    atomic_fetch_add(&finished, 1);
+    lwt_waitgroup_done(wg);
+}
+
+/* Waits for the fan-in from a lightweight thread */
+static void wg_waiter_thread(void* arg) {
+    lwt_waitgroup_wait((lwt_waitgroup_t*)arg);
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Many lightweight joiners on one thread */
+static int many_joiners(lwt_scheduler_t* scheduler) {
+    atomic_store(&joined, 0);
+    lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+    lwt_thread_t* joiners[JOINERS];
+    for (int i = 0; i < JOINERS; i++) {
+        joiners[i] = lwt_create(scheduler, joiner_thread, target);
+    }
+    for (int i = 0; i < JOINERS; i++) {
+        lwt_join(joiners[i]);
+        lwt_thread_free(joiners[i]);
+    }
+    lwt_thread_free(target);
+    return atomic_load(&joined) == JOINERS ? 0 : -1;
+}
+
+/* The main thread joins alongside a lightweight joiner that frees the target */
+static int external_and_freeing_joiner(lwt_scheduler_t* scheduler) {
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&joined, 0);
+        lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+        lwt_thread_t* joiner = lwt_create(scheduler, freeing_joiner_thread, target);
+        lwt_join(target);
+        lwt_join(joiner);
+        lwt_thread_free(joiner);
+        if (atomic_load(&joined) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* The main thread joins with a deadline while the target is freed */
+static int timed_and_freeing_joiner(lwt_scheduler_t* scheduler) {
+    for (int round = 0; round < ROUNDS; round++) {
+        lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+        lwt_thread_t* joiner = lwt_create(scheduler, freeing_joiner_thread, target);
+        if (lwt_join_until(target, lwt_now_ns() + 1000000000ull) != 0) {
+            return -1;
+        }
+        lwt_join(joiner);
+        lwt_thread_free(joiner);
+    }
+    return 0;
+}
+
+/* The main thread joins a thread that is detached meanwhile */
+static int external_joiner_of_detached(lwt_scheduler_t* scheduler) {
+    for (int round = 0; round < ROUNDS; round++) {
+        lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+        lwt_thread_t* detacher = lwt_create(scheduler, detaching_thread, target);
+        lwt_join(target);
+        lwt_join(detacher);
+        lwt_thread_free(detacher);
+    }
+    return 0;
+}
+
+/* Fan-in: the main thread and a lightweight thread wait for all tasks */
+static int fan_in(lwt_scheduler_t* scheduler) {
+    lwt_waitgroup_t* wg = lwt_waitgroup_create();
+    if (!wg) {
+        return -1;
+    }
+    atomic_store(&joined, 0);
+    atomic_store(&finished, 0);
+    lwt_waitgroup_add(wg, TASKS);
+    lwt_thread_t* waiter = lwt_create(scheduler, wg_waiter_thread, wg);
+    for (int i = 0; i < TASKS; i++) {
+        lwt_detach(lwt_create(scheduler, task_thread, wg));
+    }
+    int rc = lwt_waitgroup_wait(wg);
+    int done = atomic_load(&finished);
+    lwt_join(waiter);
+    lwt_thread_free(waiter);
+    lwt_waitgroup_destroy(wg);
+    return (0 == rc && TASKS == done && 1 == atomic_load(&joined)) ? 0 : -1;
+}
+
+int main() {
+    lwt_scheduler_t* scheduler = lwt_scheduler_create(2);
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    lwt_scheduler_start(scheduler);
+
+    struct {
+        const char* name;
+        int (*run)(lwt_scheduler_t* scheduler);
+    } cases[] = {
+        { "many joiners", many_joiners },
+        { "external joiner with a freeing joiner", external_and_freeing_joiner },
+        { "timed joiner with a freeing joiner", timed_and_freeing_joiner },
+        { "external joiner of a detached thread", external_joiner_of_detached },
+        { "wait group fan-in", fan_in },
+    };
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int rc = cases[i].run(scheduler);
+        printf("%-40s %s\n", cases[i].name, 0 == rc ? "ok" : "FAILED");
+        failed |= (rc != 0);
+    }
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}
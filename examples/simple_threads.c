@@ -61,8 +61,8 @@
              lwt_join(threads[i]);
              printf("Thread %d joined\n", ids[i]);
              
-             /* Free thread memory */
-             free(threads[i]);
+             /* Release the thread so its control block can be reused */
+             lwt_thread_free(threads[i]);
          }
      }
      
@@ -13,6 +13,9 @@
 #define LWTHREAD_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -22,12 +25,88 @@ extern "C"
 /* Opaque type definitions */
 typedef struct lwt_thread lwt_thread_t;
 typedef struct lwt_scheduler lwt_scheduler_t;
+typedef struct lwt_mutex lwt_mutex_t;
+typedef struct lwt_chan lwt_chan_t;
+typedef struct lwt_event lwt_event_t;
+typedef struct lwt_waitgroup lwt_waitgroup_t;
 
 /**
  * Function type for thread entry points
  */
 typedef void (*lwt_func_t)(void* arg);
 
+/**
+ * Generation-counted reference to a thread
+ *
+ * Thread control blocks are recycled, so a plain lwt_thread_t* may end up
+ * pointing at an unrelated thread once the original has been freed. A
+ * handle detects that: lwt_handle_thread() returns NULL for stale handles.
+ */
+typedef struct lwt_handle {
+    lwt_thread_t* thread;       /* Control block */
+    unsigned long generation;   /* Generation of the control block when taken */
+} lwt_handle_t;
+
+/**
+ * Point on the CLOCK_MONOTONIC clock in nanoseconds, as read by lwt_now_ns()
+ *
+ * Every deadline and timeout in the API is one of these.
+ */
+typedef uint64_t lwt_deadline_t;
+
+/**
+ * Deadline that never comes
+ */
+#define LWT_DEADLINE_NONE UINT64_MAX
+
+/**
+ * I/O backends a scheduler can use
+ */
+typedef enum {
+    LWT_IO_AUTO,        /* io_uring when the kernel supports it, epoll otherwise */
+    LWT_IO_EPOLL,       /* epoll for sockets, a blocking thread pool for files */
+    LWT_IO_URING        /* One io_uring per worker for everything */
+} lwt_io_backend_t;
+
+/**
+ * Policies for ordering ready threads
+ */
+typedef enum {
+    LWT_SCHED_DEFAULT,  /* Priorities, then FIFO per worker with work stealing */
+    LWT_SCHED_EDF       /* Threads with a deadline first, earliest deadline first */
+} lwt_sched_policy_t;
+
+/**
+ * Scheduler creation attributes
+ */
+typedef struct lwt_scheduler_attr {
+    int num_threads;                /* Worker threads (similar to GOMAXPROCS) */
+    lwt_io_backend_t io_backend;    /* I/O backend */
+    unsigned int uring_entries;     /* Submission queue size of each ring */
+    int uring_sqpoll;               /* Let kernel threads poll the rings (SQPOLL) */
+    unsigned int time_slice_us;     /* Preempt threads running longer than this, 0 to never preempt */
+    lwt_sched_policy_t policy;      /* How ready threads are ordered */
+    size_t shared_stack_size;       /* Each worker's stack for shared-stack threads, 0 for 1MB */
+} lwt_scheduler_attr_t;
+
+/**
+ * Scheduler statistics
+ */
+typedef struct lwt_scheduler_stats {
+    uint64_t deadlines_met;         /* Deadlines finished or replaced in time */
+    uint64_t deadlines_missed;      /* Deadlines finished or replaced late */
+} lwt_scheduler_stats_t;
+
+/**
+ * Initializes scheduler attributes with defaults
+ * 
+ * The defaults are one worker, LWT_IO_AUTO, 256 ring entries, no SQPOLL,
+ * no preemption and LWT_SCHED_DEFAULT.
+ * 
+ * @param attr Attributes to initialize
+ */
+void lwt_scheduler_attr_init(lwt_scheduler_attr_t* attr);
+
 /**
  * Creates a new scheduler with the specified number of worker threads
  * 
@@ -36,6 +115,56 @@ typedef void (*lwt_func_t)(void* arg);
  */
 lwt_scheduler_t* lwt_scheduler_create(int num_threads);
 
+/**
+ * Creates a new scheduler from attributes
+ * 
+ * LWT_IO_URING fails with ENOSYS when the kernel lacks io_uring; LWT_IO_AUTO
+ * falls back to LWT_IO_EPOLL instead.
+ * 
+ * A non-zero time_slice_us starts a monitor thread that interrupts a thread
+ * which has run that long without yielding, using SIGURG. The thread is
+ * only switched out while it executes code of the main program, never
+ * inside this library, the C library or other shared objects. Preemption
+ * needs Linux on x86-64 or AArch64 with lwthread built as a shared
+ * library, and fails with ENOTSUP otherwise. Creation also fails if the
+ * monitor thread cannot be started.
+ *
+ * A preempted thread resumes the interrupted instruction on whichever
+ * worker picks it up next, which may be a different OS thread. Code that
+ * must stay on one OS thread, such as holding a pthread_mutex_t or using
+ * an address of thread-local storage after computing it, has to run
+ * between lwt_preempt_disable() and lwt_preempt_enable().
+ *
+ * With LWT_SCHED_EDF, each worker keeps its ready threads that have a
+ * deadline in a heap and runs the earliest one before any other work
+ * (every 61st round excepted, so threads without one still progress).
+ * Idle workers steal from these heaps before anything else.
+ * 
+ * @param attr Scheduler attributes
+ * @return Pointer to scheduler or NULL on error (errno set)
+ */
+lwt_scheduler_t* lwt_scheduler_create_ex(const lwt_scheduler_attr_t* attr);
+
+/**
+ * Gets the I/O backend a scheduler ended up with
+ * 
+ * @param scheduler Scheduler to query
+ * @return LWT_IO_EPOLL or LWT_IO_URING
+ */
+lwt_io_backend_t lwt_scheduler_io_backend(lwt_scheduler_t* scheduler);
+
+/**
+ * Gets a scheduler's statistics
+ * 
+ * Counters are summed over the workers without stopping them, so they
+ * may lag a little behind threads finishing meanwhile.
+ * 
+ * @param scheduler Scheduler to query
+ * @param stats Filled with the counters
+ * @return 0 on success, -1 on error (errno set to EINVAL)
+ */
+int lwt_scheduler_get_stats(lwt_scheduler_t* scheduler, lwt_scheduler_stats_t* stats);
+
 /**
  * Destroys a scheduler and all its resources
  * 
@@ -67,18 +196,257 @@ void lwt_scheduler_stop(lwt_scheduler_t* scheduler);
  */
 lwt_thread_t* lwt_create(lwt_scheduler_t* scheduler, lwt_func_t func, void* arg);
 
+/**
+ * Thread priorities
+ *
+ * Higher values run first. Threads at LWT_PRIO_NORMAL, the default, are
+ * scheduled exactly as if priorities did not exist.
+ */
+#define LWT_PRIO_MIN 0
+#define LWT_PRIO_LOW 8
+#define LWT_PRIO_NORMAL 16
+#define LWT_PRIO_HIGH 24
+#define LWT_PRIO_MAX 31
+
+/**
+ * Thread creation attributes
+ */
+typedef struct lwt_attr {
+    size_t stack_size;          /* Stack size in bytes, 0 for the default */
+    int priority;               /* LWT_PRIO_MIN to LWT_PRIO_MAX */
+    lwt_deadline_t deadline;    /* Deadline, or LWT_DEADLINE_NONE */
+    int shared_stack;           /* Run on a worker's shared stack instead of an own one */
+} lwt_attr_t;
+
+/**
+ * Initializes thread attributes with defaults
+ * 
+ * The defaults are the default stack size, LWT_PRIO_NORMAL, no deadline
+ * and an own stack.
+ * 
+ * @param attr Attributes to initialize
+ */
+void lwt_attr_init(lwt_attr_t* attr);
+
+/**
+ * Creates a new lightweight thread from attributes
+ * 
+ * Whenever a worker picks its next thread, a ready thread above
+ * LWT_PRIO_NORMAL goes first and one below it only runs when there is
+ * nothing else to do. Two safeguards keep this from starving anyone: once
+ * every 61 rounds a worker runs normal work regardless, and a thread that
+ * has waited 10 ms at its level moves up one level until it runs.
+ * 
+ * A thread created with shared_stack set has no stack of its own. It is
+ * bound to one worker and runs on that worker's shared stack; when another
+ * shared-stack thread needs the stack, the frames in use are copied to a
+ * heap buffer sized to fit them and copied back before the thread next
+ * runs. A parked thread then costs only its live stack depth, at the
+ * price of a copy when threads take turns. Such threads are never stolen
+ * by other workers, run in FIFO order on their worker whatever their
+ * priority or deadline, and ignore stack_size. The frames always return
+ * to the same address, so pointers into them stay valid for the thread
+ * itself, but no other thread may touch its stack variables while it is
+ * switched out. The library's own waits follow this rule: channel, select
+ * and I/O state goes on the heap, and I/O polls for readiness instead of
+ * using io_uring or the blocking pool, so file I/O blocks the worker.
+ * 
+ * @param scheduler Scheduler that will manage this thread
+ * @param attr Thread attributes, or NULL for the defaults
+ * @param func Function to execute
+ * @param arg Argument to pass to the function
+ * @return Pointer to thread or NULL on error (errno set to EINVAL for a
+ *         priority out of range, or ENOTSUP for a shared stack with the
+ *         ucontext fallback)
+ */
+lwt_thread_t* lwt_create_ex(lwt_scheduler_t* scheduler, const lwt_attr_t* attr,
+                            lwt_func_t func, void* arg);
+
+/**
+ * Creates many lightweight threads running the same function
+ * 
+ * Cheaper than calling lwt_create_ex() count times: control blocks and
+ * stacks are allocated a slab at a time, and the threads are published
+ * to the run queues together once all of them exist.
+ * 
+ * @param scheduler Scheduler that will manage the threads
+ * @param attr Attributes shared by every thread, or NULL for the defaults
+ * @param func Function to execute
+ * @param args count arguments, one per thread, or NULL to pass NULL to each
+ * @param count Number of threads to create
+ * @param threads Receives count threads, to be joined as usual, or NULL
+ *        to create them detached
+ * @return 0 on success, -1 on error with no thread created and threads
+ *         left untouched (errno set to EINVAL for bad arguments or ENOMEM)
+ */
+int lwt_create_many(lwt_scheduler_t* scheduler, const lwt_attr_t* attr, lwt_func_t func,
+                    void* const* args, int count, lwt_thread_t** threads);
+
+/**
+ * Replaces the current thread's deadline
+ * 
+ * The old deadline is counted as met or missed, as if the thread had
+ * finished, which suits threads that serve one request after another.
+ * The new one orders the thread from the next time it becomes ready.
+ * 
+ * @param deadline New deadline, or LWT_DEADLINE_NONE
+ * @return 0 on success, -1 if not called from a lightweight thread
+ *         (errno set to EPERM)
+ */
+int lwt_set_deadline(lwt_deadline_t deadline);
+
+/**
+ * Reads the monotonic clock used for deadlines and timeouts
+ * 
+ * @return CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t lwt_now_ns(void);
+
+/**
+ * Detaches a thread so that it is reclaimed automatically when it finishes
+ * 
+ * A detached thread must not be joined or freed, and the pointer must not
+ * be used afterwards (use a handle to check).
+ * 
+ * @param thread Thread to detach
+ * @return 0 on success, -1 on error (errno set to EINVAL)
+ */
+int lwt_detach(lwt_thread_t* thread);
+
+/**
+ * Releases a thread after it has been joined
+ * 
+ * The control block is recycled for later threads. Calling this on a
+ * thread that has not finished yet detaches it instead, and recycling
+ * waits for joiners still inside lwt_join() or lwt_join_until(). Call it
+ * once per thread; with several joiners, let one of them do it.
+ * 
+ * @param thread Thread to release
+ */
+void lwt_thread_free(lwt_thread_t* thread);
+
+/**
+ * Takes a generation-counted handle to a thread
+ * 
+ * @param thread Thread to reference
+ * @return Handle to the thread
+ */
+lwt_handle_t lwt_thread_handle(lwt_thread_t* thread);
+
+/**
+ * Resolves a handle to its thread
+ * 
+ * @param handle Handle from lwt_thread_handle()
+ * @return Thread, or NULL if it has since been freed or recycled
+ */
+lwt_thread_t* lwt_handle_thread(lwt_handle_t handle);
+
+/**
+ * Stack memory of a thread
+ */
+typedef struct lwt_stack_info {
+    size_t reserved;            /* Usable stack size, as address space */
+    size_t committed;           /* Part of it backed by memory, in bytes */
+} lwt_stack_info_t;
+
+/**
+ * Reports how much of a thread's stack is committed
+ * 
+ * Stacks only take memory for the pages a thread has touched, so a thread
+ * can be given a large stack (say 1MB) and still cost a few pages while
+ * it stays shallow. Both fields are 0 once the thread has finished. For a
+ * shared-stack thread, reserved is the shared stack's size and committed
+ * the size of the heap buffer holding its frames while it is off it.
+ * 
+ * @param thread Thread to query
+ * @param info Filled with the stack's sizes
+ * @return 0 on success, -1 on error (errno set to EINVAL)
+ */
+int lwt_thread_stack_info(lwt_thread_t* thread, lwt_stack_info_t* info);
+
 /**
  * Yields execution from current thread to another
  */
 void lwt_yield(void);
 
+/**
+ * Yields execution directly to another thread
+ * 
+ * Switches from the current thread to thread without a round trip
+ * through the worker's scheduling loop, then requeues the current thread
+ * as lwt_yield() does. This works when thread has just been created or
+ * woken by a lightweight thread of the same scheduler (the one every
+ * worker runs next), such as the next stage of a pipeline after a
+ * channel send. For any other thread the call simply yields.
+ * 
+ * @param thread Thread to run
+ * @return 0 if thread ran, -1 otherwise: errno EAGAIN if it was not
+ *         waiting to run next (the caller has yielded), EINVAL if it is
+ *         NULL, the caller, of another scheduler, or the caller is not a
+ *         lightweight thread
+ */
+int lwt_yield_to(lwt_thread_t* thread);
+
+/**
+ * Keeps the current thread from being preempted
+ * 
+ * Calls nest. Use around code of the main program that must not be
+ * switched out, such as a section holding a spinlock shared with other
+ * lightweight threads.
+ */
+void lwt_preempt_disable(void);
+
+/**
+ * Allows preemption again after lwt_preempt_disable()
+ */
+void lwt_preempt_enable(void);
+
 /**
  * Waits for a thread to complete
  * 
+ * Any number of threads may join the same thread; all of them are woken
+ * when it finishes. Exactly one of them (or some other owner) releases it
+ * with lwt_thread_free(), and only once no further join can start: joins
+ * already waiting, including those of OS threads and lwt_join_until(),
+ * keep the control block alive until they return.
+ * 
  * @param thread Thread to wait for
  */
 void lwt_join(lwt_thread_t* thread);
 
+/**
+ * Checks whether a thread has completed, without waiting
+ * 
+ * @param thread Thread to check
+ * @return 0 if it has finished, -1 otherwise (errno set to EBUSY, or
+ *         EINVAL if thread is NULL)
+ */
+int lwt_try_join(lwt_thread_t* thread);
+
+/**
+ * Waits for a thread to complete until a deadline
+ * 
+ * A lightweight thread that times out is taken off the target and woken
+ * by its worker's timer wheel; no worker blocks. Like lwt_join(), this
+ * does not release the thread.
+ * 
+ * @param thread Thread to wait for
+ * @param deadline Time to give up at, or LWT_DEADLINE_NONE
+ * @return 0 if it has finished, -1 otherwise (errno set to ETIMEDOUT, or
+ *         EINVAL if thread is NULL)
+ */
+int lwt_join_until(lwt_thread_t* thread, lwt_deadline_t deadline);
+
+/**
+ * Waits for a thread to complete for at most a number of nanoseconds
+ * 
+ * @param thread Thread to wait for
+ * @param timeout_ns Nanoseconds to wait at most, 0 to poll
+ * @return 0 if it has finished, -1 otherwise (errno set to ETIMEDOUT, or
+ *         EINVAL if thread is NULL)
+ */
+int lwt_join_timeout(lwt_thread_t* thread, uint64_t timeout_ns);
+
 /**
  * Get the current thread
  * 
@@ -93,6 +461,447 @@ lwt_thread_t* lwt_current(void);
  */
 void lwt_sleep(unsigned int ms);
 
+/**
+ * Sleeps for a number of nanoseconds
+ * 
+ * Sleeping threads are kept in a per-worker timer wheel with ticks of
+ * about a microsecond, so sub-millisecond sleeps are honoured. A sleep
+ * never ends early; sleeping for 0 ns yields.
+ * 
+ * @param ns Nanoseconds to sleep
+ */
+void lwt_sleep_ns(uint64_t ns);
+
+/**
+ * Sleeps until a point on the monotonic clock
+ * 
+ * Sleeping until successive multiples of a period paces a loop without
+ * the drift of repeated relative sleeps. A deadline that has passed
+ * yields. Outside lightweight threads this blocks the calling OS thread.
+ * 
+ * @param deadline Time to wake at
+ */
+void lwt_sleep_until(lwt_deadline_t deadline);
+
+/*
+ * Mutexes
+ *
+ * A contended lwt_mutex_lock() parks the calling lightweight thread, not
+ * its worker, after spinning briefly while the owner is running on
+ * another worker. A thread that has waited more than a millisecond puts
+ * the mutex into starvation mode, in which unlock hands it directly to
+ * the longest waiter until the queue drains. Called from any other
+ * thread, lwt_mutex_lock() spins and yields the CPU until it succeeds.
+ */
+
+/**
+ * Creates an unlocked mutex
+ * 
+ * @return Mutex handle or NULL on failure
+ */
+lwt_mutex_t* lwt_mutex_create(void);
+
+/**
+ * Destroys a mutex
+ * 
+ * The mutex must be unlocked and have no waiters.
+ * 
+ * @param mutex Mutex to destroy
+ */
+void lwt_mutex_destroy(lwt_mutex_t* mutex);
+
+/**
+ * Locks a mutex, waiting for it if necessary
+ * 
+ * @param mutex Mutex to lock
+ */
+void lwt_mutex_lock(lwt_mutex_t* mutex);
+
+/**
+ * Locks a mutex if it is free
+ * 
+ * @param mutex Mutex to lock
+ * @return 0 if locked, -1 with errno set to EBUSY otherwise
+ */
+int lwt_mutex_trylock(lwt_mutex_t* mutex);
+
+/**
+ * Unlocks a mutex
+ * 
+ * Any thread may unlock a mutex, not only the one that locked it.
+ * 
+ * @param mutex Mutex to unlock
+ */
+void lwt_mutex_unlock(lwt_mutex_t* mutex);
+
+/*
+ * Channels
+ *
+ * A channel carries fixed-size elements between threads in FIFO order.
+ * A buffered channel holds up to its capacity; an unbuffered one hands
+ * each element directly from a sender to a receiver, so send returns
+ * only once the element has been received. Blocked lightweight threads
+ * park on the scheduler and are made runnable on the worker that wakes
+ * them; other threads sleep on the OS.
+ */
+
+/**
+ * Creates a channel
+ * 
+ * @param elem_size Size in bytes of each element (may be 0)
+ * @param capacity Number of buffered elements, or 0 for an unbuffered channel
+ * @return Channel handle or NULL on failure
+ */
+lwt_chan_t* lwt_chan_create(size_t elem_size, size_t capacity);
+
+/**
+ * Destroys a channel
+ * 
+ * No thread may be blocked on the channel. Buffered elements are discarded.
+ * 
+ * @param chan Channel to destroy
+ */
+void lwt_chan_destroy(lwt_chan_t* chan);
+
+/**
+ * Sends an element, waiting for buffer space or a receiver
+ * 
+ * @param chan Channel to send on
+ * @param elem Element to copy into the channel
+ * @return 0 on success, -1 with errno set to EPIPE if the channel is closed
+ */
+int lwt_chan_send(lwt_chan_t* chan, const void* elem);
+
+/**
+ * Sends an element if that is possible without waiting
+ * 
+ * @param chan Channel to send on
+ * @param elem Element to copy into the channel
+ * @return 0 on success, -1 with errno set to EAGAIN or EPIPE otherwise
+ */
+int lwt_chan_trysend(lwt_chan_t* chan, const void* elem);
+
+/**
+ * Receives an element, waiting for one if the channel is empty
+ * 
+ * Elements buffered before the channel was closed are still received.
+ * 
+ * @param chan Channel to receive from
+ * @param elem Where to copy the element
+ * @return 0 on success, -1 with errno set to EPIPE once closed and drained
+ */
+int lwt_chan_recv(lwt_chan_t* chan, void* elem);
+
+/**
+ * Receives an element if one is available without waiting
+ * 
+ * @param chan Channel to receive from
+ * @param elem Where to copy the element
+ * @return 0 on success, -1 with errno set to EAGAIN or EPIPE otherwise
+ */
+int lwt_chan_tryrecv(lwt_chan_t* chan, void* elem);
+
+/**
+ * Closes a channel
+ * 
+ * Blocked senders fail with EPIPE, and blocked receivers fail with EPIPE
+ * once nothing is left to receive.
+ * 
+ * @param chan Channel to close
+ * @return 0 on success, -1 with errno set to EPIPE if already closed
+ */
+int lwt_chan_close(lwt_chan_t* chan);
+
+/*
+ * Events and multi-source waits
+ *
+ * lwt_select() parks the caller until the first of several sources is
+ * ready. It registers with every source, and on wakeup withdraws from the
+ * others, so a waiting thread costs nothing until a source fires. All
+ * sources are level-triggered: a thread that has already finished, a set
+ * event or a ready descriptor are reported at once.
+ */
+
+/**
+ * Kinds of source lwt_select() can wait for
+ */
+typedef enum {
+    LWT_SELECT_THREAD,      /* thread has finished */
+    LWT_SELECT_READ,        /* fd is readable */
+    LWT_SELECT_WRITE,       /* fd is writable */
+    LWT_SELECT_EVENT        /* event is set */
+} lwt_select_type_t;
+
+/**
+ * A source for lwt_select(); only the field for its type is used
+ */
+typedef struct lwt_select_source {
+    lwt_select_type_t type;     /* Kind of source */
+    lwt_thread_t* thread;       /* LWT_SELECT_THREAD: thread to wait for */
+    int fd;                     /* LWT_SELECT_READ, LWT_SELECT_WRITE: descriptor */
+    lwt_event_t* event;         /* LWT_SELECT_EVENT: event to wait for */
+} lwt_select_source_t;
+
+/**
+ * Waits until one of several sources is ready
+ * 
+ * Descriptors can only be waited for from a lightweight thread, and are
+ * handled like those passed to the I/O functions (non-blocking with the
+ * epoll backend). When several sources are ready, any one of them may be
+ * reported. A thread reported as finished still has to be joined or freed.
+ * 
+ * @param sources Sources to wait for
+ * @param count Number of sources
+ * @param timeout_ms Milliseconds to wait at most, 0 to poll, or -1 for no limit
+ * @return Index of a ready source, or -1 with errno set to ETIMEDOUT on
+ *         timeout or EINVAL for an invalid source
+ */
+int lwt_select(const lwt_select_source_t* sources, int count, int timeout_ms);
+
+/**
+ * Waits until one of several sources is ready or a deadline passes
+ * 
+ * Works like lwt_select(), with an absolute timeout: a deadline that has
+ * already passed polls, and LWT_DEADLINE_NONE waits without limit.
+ * 
+ * @param sources Sources to wait for
+ * @param count Number of sources
+ * @param deadline Time to give up at, or LWT_DEADLINE_NONE
+ * @return Index of a ready source, or -1 with errno set to ETIMEDOUT on
+ *         timeout or EINVAL for an invalid source
+ */
+int lwt_select_until(const lwt_select_source_t* sources, int count, lwt_deadline_t deadline);
+
+/**
+ * Creates an event that is not set
+ * 
+ * @return Event handle or NULL on failure
+ */
+lwt_event_t* lwt_event_create(void);
+
+/**
+ * Destroys an event
+ * 
+ * No thread may be waiting for the event.
+ * 
+ * @param event Event to destroy
+ */
+void lwt_event_destroy(lwt_event_t* event);
+
+/**
+ * Sets an event, waking every thread waiting for it
+ * 
+ * The event stays set until lwt_event_reset().
+ * 
+ * @param event Event to set
+ */
+void lwt_event_set(lwt_event_t* event);
+
+/**
+ * Clears an event
+ * 
+ * @param event Event to reset
+ */
+void lwt_event_reset(lwt_event_t* event);
+
+/**
+ * Waits until an event is set
+ * 
+ * @param event Event to wait for
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int lwt_event_wait(lwt_event_t* event);
+
+/*
+ * Wait groups
+ *
+ * A wait group counts outstanding tasks, like Go's sync.WaitGroup: add
+ * the number of tasks before starting them, have each call
+ * lwt_waitgroup_done() when it is finished, and lwt_waitgroup_wait()
+ * parks once until all are. Waiters may be lightweight or OS threads.
+ * Adding to a count of zero must not race with a wait.
+ */
+
+/**
+ * Creates a wait group with a count of zero
+ * 
+ * @return Wait group handle or NULL on failure
+ */
+lwt_waitgroup_t* lwt_waitgroup_create(void);
+
+/**
+ * Destroys a wait group
+ * 
+ * No thread may be waiting for the wait group.
+ * 
+ * @param wg Wait group to destroy
+ */
+void lwt_waitgroup_destroy(lwt_waitgroup_t* wg);
+
+/**
+ * Adds to the count of outstanding tasks
+ * 
+ * Waiters are woken when the count drops to zero.
+ * 
+ * @param wg Wait group
+ * @param delta Amount to add, negative to finish tasks
+ * @return 0 on success, -1 if the count would go negative (errno set to
+ *         EINVAL, count unchanged)
+ */
+int lwt_waitgroup_add(lwt_waitgroup_t* wg, long delta);
+
+/**
+ * Finishes one task, the same as lwt_waitgroup_add(wg, -1)
+ * 
+ * @param wg Wait group
+ * @return 0 on success, -1 on failure (errno set to EINVAL)
+ */
+int lwt_waitgroup_done(lwt_waitgroup_t* wg);
+
+/**
+ * Waits until the count is zero
+ * 
+ * @param wg Wait group
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int lwt_waitgroup_wait(lwt_waitgroup_t* wg);
+
+/*
+ * I/O functions
+ *
+ * Called from a lightweight thread, these behave like the system calls of
+ * the same name but park the thread, not the worker, until the operation
+ * can complete. With the io_uring backend every call is submitted to the
+ * worker's ring. With epoll, a descriptor is switched to non-blocking mode
+ * on first use and stays registered with the scheduler's poller until
+ * lwt_close(), and file operations run on a small blocking thread pool.
+ * Called from any other thread they block like the plain system calls.
+ *
+ * A descriptor used with these functions must be closed with lwt_close(),
+ * from any thread, not with close(). A plain close() leaves threads
+ * parked on the descriptor waiting for good, and leaves the poller's state
+ * to whatever descriptor takes the number next, which is then never made
+ * non-blocking or watched.
+ */
+
+/**
+ * Reads from a descriptor
+ * 
+ * @param fd Descriptor to read from
+ * @param buf Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @return Number of bytes read, 0 at end of file, or -1 on error (errno set)
+ */
+ssize_t lwt_read(int fd, void* buf, size_t count);
+
+/**
+ * Writes to a descriptor
+ * 
+ * @param fd Descriptor to write to
+ * @param buf Data to write
+ * @param count Number of bytes to write
+ * @return Number of bytes written, or -1 on error (errno set)
+ */
+ssize_t lwt_write(int fd, const void* buf, size_t count);
+
+/**
+ * Receives from a socket
+ * 
+ * @param fd Socket to receive from
+ * @param buf Buffer to receive into
+ * @param len Maximum number of bytes to receive
+ * @param flags Flags as for recv(2)
+ * @return Number of bytes received, 0 on orderly shutdown, or -1 on error
+ */
+ssize_t lwt_recv(int fd, void* buf, size_t len, int flags);
+
+/**
+ * Sends on a socket
+ * 
+ * SIGPIPE is suppressed; a closed peer is reported as EPIPE.
+ * 
+ * @param fd Socket to send on
+ * @param buf Data to send
+ * @param len Number of bytes to send
+ * @param flags Flags as for send(2)
+ * @return Number of bytes sent, or -1 on error (errno set)
+ */
+ssize_t lwt_send(int fd, const void* buf, size_t len, int flags);
+
+/**
+ * Accepts a connection on a listening socket
+ * 
+ * With the epoll backend the accepted socket is non-blocking.
+ * 
+ * @param fd Listening socket
+ * @param addr Receives the peer address, or NULL
+ * @param addrlen In/out size of addr, or NULL
+ * @return Accepted socket, or -1 on error (errno set)
+ */
+int lwt_accept(int fd, struct sockaddr* addr, socklen_t* addrlen);
+
+/**
+ * Connects a socket
+ * 
+ * @param fd Socket to connect
+ * @param addr Address to connect to
+ * @param addrlen Size of addr
+ * @return 0 on success, -1 on error (errno set)
+ */
+int lwt_connect(int fd, const struct sockaddr* addr, socklen_t addrlen);
+
+/**
+ * Reads from a file at an offset
+ * 
+ * @param fd Descriptor to read from
+ * @param buf Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @param offset File offset to read at
+ * @return Number of bytes read, 0 at end of file, or -1 on error (errno set)
+ */
+ssize_t lwt_pread(int fd, void* buf, size_t count, off_t offset);
+
+/**
+ * Writes to a file at an offset
+ * 
+ * @param fd Descriptor to write to
+ * @param buf Data to write
+ * @param count Number of bytes to write
+ * @param offset File offset to write at
+ * @return Number of bytes written, or -1 on error (errno set)
+ */
+ssize_t lwt_pwrite(int fd, const void* buf, size_t count, off_t offset);
+
+/**
+ * Flushes a file to its storage device
+ * 
+ * @param fd Descriptor to flush
+ * @return 0 on success, -1 on error (errno set)
+ */
+int lwt_fsync(int fd);
+
+/**
+ * Opens a file relative to a directory descriptor
+ * 
+ * @param dirfd Directory descriptor, or AT_FDCWD
+ * @param pathname Path to open
+ * @param flags Flags as for openat(2)
+ * @param mode Mode for newly created files
+ * @return New descriptor, or -1 on error (errno set)
+ */
+int lwt_openat(int dirfd, const char* pathname, int flags, mode_t mode);
+
+/**
+ * Closes a descriptor used with the I/O functions
+ * 
+ * May be called from any thread. Threads parked on the descriptor, in
+ * every scheduler, fail with EBADF.
+ * 
+ * @param fd Descriptor to close
+ * @return 0 on success, -1 on error (errno set)
+ */
+int lwt_close(int fd);
+
 #ifdef __cplusplus
 }
 #endif
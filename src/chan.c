@@ -0,0 +1,348 @@
+/**
+ * @file chan.c
+ * @brief Buffered and unbuffered channels between lightweight threads
+ */
+
+#include "lwthread/lwthread.h"
+#include "chan.h"
+#include "scheduler.h"
+#include "thread.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+lwt_chan_t* lwt_chan_create(size_t elem_size, size_t capacity) {
+    if (elem_size != 0 && capacity > SIZE_MAX / elem_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    lwt_chan_t* chan = calloc(1, sizeof(lwt_chan_t));
+    if (NULL == chan) {
+        return NULL;
+    }
+    if (capacity * elem_size > 0) {
+        chan->buf = malloc(capacity * elem_size);
+        if (NULL == chan->buf) {
+            free(chan);
+            return NULL;
+        }
+    }
+    lwt_spin_init(&chan->lock);
+    chan->elem_size = elem_size;
+    chan->capacity = capacity;
+    return chan;
+}
+
+void lwt_chan_destroy(lwt_chan_t* chan) {
+    if (!chan) {
+        return;
+    }
+    free(chan->buf);
+    free(chan);
+}
+
+static void lwt_chan_copy(lwt_chan_t* chan, void* dst, const void* src) {
+    if (chan->elem_size > 0) {
+        memcpy(dst, src, chan->elem_size);
+    }
+}
+
+static void* lwt_chan_slot(lwt_chan_t* chan, size_t index) {
+    return chan->buf + index * chan->elem_size;
+}
+
+static void lwt_chan_waitq_push(lwt_chan_waitq_t* q, lwt_chan_waiter_t* waiter) {
+    waiter->next = NULL;
+    if (q->tail) {
+        q->tail->next = waiter;
+    } else {
+        q->head = waiter;
+    }
+    q->tail = waiter;
+}
+
+static lwt_chan_waiter_t* lwt_chan_waitq_pop(lwt_chan_waitq_t* q) {
+    lwt_chan_waiter_t* waiter = q->head;
+    if (waiter) {
+        q->head = waiter->next;
+        if (NULL == q->head) {
+            q->tail = NULL;
+        }
+    }
+    return waiter;
+}
+
+/* Wake a dequeued waiter; called with the lock held, returns with it dropped */
+static void lwt_chan_wake(lwt_chan_t* chan, lwt_chan_waiter_t* waiter) {
+    waiter->done = 1;
+    struct lwt_thread* thread = waiter->thread;
+    if (thread) {
+        /* Stays parked, and its waiter record valid, until we make it runnable */
+        lwt_spin_unlock(&chan->lock);
+        lwt_scheduler_add_thread(thread->scheduler, thread);
+    } else {
+        /* The OS thread cannot return until it retakes the lock */
+        lwt_parker_unpark(waiter->parker);
+        lwt_spin_unlock(&chan->lock);
+    }
+}
+
+/* Park function: a sender or receiver may complete us once the lock is dropped */
+static void lwt_chan_unlock(void* arg) {
+    lwt_spin_unlock((lwt_spinlock_t*)arg);
+}
+
+/* Block on q until woken; called with the lock held, returns with it dropped */
+static int lwt_chan_wait(lwt_chan_t* chan, lwt_chan_waitq_t* q, lwt_chan_waiter_t* waiter) {
+    struct lwt_thread* self = lwt_thread_self();
+    if (self && lwt_scheduler_current_worker()) {
+        waiter->thread = self;
+        lwt_chan_waitq_push(q, waiter);
+        self->state = LWT_STATE_BLOCKED;
+        lwt_scheduler_park(lwt_chan_unlock, &chan->lock);
+        return 0;
+    }
+
+    /* Not in a lightweight thread: sleep the OS thread */
+    lwt_parker_t parker;
+    if (lwt_parker_init(&parker) != 0) {
+        lwt_spin_unlock(&chan->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    waiter->thread = NULL;
+    waiter->parker = &parker;
+    lwt_chan_waitq_push(q, waiter);
+    while (!waiter->done) {
+        lwt_spin_unlock(&chan->lock);
+        lwt_parker_park(&parker, UINT64_MAX);
+        lwt_spin_lock(&chan->lock);
+    }
+    lwt_spin_unlock(&chan->lock);
+    lwt_parker_destroy(&parker);
+    return 0;
+}
+
+/*
+ * Waiter record for a blocking call; elem is the caller's element. A
+ * shared-stack thread may have its frames copied away while it waits, so
+ * its record and a staging copy of the element go on the heap instead.
+ * Called with the lock held; on failure drops it and returns NULL.
+ */
+static lwt_chan_waiter_t* lwt_chan_waiter_get(lwt_chan_t* chan, lwt_chan_waiter_t* local,
+                                              void* elem, int send) {
+    struct lwt_thread* self = lwt_thread_self();
+    if (NULL == self || NULL == self->home) {
+        memset(local, 0, sizeof(lwt_chan_waiter_t));
+        local->elem = elem;
+        return local;
+    }
+
+    size_t offset = (sizeof(lwt_chan_waiter_t) + _Alignof(max_align_t) - 1) &
+                    ~(_Alignof(max_align_t) - 1);
+    lwt_chan_waiter_t* waiter = calloc(1, offset + chan->elem_size);
+    if (NULL == waiter) {
+        lwt_spin_unlock(&chan->lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+    waiter->elem = (char*)waiter + offset;
+    if (send) {
+        lwt_chan_copy(chan, waiter->elem, elem);
+    }
+    return waiter;
+}
+
+/* Release a waiter record, delivering a received element; returns success */
+static int lwt_chan_waiter_put(lwt_chan_t* chan, lwt_chan_waiter_t* waiter,
+                               lwt_chan_waiter_t* local, void* elem, int send) {
+    int success = waiter->success;
+    if (waiter != local) {
+        if (!send && success) {
+            lwt_chan_copy(chan, elem, waiter->elem);
+        }
+        free(waiter);
+    }
+    return success;
+}
+
+static int lwt_chan_send_common(lwt_chan_t* chan, const void* elem, int block) {
+    lwt_spin_lock(&chan->lock);
+    if (chan->closed) {
+        lwt_spin_unlock(&chan->lock);
+        errno = EPIPE;
+        return -1;
+    }
+
+    /* A waiting receiver means the buffer is empty: copy straight to it */
+    lwt_chan_waiter_t* receiver = lwt_chan_waitq_pop(&chan->recvq);
+    if (receiver) {
+        lwt_chan_copy(chan, receiver->elem, elem);
+        receiver->success = 1;
+        lwt_chan_wake(chan, receiver);
+        return 0;
+    }
+
+    if (chan->count < chan->capacity) {
+        lwt_chan_copy(chan, lwt_chan_slot(chan, chan->sendx), elem);
+        chan->sendx = (chan->sendx + 1) % chan->capacity;
+        chan->count++;
+        lwt_spin_unlock(&chan->lock);
+        return 0;
+    }
+
+    if (!block) {
+        lwt_spin_unlock(&chan->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    lwt_chan_waiter_t local;
+    lwt_chan_waiter_t* waiter = lwt_chan_waiter_get(chan, &local, (void*)elem, 1);
+    if (NULL == waiter) {
+        return -1;
+    }
+    int rc = lwt_chan_wait(chan, &chan->sendq, waiter);
+    int success = lwt_chan_waiter_put(chan, waiter, &local, (void*)elem, 1);
+    if (rc != 0) {
+        return -1;
+    }
+    if (!success) {
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+static int lwt_chan_recv_common(lwt_chan_t* chan, void* elem, int block) {
+    lwt_spin_lock(&chan->lock);
+
+    /* A waiting sender means the buffer is full (or the channel unbuffered) */
+    lwt_chan_waiter_t* sender = lwt_chan_waitq_pop(&chan->sendq);
+    if (sender) {
+        if (0 == chan->capacity) {
+            lwt_chan_copy(chan, elem, sender->elem);
+        } else {
+            /* Take the oldest element and put the sender's in its slot */
+            void* slot = lwt_chan_slot(chan, chan->recvx);
+            lwt_chan_copy(chan, elem, slot);
+            lwt_chan_copy(chan, slot, sender->elem);
+            chan->recvx = (chan->recvx + 1) % chan->capacity;
+            chan->sendx = chan->recvx;
+        }
+        sender->success = 1;
+        lwt_chan_wake(chan, sender);
+        return 0;
+    }
+
+    if (chan->count > 0) {
+        lwt_chan_copy(chan, elem, lwt_chan_slot(chan, chan->recvx));
+        chan->recvx = (chan->recvx + 1) % chan->capacity;
+        chan->count--;
+        lwt_spin_unlock(&chan->lock);
+        return 0;
+    }
+
+    if (chan->closed) {
+        lwt_spin_unlock(&chan->lock);
+        errno = EPIPE;
+        return -1;
+    }
+    if (!block) {
+        lwt_spin_unlock(&chan->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    lwt_chan_waiter_t local;
+    lwt_chan_waiter_t* waiter = lwt_chan_waiter_get(chan, &local, elem, 0);
+    if (NULL == waiter) {
+        return -1;
+    }
+    int rc = lwt_chan_wait(chan, &chan->recvq, waiter);
+    int success = lwt_chan_waiter_put(chan, waiter, &local, elem, 0);
+    if (rc != 0) {
+        return -1;
+    }
+    if (!success) {
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+int lwt_chan_send(lwt_chan_t* chan, const void* elem) {
+    if (!chan) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lwt_chan_send_common(chan, elem, 1);
+}
+
+int lwt_chan_trysend(lwt_chan_t* chan, const void* elem) {
+    if (!chan) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lwt_chan_send_common(chan, elem, 0);
+}
+
+int lwt_chan_recv(lwt_chan_t* chan, void* elem) {
+    if (!chan) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lwt_chan_recv_common(chan, elem, 1);
+}
+
+int lwt_chan_tryrecv(lwt_chan_t* chan, void* elem) {
+    if (!chan) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lwt_chan_recv_common(chan, elem, 0);
+}
+
+int lwt_chan_close(lwt_chan_t* chan) {
+    if (!chan) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lwt_spin_lock(&chan->lock);
+    if (chan->closed) {
+        lwt_spin_unlock(&chan->lock);
+        errno = EPIPE;
+        return -1;
+    }
+    chan->closed = 1;
+
+    /* Fail every waiter; lightweight threads are readied once the lock is dropped */
+    struct lwt_thread* ready = NULL;
+    lwt_chan_waitq_t* queues[2] = { &chan->recvq, &chan->sendq };
+    for (int i = 0; i < 2; i++) {
+        lwt_chan_waiter_t* waiter;
+        while ((waiter = lwt_chan_waitq_pop(queues[i])) != NULL) {
+            waiter->success = 0;
+            waiter->done = 1;
+            if (waiter->thread) {
+                waiter->thread->next = ready;
+                ready = waiter->thread;
+            } else {
+                lwt_parker_unpark(waiter->parker);
+            }
+        }
+    }
+    lwt_spin_unlock(&chan->lock);
+
+    while (ready) {
+        struct lwt_thread* thread = ready;
+        ready = thread->next;
+        thread->next = NULL;
+        lwt_scheduler_add_thread(thread->scheduler, thread);
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file chan.h
+ * @brief Internal channel for communication between lightweight threads
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_CHAN_INTERNAL_H
+#define LWTHREAD_CHAN_INTERNAL_H
+
+#include "parker.h"
+#include "spinlock.h"
+#include <stddef.h>
+
+struct lwt_thread;
+
+/**
+ * A thread blocked in send or receive
+ *
+ * Lives on the blocked thread's stack. Whoever completes the operation
+ * copies the element straight to or from elem, so a value handed to a
+ * waiting receiver is copied once, not through the buffer. A shared-stack
+ * thread's frames may be copied away while it waits, so its waiter and a
+ * staging copy of the element live on the heap instead.
+ */
+typedef struct lwt_chan_waiter {
+    struct lwt_thread* thread;          /* Parked lightweight thread, or NULL */
+    lwt_parker_t* parker;               /* Parked OS thread when thread is NULL */
+    void* elem;                         /* Value to send, or where to receive */
+    int done;                           /* Set under the channel lock when woken */
+    int success;                        /* 0 if woken by lwt_chan_close() */
+    struct lwt_chan_waiter* next;
+} lwt_chan_waiter_t;
+
+/**
+ * FIFO of blocked threads
+ */
+typedef struct lwt_chan_waitq {
+    lwt_chan_waiter_t* head;
+    lwt_chan_waiter_t* tail;
+} lwt_chan_waitq_t;
+
+/**
+ * Channel structure
+ *
+ * Senders wait only while the buffer is full (always, if unbuffered) and
+ * receivers only while it is empty, so at most one of the queues is
+ * non-empty at any time.
+ */
+struct lwt_chan {
+    lwt_spinlock_t lock;                /* Protects everything below */
+    size_t elem_size;                   /* Size of one element */
+    size_t capacity;                    /* Buffer slots, 0 if unbuffered */
+    size_t count;                       /* Elements in the buffer */
+    size_t sendx;                       /* Next slot to fill */
+    size_t recvx;                       /* Next slot to take */
+    unsigned char* buf;                 /* capacity * elem_size bytes */
+    int closed;                         /* Set by lwt_chan_close() */
+    lwt_chan_waitq_t recvq;             /* Blocked receivers */
+    lwt_chan_waitq_t sendq;             /* Blocked senders */
+};
+
+#endif /* LWTHREAD_CHAN_INTERNAL_H */
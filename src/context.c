@@ -0,0 +1,81 @@
+/**
+ * @file context.c
+ * @brief Context creation and the ucontext fallback
+ */
+
+#include "context.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef LWT_CONTEXT_UCONTEXT
+
+int lwt_context_make(lwt_context_t* context, void* stack, size_t stack_size,
+                     lwt_context_entry_t entry) {
+    if (NULL == context || NULL == stack || NULL == entry) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (getcontext(&context->uc) == -1) {
+        return -1;
+    }
+
+    /*
+     * uc_link is NULL as we're implementing custom context switching
+     * rather than using the default chain-of-execution mechanism
+     */
+    context->uc.uc_stack.ss_sp = stack;
+    context->uc.uc_stack.ss_size = stack_size;
+    context->uc.uc_link = NULL;
+    makecontext(&context->uc, entry, 0);
+    return 0;
+}
+
+void lwt_context_switch(lwt_context_t* from, lwt_context_t* to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+#else
+
+/* First code run on a new stack; calls the entry function (see .S files) */
+extern void lwt_context_trampoline(void);
+
+int lwt_context_make(lwt_context_t* context, void* stack, size_t stack_size,
+                     lwt_context_entry_t entry) {
+    if (NULL == context || NULL == stack || NULL == entry) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+    /*
+     * Frame popped by lwt_context_switch, lowest address first:
+     * MXCSR and x87 control word, r15, r14, r13, r12, rbx, rbp, return
+     * address, then a zero slot standing in for the trampoline's caller.
+     */
+    uint64_t* frame = (uint64_t*)top - 9;
+    memset(frame, 0, 9 * sizeof(uint64_t));
+    frame[0] = 0x1F80 | ((uint64_t)0x037F << 32);   /* Default MXCSR / FPU CW */
+    frame[4] = (uint64_t)(uintptr_t)entry;          /* r12 */
+    frame[7] = (uint64_t)(uintptr_t)lwt_context_trampoline;
+#elif defined(__aarch64__)
+    /*
+     * Frame popped by lwt_context_switch: d8-d15, x19-x28, x29, x30.
+     * x19 carries the entry point, x30 returns into the trampoline.
+     */
+    uint64_t* frame = (uint64_t*)top - 20;
+    memset(frame, 0, 20 * sizeof(uint64_t));
+    frame[8] = (uint64_t)(uintptr_t)entry;          /* x19 */
+    frame[19] = (uint64_t)(uintptr_t)lwt_context_trampoline;
+#else
+#error "No assembly context switch for this architecture; configure with LWTHREAD_CONTEXT=ucontext"
+#endif
+
+    context->sp = frame;
+    return 0;
+}
+
+#endif /* LWT_CONTEXT_UCONTEXT */
@@ -0,0 +1,72 @@
+/**
+ * @file context.h
+ * @brief Internal execution context switching
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_CONTEXT_INTERNAL_H
+#define LWTHREAD_CONTEXT_INTERNAL_H
+
+#include <stddef.h>
+
+#ifdef LWT_CONTEXT_UCONTEXT
+#include <ucontext.h>
+
+/**
+ * Saved execution context (portable ucontext fallback)
+ */
+typedef struct lwt_context {
+    ucontext_t uc;                      /* Full machine context and signal mask */
+} lwt_context_t;
+#else
+
+/**
+ * Saved execution context
+ *
+ * Callee-saved registers are pushed onto the thread's own stack by
+ * lwt_context_switch, so only the stack pointer lives here.
+ */
+typedef struct lwt_context {
+    void* sp;                           /* Saved stack pointer */
+} lwt_context_t;
+
+/**
+ * A switched-out context lives entirely between sp and the top of its
+ * stack, so those bytes can be copied away and back to the same address
+ */
+#define LWT_CONTEXT_STACK_COPY 1
+#endif
+
+/**
+ * Entry point type for a new context
+ */
+typedef void (*lwt_context_entry_t)(void);
+
+/**
+ * Prepare a context that starts executing entry on the given stack
+ * 
+ * entry must never return.
+ * 
+ * @param context Context to initialize
+ * @param stack Lowest address of the stack
+ * @param stack_size Size of the stack
+ * @param entry Function to run when the context is first switched to
+ * @return 0 on success, -1 on failure
+ */
+int lwt_context_make(lwt_context_t* context, void* stack, size_t stack_size,
+                     lwt_context_entry_t entry);
+
+/**
+ * Save the current context into from and resume to
+ * 
+ * @param from Where to save the current context
+ * @param to Context to resume
+ */
+void lwt_context_switch(lwt_context_t* from, lwt_context_t* to);
+
+#endif /* LWTHREAD_CONTEXT_INTERNAL_H */
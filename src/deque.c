@@ -0,0 +1,100 @@
+/**
+ * @file deque.c
+ * @brief Per-worker work-stealing run queue implementation
+ */
+
+#include "deque.h"
+#include "thread.h"
+#include <stddef.h>
+
+#define LWT_DEQUE_MASK (LWT_DEQUE_SIZE - 1)
+
+void lwt_deque_init(lwt_deque_t* deque) {
+    atomic_init(&deque->head, 0);
+    atomic_init(&deque->tail, 0);
+    for (unsigned int i = 0; i < LWT_DEQUE_SIZE; i++) {
+        atomic_init(&deque->slots[i], NULL);
+    }
+}
+
+int lwt_deque_push(lwt_deque_t* deque, struct lwt_thread* thread) {
+    unsigned int head = atomic_load_explicit(&deque->head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(&deque->tail, memory_order_relaxed);
+    if (tail - head >= LWT_DEQUE_SIZE) {
+        return -1;
+    }
+    atomic_store_explicit(&deque->slots[tail & LWT_DEQUE_MASK], thread,
+                          memory_order_relaxed);
+    /* Publish the slot before thieves can see the new tail */
+    atomic_store_explicit(&deque->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+struct lwt_thread* lwt_deque_pop(lwt_deque_t* deque) {
+    for (;;) {
+        unsigned int head = atomic_load_explicit(&deque->head, memory_order_acquire);
+        unsigned int tail = atomic_load_explicit(&deque->tail, memory_order_relaxed);
+        if (head == tail) {
+            return NULL;
+        }
+        struct lwt_thread* thread = atomic_load_explicit(
+            &deque->slots[head & LWT_DEQUE_MASK], memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&deque->head, &head, head + 1,
+                                                  memory_order_release,
+                                                  memory_order_relaxed)) {
+            return thread;
+        }
+    }
+}
+
+unsigned int lwt_deque_grab(lwt_deque_t* deque, struct lwt_thread** batch) {
+    for (;;) {
+        unsigned int head = atomic_load_explicit(&deque->head, memory_order_acquire);
+        unsigned int tail = atomic_load_explicit(&deque->tail, memory_order_acquire);
+        unsigned int n = tail - head;
+        n = n - n / 2;
+        if (0 == n) {
+            return 0;
+        }
+        if (n > LWT_DEQUE_SIZE / 2) {
+            /* head and tail were read at different times, try again */
+            continue;
+        }
+        /*
+         * The owner only writes slots at or beyond the tail while fewer
+         * than LWT_DEQUE_SIZE threads are queued, so the slots we copy
+         * cannot change as long as head has not moved. The CAS below
+         * confirms that.
+         */
+        for (unsigned int i = 0; i < n; i++) {
+            batch[i] = atomic_load_explicit(
+                &deque->slots[(head + i) & LWT_DEQUE_MASK], memory_order_relaxed);
+        }
+        if (atomic_compare_exchange_weak_explicit(&deque->head, &head, head + n,
+                                                  memory_order_release,
+                                                  memory_order_relaxed)) {
+            return n;
+        }
+    }
+}
+
+struct lwt_thread* lwt_deque_steal(lwt_deque_t* deque, lwt_deque_t* victim) {
+    struct lwt_thread* batch[LWT_DEQUE_SIZE / 2];
+    unsigned int n = lwt_deque_grab(victim, batch);
+    if (0 == n) {
+        return NULL;
+    }
+    /* Our own queue was empty and n is at most half its capacity */
+    for (unsigned int i = 1; i < n; i++) {
+        lwt_deque_push(deque, batch[i]);
+    }
+    return batch[0];
+}
+
+unsigned int lwt_deque_size(lwt_deque_t* deque) {
+    unsigned int head = atomic_load_explicit(&deque->head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(&deque->tail, memory_order_acquire);
+    /* A stale head can make the difference briefly look negative */
+    unsigned int n = tail - head;
+    return n > LWT_DEQUE_SIZE ? 0 : n;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file deque.h
+ * @brief Internal per-worker run queue with work stealing
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_DEQUE_INTERNAL_H
+#define LWTHREAD_DEQUE_INTERNAL_H
+
+#include <stdatomic.h>
+
+/**
+ * Capacity of a worker's local run queue (must be a power of two)
+ */
+#define LWT_DEQUE_SIZE 256
+
+/**
+ * Bounded work-stealing run queue
+ *
+ * Chase-Lev style ring: only the owning worker pushes at the tail, while
+ * the owner and thieves take from the head with a CAS. The owner also
+ * takes from the head so that yielded threads go behind the work already
+ * queued instead of being resumed immediately.
+ */
+typedef struct lwt_deque {
+    atomic_uint head;                                   /* Next slot to take (owner and thieves) */
+    atomic_uint tail;                                   /* Next slot to fill (owner only) */
+    struct lwt_thread* _Atomic slots[LWT_DEQUE_SIZE];   /* Ring of queued threads */
+} lwt_deque_t;
+
+/**
+ * Initialize a run queue
+ * 
+ * @param deque Queue to initialize
+ */
+void lwt_deque_init(lwt_deque_t* deque);
+
+/**
+ * Push a thread onto the tail of the queue (owner only)
+ * 
+ * @param deque Queue to push to
+ * @param thread Thread to push
+ * @return 0 on success, -1 if the queue is full
+ */
+int lwt_deque_push(lwt_deque_t* deque, struct lwt_thread* thread);
+
+/**
+ * Pop a thread from the head of the queue (owner only)
+ * 
+ * @param deque Queue to pop from
+ * @return Thread or NULL if queue is empty
+ */
+struct lwt_thread* lwt_deque_pop(lwt_deque_t* deque);
+
+/**
+ * Take up to half of the queued threads from the head of a queue
+ * 
+ * Safe to call from any thread.
+ * 
+ * @param deque Queue to take from
+ * @param batch Array of at least LWT_DEQUE_SIZE / 2 entries to fill
+ * @return Number of threads taken
+ */
+unsigned int lwt_deque_grab(lwt_deque_t* deque, struct lwt_thread** batch);
+
+/**
+ * Steal half of another worker's queue into our own
+ * 
+ * @param deque Queue of the calling worker (must be empty)
+ * @param victim Queue to steal from
+ * @return One stolen thread to run, or NULL if nothing was stolen
+ */
+struct lwt_thread* lwt_deque_steal(lwt_deque_t* deque, lwt_deque_t* victim);
+
+/**
+ * Get the approximate number of queued threads
+ * 
+ * @param deque Queue to check
+ * @return Number of threads in the queue
+ */
+unsigned int lwt_deque_size(lwt_deque_t* deque);
+
+#endif /* LWTHREAD_DEQUE_INTERNAL_H */
@@ -0,0 +1,87 @@
+/**
+ * @file edf.c
+ * @brief Deadline heap implementation
+ */
+
+#include "edf.h"
+#include "thread.h"
+
+void lwt_edf_init(lwt_edf_heap_t* heap) {
+    lwt_spin_init(&heap->lock);
+    heap->root = NULL;
+    atomic_init(&heap->count, 0);
+}
+
+/* Link two heap roots, the later deadline becoming a child of the earlier */
+static struct lwt_thread* lwt_edf_meld(struct lwt_thread* a, struct lwt_thread* b) {
+    if (NULL == a) {
+        return b;
+    }
+    if (NULL == b) {
+        return a;
+    }
+    if (b->deadline < a->deadline) {
+        struct lwt_thread* t = a;
+        a = b;
+        b = t;
+    }
+    b->edf_sibling = a->edf_child;
+    a->edf_child = b;
+    return a;
+}
+
+/* Standard two-pass merge of a removed root's children */
+static struct lwt_thread* lwt_edf_merge_pairs(struct lwt_thread* first) {
+    /* Meld neighbours left to right, collecting the results in reverse */
+    struct lwt_thread* pairs = NULL;
+    while (first) {
+        struct lwt_thread* a = first;
+        struct lwt_thread* b = a->edf_sibling;
+        first = b ? b->edf_sibling : NULL;
+        a->edf_sibling = NULL;
+        if (b) {
+            b->edf_sibling = NULL;
+        }
+        struct lwt_thread* tree = lwt_edf_meld(a, b);
+        tree->edf_sibling = pairs;
+        pairs = tree;
+    }
+
+    /* Then meld the pairs right to left into one tree */
+    struct lwt_thread* root = NULL;
+    while (pairs) {
+        struct lwt_thread* next = pairs->edf_sibling;
+        pairs->edf_sibling = NULL;
+        root = lwt_edf_meld(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+void lwt_edf_push(lwt_edf_heap_t* heap, struct lwt_thread* thread) {
+    thread->edf_child = NULL;
+    thread->edf_sibling = NULL;
+    lwt_spin_lock(&heap->lock);
+    heap->root = lwt_edf_meld(heap->root, thread);
+    lwt_spin_unlock(&heap->lock);
+    atomic_fetch_add_explicit(&heap->count, 1, memory_order_release);
+}
+
+struct lwt_thread* lwt_edf_pop(lwt_edf_heap_t* heap) {
+    if (0 == atomic_load_explicit(&heap->count, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    lwt_spin_lock(&heap->lock);
+    struct lwt_thread* thread = heap->root;
+    if (thread) {
+        heap->root = lwt_edf_merge_pairs(thread->edf_child);
+        thread->edf_child = NULL;
+    }
+    lwt_spin_unlock(&heap->lock);
+
+    if (thread) {
+        atomic_fetch_sub_explicit(&heap->count, 1, memory_order_relaxed);
+    }
+    return thread;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file edf.h
+ * @brief Internal per-worker earliest-deadline-first run queue
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_EDF_INTERNAL_H
+#define LWTHREAD_EDF_INTERNAL_H
+
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Pairing heap of ready threads ordered by deadline
+ *
+ * Intrusive: threads are linked through edf_child and edf_sibling, so
+ * pushing is O(1) and never allocates, and popping is O(log n) amortized.
+ * Owned by one worker; other workers only take from it when stealing, so
+ * the lock is uncontended in practice.
+ */
+typedef struct lwt_edf_heap {
+    lwt_spinlock_t lock;                /* Protects root */
+    struct lwt_thread* root;            /* Thread with the earliest deadline */
+    atomic_int count;                   /* Queued threads (readable without the lock) */
+} lwt_edf_heap_t;
+
+/**
+ * Initialize a deadline heap
+ *
+ * @param heap Heap to initialize
+ */
+void lwt_edf_init(lwt_edf_heap_t* heap);
+
+/**
+ * Queue a thread, keyed by its deadline
+ *
+ * @param heap Heap to push to
+ * @param thread Thread to push
+ */
+void lwt_edf_push(lwt_edf_heap_t* heap, struct lwt_thread* thread);
+
+/**
+ * Take the thread with the earliest deadline
+ *
+ * @param heap Heap to pop from
+ * @return Thread or NULL if the heap is empty
+ */
+struct lwt_thread* lwt_edf_pop(lwt_edf_heap_t* heap);
+
+#endif /* LWTHREAD_EDF_INTERNAL_H */
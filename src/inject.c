@@ -0,0 +1,79 @@
+/**
+ * @file inject.c
+ * @brief Injection queue implementation
+ */
+
+#include "inject.h"
+#include "thread.h"
+#include <stddef.h>
+
+/* Thread owning an injection link */
+#define LWT_INJECT_THREAD(link) \
+    ((struct lwt_thread*)((char*)(link) - offsetof(struct lwt_thread, inject_link)))
+
+void lwt_inject_init(lwt_inject_t* q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    atomic_init(&q->count, 0);
+    lwt_spin_init(&q->lock);
+    q->tail = &q->stub;
+}
+
+/* Append a link: claim the head slot, then point the old head at it */
+static void lwt_inject_link(lwt_inject_t* q, lwt_inject_link_t* link) {
+    atomic_store_explicit(&link->next, NULL, memory_order_relaxed);
+    lwt_inject_link_t* prev = atomic_exchange_explicit(&q->head, link, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, link, memory_order_release);
+}
+
+void lwt_inject_push(lwt_inject_t* q, struct lwt_thread* thread) {
+    lwt_inject_link(q, &thread->inject_link);
+    atomic_fetch_add_explicit(&q->count, 1, memory_order_release);
+}
+
+void lwt_inject_push_list(lwt_inject_t* q, struct lwt_thread* first, int count) {
+    /* Chain the links privately, then splice the chain in like a single link */
+    struct lwt_thread* last = first;
+    for (int i = 1; i < count; i++) {
+        atomic_store_explicit(&last->inject_link.next, &last->next->inject_link,
+                              memory_order_relaxed);
+        last = last->next;
+    }
+    atomic_store_explicit(&last->inject_link.next, NULL, memory_order_relaxed);
+
+    lwt_inject_link_t* prev = atomic_exchange_explicit(&q->head, &last->inject_link,
+                                                       memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, &first->inject_link, memory_order_release);
+    atomic_fetch_add_explicit(&q->count, count, memory_order_release);
+}
+
+struct lwt_thread* lwt_inject_pop(lwt_inject_t* q) {
+    lwt_inject_link_t* tail = q->tail;
+    lwt_inject_link_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    /* Step over the stub */
+    if (tail == &q->stub) {
+        if (NULL == next) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (NULL == next) {
+        /* tail looks last: unless a push is half done, put the stub behind it */
+        if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+            return NULL;
+        }
+        lwt_inject_link(q, &q->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (NULL == next) {
+            return NULL;
+        }
+    }
+
+    q->tail = next;
+    atomic_fetch_sub_explicit(&q->count, 1, memory_order_relaxed);
+    return LWT_INJECT_THREAD(tail);
+}
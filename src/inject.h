@@ -0,0 +1,90 @@
+/**
+ * @file inject.h
+ * @brief Internal lock-free queue for threads readied off the workers
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_INJECT_INTERNAL_H
+#define LWTHREAD_INJECT_INTERNAL_H
+
+#include "spinlock.h"
+#include <stdatomic.h>
+
+/* Forward declarations */
+struct lwt_thread;
+
+/**
+ * Link embedded in each thread for the injection queue
+ */
+typedef struct lwt_inject_link {
+    struct lwt_inject_link* _Atomic next;
+} lwt_inject_link_t;
+
+/**
+ * Intrusive multi-producer, single-consumer queue (Dmitry Vyukov's)
+ *
+ * Pushing is one atomic exchange on head and a store, with no lock and no
+ * retry loop, however many OS threads push at once. The consumer end is
+ * guarded by a spinlock that workers only try: whoever holds it drains a
+ * batch, and the others move on to other work rather than wait.
+ *
+ * A push that has swapped head but not yet linked its predecessor leaves
+ * the queue briefly cut short; the consumer then sees it as empty and the
+ * thread is found on a later look, as the pusher's wakeup guarantees.
+ */
+typedef struct lwt_inject {
+    lwt_inject_link_t* _Atomic head;    /* Most recently pushed link */
+    atomic_int count;                   /* Queued threads (may lag pushes) */
+    lwt_spinlock_t lock;                /* Held by the one consumer */
+    lwt_inject_link_t* tail;            /* Oldest link, possibly the stub */
+    lwt_inject_link_t stub;             /* Keeps the list non-empty */
+} lwt_inject_t;
+
+/**
+ * Initialize an injection queue
+ *
+ * @param q Queue to initialize
+ */
+void lwt_inject_init(lwt_inject_t* q);
+
+/**
+ * Queue a thread (any thread may call this)
+ *
+ * @param q Queue to push to
+ * @param thread Thread to push
+ */
+void lwt_inject_push(lwt_inject_t* q, struct lwt_thread* thread);
+
+/**
+ * Queue a list of threads with a single exchange (any thread may call this)
+ *
+ * @param q Queue to push to
+ * @param first First thread, the rest linked through next
+ * @param count Number of threads in the list
+ */
+void lwt_inject_push_list(lwt_inject_t* q, struct lwt_thread* first, int count);
+
+/**
+ * Take the oldest thread (consumer lock held)
+ *
+ * @param q Queue to pop from
+ * @return Thread or NULL if the queue is empty or a push is half done
+ */
+struct lwt_thread* lwt_inject_pop(lwt_inject_t* q);
+
+/**
+ * Get the number of queued threads without any lock
+ *
+ * @param q Queue to check
+ * @return Approximate number of threads
+ */
+static inline int lwt_inject_size(lwt_inject_t* q) {
+    return atomic_load_explicit(&q->count, memory_order_relaxed);
+}
+
+#endif /* LWTHREAD_INJECT_INTERNAL_H */
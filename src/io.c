@@ -0,0 +1,358 @@
+/**
+ * @file io.c
+ * @brief I/O wrappers that park the calling thread until completion
+ */
+
+#define _GNU_SOURCE
+#include "lwthread/lwthread.h"
+#include "io.h"
+#include "netpoll.h"
+#include "scheduler.h"
+#include "thread.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifndef SOCK_NONBLOCK
+/* No accept4: lwt_io_syscall applies O_NONBLOCK itself */
+#define SOCK_NONBLOCK O_NONBLOCK
+#endif
+
+long lwt_io_syscall(lwt_io_request_t* req) {
+    long rc = -1;
+    switch (req->opcode) {
+    case LWT_IO_OP_READ:
+        rc = read(req->fd, req->buf, req->len);
+        break;
+    case LWT_IO_OP_WRITE:
+        rc = write(req->fd, req->buf, req->len);
+        break;
+    case LWT_IO_OP_PREAD:
+        rc = pread(req->fd, req->buf, req->len, req->offset);
+        break;
+    case LWT_IO_OP_PWRITE:
+        rc = pwrite(req->fd, req->buf, req->len, req->offset);
+        break;
+    case LWT_IO_OP_FSYNC:
+        rc = fsync(req->fd);
+        break;
+    case LWT_IO_OP_OPENAT:
+        rc = openat(req->fd, req->path, req->flags, req->mode);
+        break;
+    case LWT_IO_OP_RECV:
+        rc = recv(req->fd, req->buf, req->len, req->flags);
+        break;
+    case LWT_IO_OP_SEND:
+        rc = send(req->fd, req->buf, req->len, req->flags);
+        break;
+    case LWT_IO_OP_ACCEPT:
+#ifdef __linux__
+        rc = accept4(req->fd, req->addr, req->addrlenp, req->flags);
+#else
+        rc = accept(req->fd, req->addr, req->addrlenp);
+        if (rc >= 0 && (req->flags & SOCK_NONBLOCK)) {
+            fcntl((int)rc, F_SETFL, fcntl((int)rc, F_GETFL) | O_NONBLOCK);
+        }
+#endif
+        break;
+    case LWT_IO_OP_CONNECT:
+        rc = connect(req->fd, req->addr, req->addrlen);
+        break;
+    case LWT_IO_OP_POLL: {
+        struct pollfd pfd;
+        pfd.fd = req->fd;
+        pfd.events = (short)req->flags;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, -1);
+        if (rc > 0) {
+            rc = pfd.revents;
+        }
+        break;
+    }
+    }
+    return rc < 0 ? -errno : rc;
+}
+
+/* Set up a request for an operation on fd */
+static void lwt_io_prepare(lwt_io_request_t* req, lwt_io_opcode_t opcode, int fd) {
+    memset(req, 0, sizeof(lwt_io_request_t));
+    req->opcode = opcode;
+    req->fd = fd;
+}
+
+/* Convert a request result to the system call convention */
+static long lwt_io_result(long rc) {
+    if (rc < 0) {
+        errno = (int)-rc;
+        return -1;
+    }
+    return rc;
+}
+
+/* Park on a request; cancellation only happens when the descriptor is closed */
+static long lwt_io_submit(lwt_io_request_t* req) {
+    /* Counted on ring requests, so that lwt_close only cancels when there are some */
+    struct lwt_worker* worker = lwt_scheduler_current_worker();
+    lwt_pollfd_t* pd = NULL;
+    if (worker->uring.fd >= 0 && req->fd >= 0) {
+        pd = lwt_netpoll_state(&worker->scheduler->netpoll, req->fd);
+    }
+    if (pd) {
+        atomic_fetch_add_explicit(&pd->inflight, 1, memory_order_relaxed);
+    }
+    long rc = lwt_scheduler_submit_io(req);
+    if (pd) {
+        atomic_fetch_sub_explicit(&pd->inflight, 1, memory_order_relaxed);
+    }
+    return (-ECANCELED == rc) ? -EBADF : rc;
+}
+
+/*
+ * The ring and the blocking pool fill the request and its buffers while
+ * the caller is parked. A shared-stack thread's frames may be copied away
+ * by then, so it polls and runs the system call itself instead.
+ */
+static int lwt_io_shared_stack(void) {
+    struct lwt_thread* self = lwt_thread_self();
+    return self && self->home;
+}
+
+/* How the calling thread waits for a descriptor */
+typedef struct lwt_io {
+    int fd;
+    int uring;                  /* Submit to the worker's ring */
+    int unpollable;             /* Not pollable (a regular file): use the blocking pool */
+    lwt_netpoll_t* netpoll;     /* Poller, or NULL outside the scheduler */
+    lwt_pollfd_t* pd;           /* Poll state of fd */
+    unsigned int edges;         /* Edges of pd seen before the last attempt */
+} lwt_io_t;
+
+static void lwt_io_begin(lwt_io_t* io, int fd) {
+    memset(io, 0, sizeof(lwt_io_t));
+    io->fd = fd;
+
+    struct lwt_worker* worker = lwt_scheduler_current_worker();
+    if (!worker || !lwt_thread_self()) {
+        return;
+    }
+    if (worker->uring.fd >= 0 && !lwt_io_shared_stack()) {
+        io->uring = 1;
+        return;
+    }
+    if (worker->scheduler->netpoll.epfd >= 0) {
+        io->netpoll = &worker->scheduler->netpoll;
+        io->pd = lwt_netpoll_fd(io->netpoll, fd);
+        /* EPERM: regular files are always ready and cannot be polled */
+        io->unpollable = (NULL == io->pd && EPERM == errno);
+    }
+}
+
+/* Note the edges seen so far before an attempt, so that lwt_io_wait misses none */
+static void lwt_io_arm(lwt_io_t* io, lwt_poll_mode_t mode) {
+    if (io->pd) {
+        io->edges = lwt_netpoll_edges(io->pd, mode);
+    }
+}
+
+/* Wait until the operation is worth retrying; -1 on error */
+static int lwt_io_wait(lwt_io_t* io, lwt_poll_mode_t mode) {
+    short events = (LWT_POLL_READ == mode) ? POLLIN : POLLOUT;
+
+    if (io->uring) {
+        lwt_io_request_t req;
+        lwt_io_prepare(&req, LWT_IO_OP_POLL, io->fd);
+        req.flags = events;
+        return lwt_io_result(lwt_io_submit(&req)) < 0 ? -1 : 0;
+    }
+    if (io->pd) {
+        return lwt_netpoll_wait(io->netpoll, io->pd, mode, io->edges);
+    }
+
+    /* Not on a worker (or fd not pollable): block this OS thread */
+    struct pollfd pfd;
+    pfd.fd = io->fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int lwt_io_again(long rc) {
+    return -EAGAIN == rc || -EWOULDBLOCK == rc || -EINTR == rc;
+}
+
+/* Run a file request: on the ring, on the blocking pool, or inline */
+static long lwt_io_file(lwt_io_request_t* req) {
+    if (lwt_thread_self() && lwt_scheduler_current_worker() && !lwt_io_shared_stack()) {
+        return lwt_io_submit(req);
+    }
+    return lwt_io_syscall(req);
+}
+
+/* Run a descriptor request, waiting for readiness whenever it would block */
+static long lwt_io_socket(lwt_io_request_t* req, lwt_poll_mode_t mode) {
+    lwt_io_t io;
+    lwt_io_begin(&io, req->fd);
+    if (io.unpollable) {
+        return lwt_io_file(req);
+    }
+
+    for (;;) {
+        /* Blocking sockets complete inside io_uring; non-blocking ones report EAGAIN */
+        lwt_io_arm(&io, mode);
+        long rc = io.uring ? lwt_io_submit(req) : lwt_io_syscall(req);
+        if (!lwt_io_again(rc)) {
+            return rc;
+        }
+        if (-EINTR != rc && lwt_io_wait(&io, mode) != 0) {
+            return -errno;
+        }
+    }
+}
+
+ssize_t lwt_read(int fd, void* buf, size_t count) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_READ, fd);
+    req.buf = buf;
+    req.len = count;
+    return lwt_io_result(lwt_io_socket(&req, LWT_POLL_READ));
+}
+
+ssize_t lwt_write(int fd, const void* buf, size_t count) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_WRITE, fd);
+    req.buf = (void*)buf;
+    req.len = count;
+    return lwt_io_result(lwt_io_socket(&req, LWT_POLL_WRITE));
+}
+
+ssize_t lwt_recv(int fd, void* buf, size_t len, int flags) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_RECV, fd);
+    req.buf = buf;
+    req.len = len;
+    req.flags = flags;
+    return lwt_io_result(lwt_io_socket(&req, LWT_POLL_READ));
+}
+
+ssize_t lwt_send(int fd, const void* buf, size_t len, int flags) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_SEND, fd);
+    req.buf = (void*)buf;
+    req.len = len;
+    req.flags = flags | MSG_NOSIGNAL;
+    return lwt_io_result(lwt_io_socket(&req, LWT_POLL_WRITE));
+}
+
+int lwt_accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_ACCEPT, fd);
+    req.addr = addr;
+    req.addrlenp = addrlen;
+    /* With epoll, accepted sockets are non-blocking so they can use the poller too */
+    struct lwt_worker* worker = lwt_scheduler_current_worker();
+    if (!worker || worker->uring.fd < 0 || lwt_io_shared_stack()) {
+        req.flags = SOCK_NONBLOCK;
+    }
+
+    long rc;
+    do {
+        rc = lwt_io_socket(&req, LWT_POLL_READ);
+    } while (-ECONNABORTED == rc);
+    return (int)lwt_io_result(rc);
+}
+
+int lwt_connect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
+    lwt_io_t io;
+    lwt_io_begin(&io, fd);
+
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_CONNECT, fd);
+    req.addr = (struct sockaddr*)addr;
+    req.addrlen = addrlen;
+    lwt_io_arm(&io, LWT_POLL_WRITE);
+    long rc = io.uring ? lwt_io_submit(&req) : lwt_io_syscall(&req);
+    if (0 == rc) {
+        return 0;
+    }
+    if (-EINPROGRESS != rc && -EINTR != rc && -EAGAIN != rc) {
+        return (int)lwt_io_result(rc);
+    }
+
+    /* Non-blocking socket: wait for writability and read the outcome */
+    for (;;) {
+        if (lwt_io_wait(&io, LWT_POLL_WRITE) != 0) {
+            return -1;
+        }
+
+        lwt_io_arm(&io, LWT_POLL_WRITE);
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+            return -1;
+        }
+        if (EINPROGRESS == error || EALREADY == error || EINTR == error) {
+            continue;
+        }
+        if (error != 0) {
+            errno = error;
+            return -1;
+        }
+
+        /* A stale write edge can wake us before the handshake is done */
+        struct sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(fd, (struct sockaddr*)&peer, &peer_len) == 0) {
+            return 0;
+        }
+        if (ENOTCONN != errno) {
+            return -1;
+        }
+    }
+}
+
+ssize_t lwt_pread(int fd, void* buf, size_t count, off_t offset) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_PREAD, fd);
+    req.buf = buf;
+    req.len = count;
+    req.offset = offset;
+    return lwt_io_result(lwt_io_file(&req));
+}
+
+ssize_t lwt_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_PWRITE, fd);
+    req.buf = (void*)buf;
+    req.len = count;
+    req.offset = offset;
+    return lwt_io_result(lwt_io_file(&req));
+}
+
+int lwt_fsync(int fd) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_FSYNC, fd);
+    return (int)lwt_io_result(lwt_io_file(&req));
+}
+
+int lwt_openat(int dirfd, const char* pathname, int flags, mode_t mode) {
+    lwt_io_request_t req;
+    lwt_io_prepare(&req, LWT_IO_OP_OPENAT, dirfd);
+    req.path = pathname;
+    req.flags = flags;
+    req.mode = mode;
+    return (int)lwt_io_result(lwt_io_file(&req));
+}
+
+int lwt_close(int fd) {
+    /* Whoever closes it, no scheduler may keep state for the descriptor number */
+    lwt_scheduler_close_fd(fd);
+    return close(fd);
+}
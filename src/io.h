@@ -0,0 +1,66 @@
+/**
+ * @file io.h
+ * @brief Internal I/O request description shared by the I/O backends
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_IO_INTERNAL_H
+#define LWTHREAD_IO_INTERNAL_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * Operations an I/O request can describe
+ */
+typedef enum {
+    LWT_IO_OP_READ,
+    LWT_IO_OP_WRITE,
+    LWT_IO_OP_PREAD,
+    LWT_IO_OP_PWRITE,
+    LWT_IO_OP_FSYNC,
+    LWT_IO_OP_OPENAT,
+    LWT_IO_OP_RECV,
+    LWT_IO_OP_SEND,
+    LWT_IO_OP_ACCEPT,
+    LWT_IO_OP_CONNECT,
+    LWT_IO_OP_POLL          /* Wait for the events in flags */
+} lwt_io_opcode_t;
+
+/**
+ * An I/O operation issued by a thread
+ *
+ * Requests live on the issuing thread's stack while it is parked, and are
+ * completed either by an io_uring completion or by the blocking pool.
+ */
+typedef struct lwt_io_request {
+    lwt_io_opcode_t opcode;         /* Operation */
+    int fd;                         /* Descriptor (directory for openat) */
+    void* buf;                      /* Data buffer */
+    size_t len;                     /* Size of buf */
+    off_t offset;                   /* File offset for pread/pwrite */
+    int flags;                      /* recv/send/open flags, or poll events */
+    mode_t mode;                    /* openat mode */
+    const char* path;               /* openat path */
+    struct sockaddr* addr;          /* accept/connect address */
+    socklen_t addrlen;              /* connect address length */
+    socklen_t* addrlenp;            /* accept address length (in/out) */
+    struct lwt_thread* thread;      /* Thread parked on the request */
+    long result;                    /* Result, or -errno on failure */
+    struct lwt_io_request* next;    /* Link in the blocking pool queue */
+} lwt_io_request_t;
+
+/**
+ * Perform a request with plain (possibly blocking) system calls
+ *
+ * @param req Request to perform
+ * @return Result, or -errno on failure
+ */
+long lwt_io_syscall(lwt_io_request_t* req);
+
+#endif /* LWTHREAD_IO_INTERNAL_H */
@@ -0,0 +1,90 @@
+/**
+ * @file iopool.c
+ * @brief Blocking I/O pool implementation
+ */
+
+#include "iopool.h"
+#include "scheduler.h"
+#include <errno.h>
+#include <string.h>
+
+int lwt_iopool_init(lwt_iopool_t* pool, struct lwt_scheduler* scheduler) {
+    memset(pool, 0, sizeof(lwt_iopool_t));
+    pool->scheduler = scheduler;
+
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&pool->cond, NULL) != 0) {
+        pthread_mutex_destroy(&pool->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+void lwt_iopool_destroy(lwt_iopool_t* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+static void* lwt_iopool_function(void* arg) {
+    lwt_iopool_t* pool = (lwt_iopool_t*)arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->stopping) {
+        lwt_io_request_t* req = pool->head;
+        if (NULL == req) {
+            pool->nidle++;
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            pool->nidle--;
+            continue;
+        }
+        pool->head = req->next;
+        if (NULL == pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        req->result = lwt_io_syscall(req);
+        lwt_scheduler_add_thread(pool->scheduler, req->thread);
+
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+int lwt_iopool_submit(lwt_iopool_t* pool, lwt_io_request_t* req) {
+    req->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    /* Start another thread if every running one is busy */
+    if (0 == pool->nidle && pool->nthreads < LWT_IOPOOL_THREADS) {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL,
+                           lwt_iopool_function, pool) == 0) {
+            pool->nthreads++;
+        } else if (0 == pool->nthreads) {
+            pthread_mutex_unlock(&pool->mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    if (pool->tail) {
+        pool->tail->next = req;
+    } else {
+        pool->head = req;
+    }
+    pool->tail = req;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
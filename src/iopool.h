@@ -0,0 +1,66 @@
+/**
+ * @file iopool.h
+ * @brief Internal pool of OS threads for I/O that cannot be polled
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_IOPOOL_INTERNAL_H
+#define LWTHREAD_IOPOOL_INTERNAL_H
+
+#include "io.h"
+#include <pthread.h>
+
+/**
+ * Maximum number of blocking I/O threads per scheduler
+ */
+#define LWT_IOPOOL_THREADS 4
+
+/**
+ * Blocking I/O pool
+ *
+ * Without io_uring, file operations run on these threads while the issuing
+ * lightweight thread is parked. Threads are started on demand.
+ */
+typedef struct lwt_iopool {
+    pthread_mutex_t mutex;                      /* Protects the fields below */
+    pthread_cond_t cond;                        /* Signalled when requests are queued */
+    lwt_io_request_t* head;                     /* Queued requests */
+    lwt_io_request_t* tail;
+    struct lwt_scheduler* scheduler;            /* Scheduler to ready threads on */
+    pthread_t threads[LWT_IOPOOL_THREADS];      /* Started pool threads */
+    int nthreads;                               /* Number of started threads */
+    int nidle;                                  /* Threads waiting for requests */
+    int stopping;                               /* Set when the pool is destroyed */
+} lwt_iopool_t;
+
+/**
+ * Initialize a pool; no threads are started yet
+ *
+ * @param pool Pool to initialize
+ * @param scheduler Scheduler that owns it
+ * @return 0 on success, -1 on failure
+ */
+int lwt_iopool_init(lwt_iopool_t* pool, struct lwt_scheduler* scheduler);
+
+/**
+ * Stop the pool threads and destroy the pool
+ *
+ * @param pool Pool to destroy
+ */
+void lwt_iopool_destroy(lwt_iopool_t* pool);
+
+/**
+ * Queue a request; its thread is readied with the result once done
+ *
+ * @param pool Pool to use
+ * @param req Request with thread set
+ * @return 0 on success, -1 if no pool thread could be started
+ */
+int lwt_iopool_submit(lwt_iopool_t* pool, lwt_io_request_t* req);
+
+#endif /* LWTHREAD_IOPOOL_INTERNAL_H */
@@ -12,29 +12,88 @@
 #include <time.h>
 #include <errno.h>
 
-#define CLOCK_REALTIME 0
+/* Initialize scheduler attributes */
+void lwt_scheduler_attr_init(lwt_scheduler_attr_t* attr) {
+    if (!attr) {
+        return;
+    }
+    
+    memset(attr, 0, sizeof(lwt_scheduler_attr_t));
+    attr->num_threads = 1;
+    attr->io_backend = LWT_IO_AUTO;
+    attr->uring_entries = LWT_URING_ENTRIES;
+}
 
 /* Create a new scheduler */
 lwt_scheduler_t* lwt_scheduler_create(int num_threads) {
-    if (num_threads <= 0 || num_threads > LWT_MAX_WORKERS) {
+    lwt_scheduler_attr_t attr;
+    lwt_scheduler_attr_init(&attr);
+    attr.num_threads = num_threads;
+    return lwt_scheduler_create_ex(&attr);
+}
+
+/* Create a new scheduler from attributes */
+lwt_scheduler_t* lwt_scheduler_create_ex(const lwt_scheduler_attr_t* attr) {
+    if (!attr || attr->num_threads <= 0 || attr->num_threads > LWT_MAX_WORKERS ||
+        attr->io_backend < LWT_IO_AUTO || attr->io_backend > LWT_IO_URING ||
+        attr->policy < LWT_SCHED_DEFAULT || attr->policy > LWT_SCHED_EDF ||
+        0 == attr->uring_entries) {
         errno = EINVAL;
         return NULL;
     }
+    if (attr->time_slice_us != 0 && lwt_preempt_init() != 0) {
+        return NULL;
+    }
     
-    /* Allocate scheduler */
-    lwt_scheduler_t* scheduler = malloc(sizeof(lwt_scheduler_t));
+    /* Allocate scheduler (workers are cache-line aligned) */
+    lwt_scheduler_t* scheduler = aligned_alloc(_Alignof(lwt_scheduler_t),
+                                               sizeof(lwt_scheduler_t));
     if (!scheduler) {
         return NULL;
     }
     
     /* Initialize scheduler */
-    if (lwt_scheduler_init(scheduler, num_threads) != 0) {
+    if (lwt_scheduler_init(scheduler, attr) != 0) {
+        int error = errno;
         free(scheduler);
+        errno = error;
+        return NULL;
+    }
+
+    /* Here rather than in start, so that the caller learns it failed */
+    if (scheduler->time_slice && lwt_sysmon_start(scheduler) != 0) {
+        int error = errno;
+        lwt_scheduler_cleanup(scheduler);
+        free(scheduler);
+        errno = error;
         return NULL;
     }
     return scheduler;
 }
 
+/* Get the I/O backend in use */
+lwt_io_backend_t lwt_scheduler_io_backend(lwt_scheduler_t* scheduler) {
+    return scheduler ? scheduler->io_backend : LWT_IO_AUTO;
+}
+
+/* Sum the workers' counters */
+int lwt_scheduler_get_stats(lwt_scheduler_t* scheduler, lwt_scheduler_stats_t* stats) {
+    if (!scheduler || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    memset(stats, 0, sizeof(lwt_scheduler_stats_t));
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        struct lwt_worker* worker = &scheduler->workers[i];
+        stats->deadlines_met += atomic_load_explicit(&worker->deadlines_met,
+                                                     memory_order_relaxed);
+        stats->deadlines_missed += atomic_load_explicit(&worker->deadlines_missed,
+                                                        memory_order_relaxed);
+    }
+    return 0;
+}
+
 /* Destroy a scheduler */
 void lwt_scheduler_destroy(lwt_scheduler_t* scheduler) {
     if (!scheduler) {
@@ -42,6 +101,7 @@ void lwt_scheduler_destroy(lwt_scheduler_t* scheduler) {
     }
     
     lwt_scheduler_stop(scheduler);
+    lwt_sysmon_stop(scheduler);
     lwt_scheduler_cleanup(scheduler);
     free(scheduler);
 }
@@ -52,14 +112,15 @@ void lwt_scheduler_start(lwt_scheduler_t* scheduler) {
         return;
     }
     
-    pthread_mutex_lock(&scheduler->mutex);
-    scheduler->running_flag = 1;
-    pthread_mutex_unlock(&scheduler->mutex);
+    atomic_store(&scheduler->running_flag, 1);
     
     for (int i = 0; i < scheduler->num_workers; i++) {
-        pthread_create(&scheduler->workers[i], NULL, 
-                       lwt_worker_function, &scheduler->worker_ids[i]);
+        pthread_create(&scheduler->workers[i].pthread, NULL, 
+                       lwt_worker_function, &scheduler->workers[i]);
     }
+    
+    /* Without sysmon, threads simply run until they yield */
+    lwt_sysmon_arm(scheduler, 1);
 }
 
 /* Stop the scheduler */
@@ -68,82 +129,331 @@ void lwt_scheduler_stop(lwt_scheduler_t* scheduler) {
         return;
     }
     
-    /* Clear running flag */
-    pthread_mutex_lock(&scheduler->mutex);
-    scheduler->running_flag = 0;
-    pthread_cond_broadcast(&scheduler->cond);
-    pthread_mutex_unlock(&scheduler->mutex);
+    /* Clear running flag and wake every worker to notice */
+    atomic_store(&scheduler->running_flag, 0);
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        lwt_parker_unpark(&scheduler->workers[i].parker);
+    }
+    lwt_netpoll_break(&scheduler->netpoll);
+    
+    /* Sysmon signals workers, so it must leave them alone before they are gone */
+    lwt_sysmon_arm(scheduler, 0);
     
     /* Wait for workers to finish */
     for (int i = 0; i < scheduler->num_workers; i++) {
-        pthread_join(scheduler->workers[i], NULL);
+        pthread_join(scheduler->workers[i].pthread, NULL);
     }
 }
 
+/* Initialize thread attributes */
+void lwt_attr_init(lwt_attr_t* attr) {
+    if (!attr) {
+        return;
+    }
+    
+    memset(attr, 0, sizeof(lwt_attr_t));
+    attr->priority = LWT_PRIO_NORMAL;
+    attr->deadline = LWT_DEADLINE_NONE;
+}
+
 /* Create a new lightweight thread */
 lwt_thread_t* lwt_create(lwt_scheduler_t* scheduler, lwt_func_t func, void* arg) {
-    if (!scheduler || !func) {
+    return lwt_create_ex(scheduler, NULL, func, arg);
+}
+
+/* Create a new lightweight thread from attributes */
+lwt_thread_t* lwt_create_ex(lwt_scheduler_t* scheduler, const lwt_attr_t* attr,
+                            lwt_func_t func, void* arg) {
+    lwt_attr_t defaults;
+    if (!attr) {
+        lwt_attr_init(&defaults);
+        attr = &defaults;
+    }
+    if (!scheduler || !func ||
+        attr->priority < LWT_PRIO_MIN || attr->priority > LWT_PRIO_MAX) {
         errno = EINVAL;
         return NULL;
     }
     
-    /* Allocate thread */
-    lwt_thread_t* thread = malloc(sizeof(lwt_thread_t));
+    /* Allocate thread from the control block slabs */
+    lwt_thread_t* thread = lwt_scheduler_alloc_thread(scheduler);
     if (!thread) {
         return NULL;
     }
     
     /* Initialize thread */
-    if (lwt_thread_init(thread, func, arg, scheduler, 0) != 0) {
-        free(thread);
+    if (attr->shared_stack) {
+        struct lwt_worker* home = lwt_scheduler_pick_home(scheduler);
+        if (lwt_thread_setup_shared(thread, func, arg, scheduler, home) != 0) {
+            lwt_scheduler_free_thread(scheduler, thread);
+            return NULL;
+        }
+        thread->id = lwt_scheduler_alloc_ids(scheduler, 1);
+    } else if (lwt_thread_init(thread, func, arg, scheduler, attr->stack_size) != 0) {
+        lwt_scheduler_free_thread(scheduler, thread);
         return NULL;
     }
+    thread->priority = attr->priority;
+    thread->deadline = attr->deadline;
     
     /* Add to scheduler */
     if (lwt_scheduler_add_thread(scheduler, thread) != 0) {
         lwt_thread_cleanup(thread);
-        free(thread);
+        lwt_scheduler_free_thread(scheduler, thread);
         return NULL;
     }
     
     return thread;
 }
 
-/* Yield execution from current thread */
-void lwt_yield(void) {
-    /* Get current thread */
-    lwt_thread_t* thread = lwt_thread_self();
+/* Create many lightweight threads at once */
+int lwt_create_many(lwt_scheduler_t* scheduler, const lwt_attr_t* attr, lwt_func_t func,
+                    void* const* args, int count, lwt_thread_t** threads) {
+    lwt_attr_t defaults;
+    if (!attr) {
+        lwt_attr_init(&defaults);
+        attr = &defaults;
+    }
+    if (!scheduler || !func || count < 0 ||
+        attr->priority < LWT_PRIO_MIN || attr->priority > LWT_PRIO_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    /* Build every chunk before publishing any, so that failure creates nothing */
+    lwt_thread_t* first = NULL;
+    lwt_thread_t** tail = &first;
+    for (int done = 0; done < count; ) {
+        int n = count - done;
+        if (n > LWT_THREAD_SLAB_SIZE) {
+            n = LWT_THREAD_SLAB_SIZE;
+        }
+        
+        lwt_thread_t* blocks[LWT_THREAD_SLAB_SIZE];
+        void* stacks[LWT_THREAD_SLAB_SIZE];
+        size_t stack_size = attr->stack_size ? attr->stack_size : LWT_DEFAULT_STACK_SIZE;
+        if (lwt_scheduler_alloc_many(scheduler, blocks, attr->shared_stack ? NULL : stacks, n,
+                                     &stack_size) != 0) {
+            goto fail;
+        }
+        
+        uint64_t id = lwt_scheduler_alloc_ids(scheduler, n);
+        for (int i = 0; i < n; i++) {
+            lwt_thread_t* thread = blocks[i];
+            void* arg = args ? args[done + i] : NULL;
+            int rc = attr->shared_stack
+                ? lwt_thread_setup_shared(thread, func, arg, scheduler,
+                                          lwt_scheduler_pick_home(scheduler))
+                : lwt_thread_setup(thread, func, arg, scheduler, stacks[i], stack_size);
+            if (rc != 0) {
+                for (int j = i; j < n; j++) {
+                    if (!attr->shared_stack) {
+                        lwt_scheduler_free_stack(scheduler, stacks[j], stack_size);
+                    }
+                    lwt_scheduler_free_thread(scheduler, blocks[j]);
+                }
+                goto fail;
+            }
+            thread->id = id + (uint64_t)i;
+            thread->priority = attr->priority;
+            thread->deadline = attr->deadline;
+            thread->detached = (NULL == threads);
+            *tail = thread;
+            tail = &thread->next;
+        }
+        done += n;
+    }
+    
+    /* Only now, so that a failure leaves nothing in threads[] to misuse */
+    if (threads) {
+        int i = 0;
+        for (lwt_thread_t* thread = first; thread; thread = thread->next) {
+            threads[i++] = thread;
+        }
+    }
+    lwt_scheduler_add_threads(scheduler, first);
+    return 0;
+    
+fail:
+    while (first) {
+        lwt_thread_t* thread = first;
+        first = thread->next;
+        lwt_thread_cleanup(thread);
+        lwt_scheduler_free_thread(scheduler, thread);
+    }
+    return -1;
+}
+
+/* Detach a thread so it is reclaimed when it finishes */
+int lwt_detach(lwt_thread_t* thread) {
     if (!thread) {
-        return;  /* Not in a lightweight thread */
+        errno = EINVAL;
+        return -1;
     }
     
-    /* Get scheduler */
-    lwt_scheduler_t* scheduler = thread->scheduler;
+    lwt_spin_lock(&thread->lock);
+    if (thread->state == LWT_STATE_FREE || thread->detached) {
+        lwt_spin_unlock(&thread->lock);
+        errno = EINVAL;
+        return -1;
+    }
     
-    /* Get worker ID */
-    int worker_id = lwt_scheduler_get_worker_id();
-    if (worker_id < 0 || worker_id >= scheduler->num_workers) {
-        return;
+    /*
+     * Still running, or still held by a joiner: the worker frees it once it
+     * finishes, or the last holder once it lets go
+     */
+    if (thread->state != LWT_STATE_FINISHED || thread->holds > 0) {
+        thread->detached = 1;
+        lwt_spin_unlock(&thread->lock);
+        return 0;
     }
+    lwt_spin_unlock(&thread->lock);
     
-    pthread_mutex_lock(&scheduler->mutex);
+    lwt_scheduler_free_thread(thread->scheduler, thread);
+    return 0;
+}
+
+/* Release a joined thread */
+void lwt_thread_free(lwt_thread_t* thread) {
+    lwt_detach(thread);
+}
+
+/* Take a handle to a thread */
+lwt_handle_t lwt_thread_handle(lwt_thread_t* thread) {
+    lwt_handle_t handle;
+    handle.thread = thread;
+    handle.generation = thread ? atomic_load_explicit(&thread->generation,
+                                                      memory_order_acquire) : 0;
+    return handle;
+}
+
+/* Resolve a handle, failing if the thread was recycled */
+lwt_thread_t* lwt_handle_thread(lwt_handle_t handle) {
+    if (!handle.thread ||
+        atomic_load_explicit(&handle.thread->generation, memory_order_acquire) !=
+            handle.generation) {
+        return NULL;
+    }
+    return handle.thread;
+}
+
+/* Report a thread's stack usage */
+int lwt_thread_stack_info(lwt_thread_t* thread, lwt_stack_info_t* info) {
+    if (!thread || !info) {
+        errno = EINVAL;
+        return -1;
+    }
     
-    /* If thread is not finished, add back to ready queue */
-    if (thread->state != LWT_STATE_FINISHED) {
-        thread->state = LWT_STATE_READY;
-        lwt_queue_push_locked(&scheduler->ready_queue, thread);
+    memset(info, 0, sizeof(lwt_stack_info_t));
+    
+    /* The lock keeps a finishing thread from releasing the stack meanwhile */
+    lwt_spin_lock(&thread->lock);
+    if (thread->stack && thread->home) {
+        info->reserved = thread->stack_size;
+        info->committed = atomic_load_explicit(&thread->stack_copy_capacity,
+                                               memory_order_relaxed);
+    } else if (thread->stack) {
+        info->reserved = thread->stack_size;
+        info->committed = lwt_stack_committed(thread->stack, thread->stack_size);
+    }
+    lwt_spin_unlock(&thread->lock);
+    return 0;
+}
+
+/* Yield execution from current thread */
+void lwt_yield(void) {
+    if (!lwt_thread_self() || !lwt_scheduler_current_worker()) {
+        return;  /* Not in a lightweight thread */
     }
     
-    /* Clear running thread */
-    scheduler->running[worker_id] = NULL;
+    /* The worker requeues us once our context is saved */
+    lwt_scheduler_yield();
+}
+
+/* Switch straight to a thread that is about to run anyway */
+int lwt_yield_to(lwt_thread_t* thread) {
+    lwt_thread_t* self = lwt_thread_self();
+    if (!thread || !self || thread == self || thread->scheduler != self->scheduler ||
+        !lwt_scheduler_current_worker()) {
+        errno = EINVAL;
+        return -1;
+    }
     
-    /* Signal that there's a thread ready to run */
-    pthread_cond_signal(&scheduler->cond);
+    return lwt_scheduler_yield_to(thread);
+}
+
+/* Keep the current thread from being preempted */
+void lwt_preempt_disable(void) {
+    lwt_thread_t* self = lwt_thread_self();
+    if (self) {
+        self->preempt_off++;
+        atomic_signal_fence(memory_order_seq_cst);
+    }
+}
+
+/* Allow preemption again once every disable is matched */
+void lwt_preempt_enable(void) {
+    lwt_thread_t* self = lwt_thread_self();
+    if (self && self->preempt_off > 0) {
+        atomic_signal_fence(memory_order_seq_cst);
+        self->preempt_off--;
+    }
+}
+
+/* Replace the current thread's deadline, accounting for the old one */
+int lwt_set_deadline(lwt_deadline_t deadline) {
+    lwt_thread_t* self = lwt_thread_self();
+    if (!self || !lwt_scheduler_current_worker()) {
+        errno = EPERM;
+        return -1;
+    }
     
+    lwt_scheduler_deadline_done(self);
+    self->deadline = deadline;
+    return 0;
+}
+
+/* Read the monotonic clock */
+uint64_t lwt_now_ns(void) {
+    return lwt_timer_now();
+}
+
+/* Park function for lwt_join: the target may finish and wake us from now on */
+static void lwt_join_unlock(void* arg) {
+    lwt_spin_unlock((lwt_spinlock_t*)arg);
+}
+
+/* Wait for a thread to complete from an OS thread that is not a worker */
+static void lwt_join_external(lwt_thread_t* thread) {
+    lwt_scheduler_t* scheduler = thread->scheduler;
+
+    lwt_spin_lock(&thread->lock);
+    if (thread->state == LWT_STATE_FINISHED || thread->state == LWT_STATE_FREE) {
+        lwt_spin_unlock(&thread->lock);
+        return;
+    }
+    /* The hold keeps a joiner that frees the thread from recycling it under us */
+    thread->external_joiners++;
+    thread->holds++;
+    lwt_spin_unlock(&thread->lock);
+
+    /* The finisher broadcasts under the mutex after setting FINISHED */
+    pthread_mutex_lock(&scheduler->mutex);
+    for (;;) {
+        lwt_spin_lock(&thread->lock);
+        int finished = (thread->state == LWT_STATE_FINISHED || thread->state == LWT_STATE_FREE);
+        if (finished) {
+            thread->external_joiners--;
+        }
+        lwt_spin_unlock(&thread->lock);
+        if (finished) {
+            break;
+        }
+        pthread_cond_wait(&scheduler->join_cond, &scheduler->mutex);
+    }
     pthread_mutex_unlock(&scheduler->mutex);
-    
-    /* Switch back to scheduler */
-    swapcontext(&thread->context, &scheduler->main_contexts[worker_id]);
+
+    lwt_thread_drop_hold(thread);
 }
 
 /* Wait for a thread to complete */
@@ -155,37 +465,64 @@ void lwt_join(lwt_thread_t* thread) {
     /* Get current thread */
     lwt_thread_t* self = lwt_thread_self();
     if (!self) {
-        return;  /* Not in a lightweight thread */
-    }
-    
-    /* Get scheduler */
-    lwt_scheduler_t* scheduler = self->scheduler;
-    
-    /* Get worker ID */
-    int worker_id = lwt_scheduler_get_worker_id();
-    if (worker_id < 0 || worker_id >= scheduler->num_workers) {
+        lwt_join_external(thread);
         return;
     }
     
-    pthread_mutex_lock(&scheduler->mutex);
+    lwt_spin_lock(&thread->lock);
     
-    /* If thread is already finished, we're done */
-    if (thread->state == LWT_STATE_FINISHED) {
-        pthread_mutex_unlock(&scheduler->mutex);
+    /* If thread is already finished (or stale), we're done */
+    if (thread->state == LWT_STATE_FINISHED || thread->state == LWT_STATE_FREE) {
+        lwt_spin_unlock(&thread->lock);
         return;
     }
     
     /* Otherwise, block until thread finishes */
     self->state = LWT_STATE_BLOCKED;
+    self->next = thread->waiting;
     thread->waiting = self;
     
-    /* Clear running thread */
-    scheduler->running[worker_id] = NULL;
+    /* Switch back to scheduler, which drops the lock */
+    lwt_scheduler_park(lwt_join_unlock, &thread->lock);
+}
+
+/* Check whether a thread has completed, without waiting */
+int lwt_try_join(lwt_thread_t* thread) {
+    if (!thread) {
+        errno = EINVAL;
+        return -1;
+    }
     
-    pthread_mutex_unlock(&scheduler->mutex);
+    lwt_spin_lock(&thread->lock);
+    int finished = (thread->state == LWT_STATE_FINISHED || thread->state == LWT_STATE_FREE);
+    lwt_spin_unlock(&thread->lock);
+    if (!finished) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait for a thread to complete until a deadline */
+int lwt_join_until(lwt_thread_t* thread, lwt_deadline_t deadline) {
+    if (!thread) {
+        errno = EINVAL;
+        return -1;
+    }
     
-    /* Switch back to scheduler */
-    swapcontext(&self->context, &scheduler->main_contexts[worker_id]);
+    /* A selector withdraws from the target on timeout, which a plain join cannot */
+    lwt_select_source_t source;
+    memset(&source, 0, sizeof(source));
+    source.type = LWT_SELECT_THREAD;
+    source.thread = thread;
+    return lwt_select_until(&source, 1, deadline) < 0 ? -1 : 0;
+}
+
+/* Wait for a thread to complete for at most a number of nanoseconds */
+int lwt_join_timeout(lwt_thread_t* thread, uint64_t timeout_ns) {
+    uint64_t now = lwt_timer_now();
+    return lwt_join_until(thread, timeout_ns > LWT_DEADLINE_NONE - now ?
+                                  LWT_DEADLINE_NONE : now + timeout_ns);
 }
 
 /* Get the current thread */
@@ -195,57 +532,32 @@ lwt_thread_t* lwt_current(void) {
 
 /* Sleep for the specified duration */
 void lwt_sleep(unsigned int ms) {
-    /* Get current thread */
-    lwt_thread_t* thread = lwt_thread_self();
-    if (!thread) {
-        /* Not in a lightweight thread, use regular sleep */
+    lwt_sleep_ns((uint64_t)ms * 1000000ull);
+}
+
+/* Sleep for a number of nanoseconds */
+void lwt_sleep_ns(uint64_t ns) {
+    uint64_t now = lwt_timer_now();
+    lwt_sleep_until(ns > LWT_DEADLINE_NONE - now ? LWT_DEADLINE_NONE : now + ns);
+}
+
+/* Sleep until a point on the monotonic clock */
+void lwt_sleep_until(lwt_deadline_t deadline) {
+    if (!lwt_thread_self() || !lwt_scheduler_current_worker()) {
+        /* Not in a lightweight thread, block the OS thread */
         struct timespec ts;
-        ts.tv_sec = ms / 1000;
-        ts.tv_nsec = (ms % 1000) * 1000000;
-        nanosleep(&ts, NULL);
+        ts.tv_sec = (time_t)(deadline / 1000000000ull);
+        ts.tv_nsec = (long)(deadline % 1000000000ull);
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+        }
         return;
     }
     
-    /* Get scheduler */
-    lwt_scheduler_t* scheduler = thread->scheduler;
-    
-    /* Get worker ID */
-    int worker_id = lwt_scheduler_get_worker_id();
-    if (worker_id < 0 || worker_id >= scheduler->num_workers) {
+    if (lwt_timer_now() >= deadline) {
+        lwt_yield();
         return;
     }
     
-    /* Calculate wake time */
-    struct timespec wake_time;
-    clock_gettime(CLOCK_REALTIME, &wake_time);
-    wake_time.tv_sec += ms / 1000;
-    wake_time.tv_nsec += (ms % 1000) * 1000000;
-    if (wake_time.tv_nsec >= 1000000000) {
-        wake_time.tv_sec += 1;
-        wake_time.tv_nsec -= 1000000000;
-    }
-    
-    pthread_mutex_lock(&scheduler->mutex);
-    
-    /* Mark thread as blocked */
-    thread->state = LWT_STATE_BLOCKED;
-    
-    /* Clear running thread */
-    scheduler->running[worker_id] = NULL;
-    
-    pthread_mutex_unlock(&scheduler->mutex);
-    
-    /* Sleep for the requested time */
-    struct timespec remaining;
-    nanosleep(&wake_time, &remaining);
-    
-    /* Add thread back to ready queue */
-    pthread_mutex_lock(&scheduler->mutex);
-    thread->state = LWT_STATE_READY;
-    lwt_queue_push_locked(&scheduler->ready_queue, thread);
-    pthread_cond_signal(&scheduler->cond);
-    pthread_mutex_unlock(&scheduler->mutex);
-    
-    /* Switch back to scheduler */
-    swapcontext(&thread->context, &scheduler->main_contexts[worker_id]);
-}
\ No newline at end of file
+    /* Park on the worker's timer wheel, which never fires early */
+    lwt_scheduler_sleep_until(deadline);
+}
@@ -0,0 +1,234 @@
+/**
+ * @file mutex.c
+ * @brief Mutex that parks lightweight threads instead of their workers
+ */
+
+#include "lwthread/lwthread.h"
+#include "mutex.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "timer.h"
+#include <errno.h>
+#include <stdlib.h>
+
+#define LWT_MUTEX_WAITER (1 << LWT_MUTEX_WAITER_SHIFT)
+
+/* Relax iterations per spin round */
+#define LWT_MUTEX_SPIN_RELAX 30
+
+lwt_mutex_t* lwt_mutex_create(void) {
+    lwt_mutex_t* mutex = calloc(1, sizeof(lwt_mutex_t));
+    if (NULL == mutex) {
+        return NULL;
+    }
+    atomic_init(&mutex->state, 0);
+    lwt_spin_init(&mutex->lock);
+    return mutex;
+}
+
+void lwt_mutex_destroy(lwt_mutex_t* mutex) {
+    free(mutex);
+}
+
+/* Park function: the releaser may ready us once the lock is dropped */
+static void lwt_mutex_unlock_waiters(void* arg) {
+    lwt_spin_unlock((lwt_spinlock_t*)arg);
+}
+
+/* Sleep until lwt_mutex_release() picks us; lifo puts a re-waiting thread first */
+static void lwt_mutex_acquire(lwt_mutex_t* mutex, struct lwt_thread* self, int lifo) {
+    lwt_spin_lock(&mutex->lock);
+    if (mutex->permits > 0) {
+        mutex->permits--;
+        lwt_spin_unlock(&mutex->lock);
+        return;
+    }
+
+    if (NULL == mutex->head) {
+        self->next = NULL;
+        mutex->head = self;
+        mutex->tail = self;
+    } else if (lifo) {
+        self->next = mutex->head;
+        mutex->head = self;
+    } else {
+        self->next = NULL;
+        mutex->tail->next = self;
+        mutex->tail = self;
+    }
+    self->state = LWT_STATE_BLOCKED;
+
+    lwt_scheduler_park(lwt_mutex_unlock_waiters, &mutex->lock);
+}
+
+/* Ready the first waiter, or leave a permit if it has not parked yet */
+static void lwt_mutex_release(lwt_mutex_t* mutex) {
+    lwt_spin_lock(&mutex->lock);
+    struct lwt_thread* waiter = mutex->head;
+    if (NULL == waiter) {
+        mutex->permits++;
+        lwt_spin_unlock(&mutex->lock);
+        return;
+    }
+    mutex->head = waiter->next;
+    if (NULL == mutex->head) {
+        mutex->tail = NULL;
+    }
+    waiter->next = NULL;
+    lwt_spin_unlock(&mutex->lock);
+
+    lwt_scheduler_add_thread(waiter->scheduler, waiter);
+}
+
+/* Spinning only pays off if the owner is running on another worker */
+static int lwt_mutex_can_spin(int iter) {
+    if (iter >= LWT_MUTEX_SPIN_ROUNDS) {
+        return 0;
+    }
+    struct lwt_worker* worker = lwt_scheduler_current_worker();
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    int busy = scheduler->num_workers - atomic_load_explicit(&scheduler->nidle, memory_order_relaxed) -
+               atomic_load_explicit(&scheduler->nspinning, memory_order_relaxed);
+    return busy > 1 && 0 == lwt_deque_size(&worker->deque);
+}
+
+/* Contended path, run by lightweight threads */
+static void lwt_mutex_lock_slow(lwt_mutex_t* mutex, struct lwt_thread* self) {
+    uint64_t wait_start = 0;
+    int starving = 0;
+    int awoke = 0;
+    int iter = 0;
+    int old = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+
+    for (;;) {
+        /* Spin while the owner might release soon; never in starvation mode */
+        if ((old & (LWT_MUTEX_LOCKED | LWT_MUTEX_STARVING)) == LWT_MUTEX_LOCKED &&
+            lwt_mutex_can_spin(iter)) {
+            /* Tell unlock not to wake a parked waiter while we compete */
+            if (!awoke && 0 == (old & LWT_MUTEX_WOKEN) && (old >> LWT_MUTEX_WAITER_SHIFT) != 0 &&
+                atomic_compare_exchange_weak_explicit(&mutex->state, &old, old | LWT_MUTEX_WOKEN,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                awoke = 1;
+            }
+            for (int i = 0; i < LWT_MUTEX_SPIN_RELAX; i++) {
+                LWT_CPU_RELAX();
+            }
+            iter++;
+            old = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+            continue;
+        }
+
+        int new = old;
+        if (0 == (old & LWT_MUTEX_STARVING)) {
+            new |= LWT_MUTEX_LOCKED;        /* Starving mutexes go to the queue, not to us */
+        }
+        if (old & (LWT_MUTEX_LOCKED | LWT_MUTEX_STARVING)) {
+            new += LWT_MUTEX_WAITER;
+        }
+        /* Only switch to starvation mode while locked, so unlock has someone to hand to */
+        if (starving && (old & LWT_MUTEX_LOCKED)) {
+            new |= LWT_MUTEX_STARVING;
+        }
+        if (awoke) {
+            new &= ~LWT_MUTEX_WOKEN;
+        }
+
+        if (!atomic_compare_exchange_weak_explicit(&mutex->state, &old, new,
+                                                   memory_order_acquire, memory_order_relaxed)) {
+            continue;
+        }
+        if (0 == (old & (LWT_MUTEX_LOCKED | LWT_MUTEX_STARVING))) {
+            return;     /* Locked with the CAS */
+        }
+
+        /* Threads that already waited go back to the front of the queue */
+        int lifo = (wait_start != 0);
+        if (0 == wait_start) {
+            wait_start = lwt_timer_now();
+        }
+        lwt_mutex_acquire(mutex, self, lifo);
+        starving = starving || lwt_timer_now() - wait_start > LWT_MUTEX_STARVATION_NS;
+
+        old = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+        if (old & LWT_MUTEX_STARVING) {
+            /* Handed off: the lock is ours, fix up the state on its behalf */
+            int delta = LWT_MUTEX_LOCKED - LWT_MUTEX_WAITER;
+            if (!starving || (old >> LWT_MUTEX_WAITER_SHIFT) == 1) {
+                delta -= LWT_MUTEX_STARVING;    /* Last waiter, or waits are short again */
+            }
+            atomic_fetch_add_explicit(&mutex->state, delta, memory_order_acquire);
+            return;
+        }
+        awoke = 1;
+        iter = 0;
+    }
+}
+
+void lwt_mutex_lock(lwt_mutex_t* mutex) {
+    int unlocked = 0;
+    if (atomic_compare_exchange_strong_explicit(&mutex->state, &unlocked, LWT_MUTEX_LOCKED,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+
+    struct lwt_thread* self = lwt_thread_self();
+    if (self && lwt_scheduler_current_worker()) {
+        lwt_mutex_lock_slow(mutex, self);
+        return;
+    }
+
+    /* Not in a lightweight thread: there is nothing to park, so poll */
+    int spins = 0;
+    while (lwt_mutex_trylock(mutex) != 0) {
+        if (++spins < LWT_SPIN_LIMIT) {
+            LWT_CPU_RELAX();
+        } else {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+int lwt_mutex_trylock(lwt_mutex_t* mutex) {
+    int old = atomic_load_explicit(&mutex->state, memory_order_relaxed);
+    while (0 == (old & (LWT_MUTEX_LOCKED | LWT_MUTEX_STARVING))) {
+        if (atomic_compare_exchange_weak_explicit(&mutex->state, &old, old | LWT_MUTEX_LOCKED,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+/* Wake or hand off to a waiter after the locked bit was cleared */
+static void lwt_mutex_unlock_slow(lwt_mutex_t* mutex, int new) {
+    if (new & LWT_MUTEX_STARVING) {
+        /* Ownership passes to the first waiter; newcomers keep off while STARVING is set */
+        lwt_mutex_release(mutex);
+        return;
+    }
+
+    int old = new;
+    for (;;) {
+        /* No waiters, or someone else is already awake, locked or handing off */
+        if ((old >> LWT_MUTEX_WAITER_SHIFT) == 0 ||
+            (old & (LWT_MUTEX_LOCKED | LWT_MUTEX_WOKEN | LWT_MUTEX_STARVING))) {
+            return;
+        }
+        new = (old - LWT_MUTEX_WAITER) | LWT_MUTEX_WOKEN;
+        if (atomic_compare_exchange_weak_explicit(&mutex->state, &old, new,
+                                                  memory_order_release, memory_order_relaxed)) {
+            lwt_mutex_release(mutex);
+            return;
+        }
+    }
+}
+
+void lwt_mutex_unlock(lwt_mutex_t* mutex) {
+    int new = atomic_fetch_sub_explicit(&mutex->state, LWT_MUTEX_LOCKED, memory_order_release) -
+              LWT_MUTEX_LOCKED;
+    if (new != 0) {
+        lwt_mutex_unlock_slow(mutex, new);
+    }
+}
@@ -0,0 +1,53 @@
+/**
+ * @file mutex.h
+ * @brief Internal mutex for lightweight threads
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_MUTEX_INTERNAL_H
+#define LWTHREAD_MUTEX_INTERNAL_H
+
+#include "spinlock.h"
+#include <stdatomic.h>
+
+/**
+ * Mutex state bits; the rest of the word counts parked waiters
+ */
+#define LWT_MUTEX_LOCKED 1          /* Held */
+#define LWT_MUTEX_WOKEN 2           /* A waiter is awake and competing, so unlock wakes nobody */
+#define LWT_MUTEX_STARVING 4        /* Ownership is handed to waiters in FIFO order */
+#define LWT_MUTEX_WAITER_SHIFT 3
+
+/**
+ * Spin rounds before a contended lock parks
+ */
+#define LWT_MUTEX_SPIN_ROUNDS 4
+
+/**
+ * Waiting longer than this switches the mutex to starvation mode
+ */
+#define LWT_MUTEX_STARVATION_NS 1000000ull
+
+/**
+ * Mutex structure
+ *
+ * Modelled on Go's sync.Mutex. In normal mode a woken waiter competes with
+ * newly arriving threads, which usually win because they are already
+ * running; this keeps throughput high. A waiter that loses for more than
+ * LWT_MUTEX_STARVATION_NS switches the mutex to starvation mode, where
+ * unlock hands ownership straight to the oldest waiter.
+ */
+struct lwt_mutex {
+    atomic_int state;                   /* LWT_MUTEX_* bits and waiter count */
+    lwt_spinlock_t lock;                /* Protects the fields below */
+    unsigned int permits;               /* Wakeups issued before their waiter parked */
+    struct lwt_thread* head;            /* Parked waiters, linked through next */
+    struct lwt_thread* tail;
+};
+
+#endif /* LWTHREAD_MUTEX_INTERNAL_H */
@@ -0,0 +1,437 @@
+/**
+ * @file netpoll.c
+ * @brief Network poller implementation
+ */
+
+#include "netpoll.h"
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+/* Events collected per epoll_wait call */
+#define LWT_NETPOLL_EVENTS 128
+
+/* Largest descriptor table we are prepared to index */
+#define LWT_NETPOLL_MAX_FDS (1 << 22)
+
+int lwt_netpoll_init(lwt_netpoll_t* netpoll, struct lwt_scheduler* scheduler) {
+    memset(netpoll, 0, sizeof(lwt_netpoll_t));
+    netpoll->scheduler = scheduler;
+    atomic_init(&netpoll->waiters, 0);
+
+    /* Size the table for the hard descriptor limit; chunks come on demand */
+    struct rlimit limit;
+    rlim_t max_fds = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_max > max_fds) {
+        max_fds = limit.rlim_max;
+    }
+    if (max_fds > LWT_NETPOLL_MAX_FDS) {
+        max_fds = LWT_NETPOLL_MAX_FDS;
+    }
+    netpoll->table_chunks = (int)((max_fds + LWT_NETPOLL_CHUNK - 1) / LWT_NETPOLL_CHUNK);
+    netpoll->table = calloc((size_t)netpoll->table_chunks, sizeof(*netpoll->table));
+    if (NULL == netpoll->table) {
+        return -1;
+    }
+
+    if (pthread_mutex_init(&netpoll->mutex, NULL) != 0) {
+        free(netpoll->table);
+        return -1;
+    }
+
+    netpoll->epfd = epoll_create1(EPOLL_CLOEXEC);
+    netpoll->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (netpoll->epfd < 0 || netpoll->wakefd < 0) {
+        goto fail;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)netpoll->wakefd;
+    if (epoll_ctl(netpoll->epfd, EPOLL_CTL_ADD, netpoll->wakefd, &event) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (netpoll->epfd >= 0) {
+        close(netpoll->epfd);
+    }
+    if (netpoll->wakefd >= 0) {
+        close(netpoll->wakefd);
+    }
+    pthread_mutex_destroy(&netpoll->mutex);
+    free(netpoll->table);
+    return -1;
+}
+
+void lwt_netpoll_destroy(lwt_netpoll_t* netpoll) {
+    close(netpoll->epfd);
+    close(netpoll->wakefd);
+    for (int i = 0; i < netpoll->table_chunks; i++) {
+        free(atomic_load(&netpoll->table[i]));
+    }
+    free(netpoll->table);
+    pthread_mutex_destroy(&netpoll->mutex);
+}
+
+/* Find the poll state for fd, allocating its chunk if needed */
+static lwt_pollfd_t* lwt_netpoll_lookup(lwt_netpoll_t* netpoll, int fd, int create) {
+    if (fd < 0 || fd / LWT_NETPOLL_CHUNK >= netpoll->table_chunks) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    lwt_pollfd_t* _Atomic* slot = &netpoll->table[fd / LWT_NETPOLL_CHUNK];
+    lwt_pollfd_t* chunk = atomic_load_explicit(slot, memory_order_acquire);
+    if (NULL == chunk && create) {
+        pthread_mutex_lock(&netpoll->mutex);
+        chunk = atomic_load_explicit(slot, memory_order_relaxed);
+        if (NULL == chunk) {
+            /* Zeroed spinlocks are unlocked */
+            chunk = calloc(LWT_NETPOLL_CHUNK, sizeof(lwt_pollfd_t));
+            atomic_store_explicit(slot, chunk, memory_order_release);
+        }
+        pthread_mutex_unlock(&netpoll->mutex);
+    }
+    if (NULL == chunk) {
+        errno = create ? ENOMEM : EBADF;
+        return NULL;
+    }
+    return &chunk[fd % LWT_NETPOLL_CHUNK];
+}
+
+/* Make a list of parked threads runnable, oldest first; returns how many */
+static int lwt_netpoll_ready(lwt_netpoll_t* netpoll, struct lwt_thread* threads) {
+    /* Waiters are pushed at the head, so reverse the list first */
+    struct lwt_thread* oldest = NULL;
+    while (threads) {
+        struct lwt_thread* next = threads->next;
+        threads->next = oldest;
+        oldest = threads;
+        threads = next;
+    }
+
+    int woken = 0;
+    while (oldest) {
+        struct lwt_thread* next = oldest->next;
+        oldest->next = NULL;
+        lwt_scheduler_add_thread(netpoll->scheduler, oldest);
+        oldest = next;
+        woken++;
+    }
+    atomic_fetch_sub_explicit(&netpoll->waiters, woken, memory_order_relaxed);
+    return woken;
+}
+
+/*
+ * Forget a descriptor's registration, failing its pending waits (netpoll
+ * mutex held). Returns the parked threads and selectors to make runnable.
+ */
+static void lwt_netpoll_forget(lwt_netpoll_t* netpoll, lwt_pollfd_t* pd, int fd,
+                               struct lwt_thread** parked, struct lwt_thread** selectors) {
+    lwt_spin_lock(&pd->lock);
+    int status = atomic_load_explicit(&pd->status, memory_order_relaxed);
+    lwt_select_fire_list(&pd->selectors, -1, selectors);
+
+    /* One list for both directions */
+    struct lwt_thread** tail = &pd->readers;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = pd->writers;
+    *parked = pd->readers;
+    pd->readers = NULL;
+    pd->writers = NULL;
+    atomic_store_explicit(&pd->status, LWT_POLLFD_NEW, memory_order_relaxed);
+    pd->seq++;
+    lwt_spin_unlock(&pd->lock);
+
+    if (LWT_POLLFD_REGISTERED == status) {
+        epoll_ctl(netpoll->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+/* Add a descriptor to the epoll set, then make it non-blocking (netpoll mutex held) */
+static lwt_pollfd_status_t lwt_netpoll_register(lwt_netpoll_t* netpoll, int fd) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = (uint64_t)fd;
+    if (epoll_ctl(netpoll->epfd, EPOLL_CTL_ADD, fd, &event) != 0 &&
+        (errno != EEXIST || epoll_ctl(netpoll->epfd, EPOLL_CTL_MOD, fd, &event) != 0)) {
+        /* EPERM: regular files are always ready and cannot be polled */
+        return (EPERM == errno) ? LWT_POLLFD_UNPOLLABLE : LWT_POLLFD_NEW;
+    }
+
+    /*
+     * Not before: O_NONBLOCK belongs to the open file description, which
+     * an inherited descriptor shares with other processes
+     */
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+        int error = errno;
+        epoll_ctl(netpoll->epfd, EPOLL_CTL_DEL, fd, NULL);
+        errno = error;
+        return LWT_POLLFD_NEW;
+    }
+    return LWT_POLLFD_REGISTERED;
+}
+
+lwt_pollfd_t* lwt_netpoll_fd(lwt_netpoll_t* netpoll, int fd) {
+    lwt_pollfd_t* pd = lwt_netpoll_lookup(netpoll, fd, 1);
+    if (NULL == pd) {
+        return NULL;
+    }
+
+    int status = atomic_load_explicit(&pd->status, memory_order_acquire);
+    if (LWT_POLLFD_NEW == status) {
+        pthread_mutex_lock(&netpoll->mutex);
+        status = atomic_load_explicit(&pd->status, memory_order_relaxed);
+        if (LWT_POLLFD_NEW == status) {
+            status = lwt_netpoll_register(netpoll, fd);
+            atomic_store_explicit(&pd->status, status, memory_order_release);
+        }
+        pthread_mutex_unlock(&netpoll->mutex);
+    }
+
+    if (LWT_POLLFD_REGISTERED == status) {
+        return pd;
+    }
+    if (LWT_POLLFD_UNPOLLABLE == status) {
+        errno = EPERM;
+    }
+    return NULL;
+}
+
+lwt_pollfd_t* lwt_netpoll_state(lwt_netpoll_t* netpoll, int fd) {
+    return lwt_netpoll_lookup(netpoll, fd, 1);
+}
+
+int lwt_netpoll_known(lwt_netpoll_t* netpoll, int fd) {
+    int saved_errno = errno;
+    lwt_pollfd_t* pd = lwt_netpoll_lookup(netpoll, fd, 0);
+    errno = saved_errno;
+    return pd && (atomic_load_explicit(&pd->status, memory_order_relaxed) != LWT_POLLFD_NEW ||
+                  atomic_load_explicit(&pd->inflight, memory_order_relaxed) > 0);
+}
+
+/* Park function for lwt_netpoll_wait */
+static void lwt_netpoll_unlock(void* arg) {
+    lwt_spin_unlock(&((lwt_pollfd_t*)arg)->lock);
+}
+
+unsigned int lwt_netpoll_edges(lwt_pollfd_t* pd, lwt_poll_mode_t mode) {
+    lwt_spin_lock(&pd->lock);
+    unsigned int edges = (LWT_POLL_READ == mode) ? pd->read_edges : pd->write_edges;
+    lwt_spin_unlock(&pd->lock);
+    return edges;
+}
+
+int lwt_netpoll_wait(lwt_netpoll_t* netpoll, lwt_pollfd_t* pd, lwt_poll_mode_t mode,
+                     unsigned int edges) {
+    struct lwt_thread* self = lwt_thread_self();
+
+    lwt_spin_lock(&pd->lock);
+    unsigned int seq = pd->seq;
+    unsigned int now = (LWT_POLL_READ == mode) ? pd->read_edges : pd->write_edges;
+    if (now != edges) {
+        /* An edge arrived since the caller's last attempt */
+        lwt_spin_unlock(&pd->lock);
+        return 0;
+    }
+
+    struct lwt_thread** waiters = (LWT_POLL_READ == mode) ? &pd->readers : &pd->writers;
+    self->next = *waiters;
+    *waiters = self;
+    atomic_fetch_add_explicit(&netpoll->waiters, 1, memory_order_relaxed);
+    self->state = LWT_STATE_BLOCKED;
+    lwt_scheduler_park(lwt_netpoll_unlock, pd);
+
+    lwt_spin_lock(&pd->lock);
+    int closed = (pd->seq != seq);
+    lwt_spin_unlock(&pd->lock);
+    if (closed) {
+        errno = EBADF;
+        return -1;
+    }
+    return 0;
+}
+
+void lwt_netpoll_close(lwt_netpoll_t* netpoll, int fd) {
+    lwt_pollfd_t* pd = lwt_netpoll_lookup(netpoll, fd, 0);
+    if (NULL == pd) {
+        return;
+    }
+
+    struct lwt_thread* parked = NULL;
+    struct lwt_thread* selectors = NULL;
+    pthread_mutex_lock(&netpoll->mutex);
+    lwt_netpoll_forget(netpoll, pd, fd, &parked, &selectors);
+    pthread_mutex_unlock(&netpoll->mutex);
+
+    /* Pending waits see the new sequence number and fail with EBADF */
+    lwt_select_ready(selectors);
+    lwt_netpoll_ready(netpoll, parked);
+}
+
+int lwt_netpoll_poll(lwt_netpoll_t* netpoll, int timeout_ms) {
+    struct epoll_event events[LWT_NETPOLL_EVENTS];
+    int n = epoll_wait(netpoll->epfd, events, LWT_NETPOLL_EVENTS, timeout_ms);
+    int woken = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t data = events[i].data.u64;
+        int fd = (int)(uint32_t)data;
+        uint32_t mask = events[i].events;
+
+        if (data >> 32) {
+            /* A ring's completion eventfd: drain it first so later completions re-arm it */
+            uint64_t value;
+            while (read(fd, &value, sizeof(value)) > 0) {
+            }
+            woken += lwt_scheduler_complete_ring(netpoll->scheduler, (int)(data >> 32) - 1);
+            continue;
+        }
+
+        if (fd == netpoll->wakefd) {
+            uint64_t value;
+            while (read(netpoll->wakefd, &value, sizeof(value)) > 0) {
+            }
+            continue;
+        }
+
+        lwt_pollfd_t* pd = lwt_netpoll_lookup(netpoll, fd, 0);
+        if (NULL == pd) {
+            continue;
+        }
+
+        struct lwt_thread* readers = NULL;
+        struct lwt_thread* writers = NULL;
+        struct lwt_thread* selectors = NULL;
+        lwt_spin_lock(&pd->lock);
+        if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            lwt_select_fire_list(&pd->selectors, LWT_POLL_READ, &selectors);
+            pd->read_edges++;
+            readers = pd->readers;
+            pd->readers = NULL;
+        }
+        if (mask & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            lwt_select_fire_list(&pd->selectors, LWT_POLL_WRITE, &selectors);
+            pd->write_edges++;
+            writers = pd->writers;
+            pd->writers = NULL;
+        }
+        lwt_spin_unlock(&pd->lock);
+
+        woken += lwt_select_ready(selectors);
+        woken += lwt_netpoll_ready(netpoll, readers);
+        woken += lwt_netpoll_ready(netpoll, writers);
+    }
+    return woken;
+}
+
+int lwt_netpoll_add_ring(lwt_netpoll_t* netpoll, int eventfd, int id) {
+    /* Descriptors use the low 32 bits of the event data; rings tag the high ones */
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)(id + 1) << 32) | (uint32_t)eventfd;
+    return epoll_ctl(netpoll->epfd, EPOLL_CTL_ADD, eventfd, &event);
+}
+
+void lwt_netpoll_break(lwt_netpoll_t* netpoll) {
+    uint64_t one = 1;
+    ssize_t rc = write(netpoll->wakefd, &one, sizeof(one));
+    (void)rc;
+}
+
+#else /* !__linux__ */
+
+/* No epoll: I/O wrappers fall back to blocking poll(2) on the worker */
+
+int lwt_netpoll_init(lwt_netpoll_t* netpoll, struct lwt_scheduler* scheduler) {
+    memset(netpoll, 0, sizeof(lwt_netpoll_t));
+    netpoll->scheduler = scheduler;
+    netpoll->epfd = -1;
+    netpoll->wakefd = -1;
+    atomic_init(&netpoll->waiters, 0);
+    return 0;
+}
+
+void lwt_netpoll_destroy(lwt_netpoll_t* netpoll) {
+    (void)netpoll;
+}
+
+lwt_pollfd_t* lwt_netpoll_fd(lwt_netpoll_t* netpoll, int fd) {
+    (void)netpoll;
+    (void)fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+unsigned int lwt_netpoll_edges(lwt_pollfd_t* pd, lwt_poll_mode_t mode) {
+    (void)pd;
+    (void)mode;
+    return 0;
+}
+
+int lwt_netpoll_wait(lwt_netpoll_t* netpoll, lwt_pollfd_t* pd, lwt_poll_mode_t mode,
+                     unsigned int edges) {
+    (void)netpoll;
+    (void)pd;
+    (void)mode;
+    (void)edges;
+    errno = ENOSYS;
+    return -1;
+}
+
+lwt_pollfd_t* lwt_netpoll_state(lwt_netpoll_t* netpoll, int fd) {
+    (void)netpoll;
+    (void)fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+int lwt_netpoll_known(lwt_netpoll_t* netpoll, int fd) {
+    (void)netpoll;
+    (void)fd;
+    return 0;
+}
+
+void lwt_netpoll_close(lwt_netpoll_t* netpoll, int fd) {
+    (void)netpoll;
+    (void)fd;
+}
+
+int lwt_netpoll_poll(lwt_netpoll_t* netpoll, int timeout_ms) {
+    (void)netpoll;
+    (void)timeout_ms;
+    return 0;
+}
+
+int lwt_netpoll_add_ring(lwt_netpoll_t* netpoll, int eventfd, int id) {
+    (void)netpoll;
+    (void)eventfd;
+    (void)id;
+    errno = ENOSYS;
+    return -1;
+}
+
+void lwt_netpoll_break(lwt_netpoll_t* netpoll) {
+    (void)netpoll;
+}
+
+#endif /* __linux__ */
+
+int lwt_netpoll_has_waiters(lwt_netpoll_t* netpoll) {
+    return atomic_load_explicit(&netpoll->waiters, memory_order_relaxed) > 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file netpoll.h
+ * @brief Internal epoll-based network poller
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_NETPOLL_INTERNAL_H
+#define LWTHREAD_NETPOLL_INTERNAL_H
+
+#include "select.h"
+#include "spinlock.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Descriptors per lazily allocated table chunk
+ */
+#define LWT_NETPOLL_CHUNK 1024
+
+/**
+ * Readiness a thread can wait for
+ */
+typedef enum {
+    LWT_POLL_READ,      /* Readable, or a connection to accept */
+    LWT_POLL_WRITE      /* Writable, or a connect has completed */
+} lwt_poll_mode_t;
+
+/**
+ * Registration status of a descriptor
+ */
+typedef enum {
+    LWT_POLLFD_NEW,             /* Not used with the poller since it was opened */
+    LWT_POLLFD_REGISTERED,      /* In the epoll set and non-blocking */
+    LWT_POLLFD_UNPOLLABLE       /* Cannot be polled (a regular file) */
+} lwt_pollfd_status_t;
+
+/**
+ * Per-descriptor poll state
+ *
+ * Descriptors stay registered edge-triggered for their whole life. Each
+ * edge is counted and wakes every thread parked for that direction, as
+ * well as every selector waiting for it: with several threads accepting
+ * on one socket, an edge may stand for more than one connection. A thread
+ * only parks if no edge has arrived since it read the count before its
+ * last attempt, so no edge is lost between trying and parking.
+ *
+ * The status only changes back to LWT_POLLFD_NEW in lwt_close(), which is
+ * why looking a descriptor up takes neither a lock nor a system call.
+ */
+typedef struct lwt_pollfd {
+    lwt_spinlock_t lock;            /* Protects the fields below */
+    struct lwt_thread* readers;     /* Threads parked waiting to read, linked through next */
+    struct lwt_thread* writers;     /* Threads parked waiting to write, linked through next */
+    lwt_select_entry_t* selectors;  /* lwt_select calls waiting for either */
+    unsigned int read_edges;        /* Read edges seen so far */
+    unsigned int write_edges;       /* Write edges seen so far */
+    unsigned int seq;               /* Bumped on close to fail pending waits */
+    atomic_int status;              /* lwt_pollfd_status_t, written under the netpoll mutex */
+    atomic_int inflight;            /* io_uring requests on the descriptor */
+} lwt_pollfd_t;
+
+/**
+ * Network poller shared by a scheduler's workers
+ */
+typedef struct lwt_netpoll {
+    struct lwt_scheduler* scheduler;        /* Scheduler to ready threads on */
+    int epfd;                               /* epoll instance, -1 if unavailable */
+    int wakefd;                             /* eventfd that interrupts a blocked poll */
+    atomic_int waiters;                     /* Threads parked on descriptors or rings, and selectors */
+    int blocked;                            /* A worker is blocked in epoll_wait (scheduler mutex) */
+    lwt_pollfd_t* _Atomic* table;           /* Chunks of descriptors indexed by fd */
+    int table_chunks;                       /* Number of chunk pointers */
+    pthread_mutex_t mutex;                  /* Serializes registration and chunk allocation */
+} lwt_netpoll_t;
+
+/**
+ * Initialize a poller
+ * 
+ * @param netpoll Poller to initialize
+ * @param scheduler Scheduler that owns it
+ * @return 0 on success, -1 on failure
+ */
+int lwt_netpoll_init(lwt_netpoll_t* netpoll, struct lwt_scheduler* scheduler);
+
+/**
+ * Destroy a poller
+ * 
+ * @param netpoll Poller to destroy
+ */
+void lwt_netpoll_destroy(lwt_netpoll_t* netpoll);
+
+/**
+ * Look up a descriptor, making it non-blocking and registering it on first use
+ * 
+ * Whether a descriptor can be polled is remembered until lwt_close(), so
+ * files fail with EPERM straight away after the first attempt. The
+ * descriptor is only made non-blocking once it is in the epoll set.
+ * 
+ * @param netpoll Poller to use
+ * @param fd Descriptor
+ * @return Poll state, or NULL if fd cannot be polled (errno set)
+ */
+lwt_pollfd_t* lwt_netpoll_fd(lwt_netpoll_t* netpoll, int fd);
+
+/**
+ * Read the edge count of a descriptor before attempting an operation
+ * 
+ * @param pd Poll state from lwt_netpoll_fd
+ * @param mode Readiness the operation needs
+ * @return Count to pass to lwt_netpoll_wait if the operation would block
+ */
+unsigned int lwt_netpoll_edges(lwt_pollfd_t* pd, lwt_poll_mode_t mode);
+
+/**
+ * Park the calling lightweight thread until fd may be ready
+ * 
+ * Any number of threads may wait for the same descriptor; an edge wakes
+ * all of them.
+ * 
+ * @param netpoll Poller to use
+ * @param pd Poll state from lwt_netpoll_fd
+ * @param mode Readiness to wait for
+ * @param edges Edge count read before the attempt that would have blocked
+ * @return 0 when the operation should be retried, -1 if fd was closed (errno EBADF)
+ */
+int lwt_netpoll_wait(lwt_netpoll_t* netpoll, lwt_pollfd_t* pd, lwt_poll_mode_t mode,
+                     unsigned int edges);
+
+/**
+ * Find the poll state of a descriptor without registering it
+ * 
+ * @param netpoll Poller to use
+ * @param fd Descriptor
+ * @return Poll state, or NULL if fd is out of range (errno set)
+ */
+lwt_pollfd_t* lwt_netpoll_state(lwt_netpoll_t* netpoll, int fd);
+
+/**
+ * Check whether lwt_netpoll_close has anything to do for a descriptor
+ * 
+ * Takes no lock, so it only gives a hint: enough to skip descriptors the
+ * poller and the rings have never seen.
+ * 
+ * @param netpoll Poller to use
+ * @param fd Descriptor
+ * @return Non-zero if fd is registered, remembered as unpollable or has
+ *         io_uring requests in flight
+ */
+int lwt_netpoll_known(lwt_netpoll_t* netpoll, int fd);
+
+/**
+ * Unregister a descriptor before it is closed, failing pending waits
+ * 
+ * @param netpoll Poller to use
+ * @param fd Descriptor
+ */
+void lwt_netpoll_close(lwt_netpoll_t* netpoll, int fd);
+
+/**
+ * Collect readiness events and make the parked threads runnable
+ * 
+ * @param netpoll Poller to use
+ * @param timeout_ms epoll_wait timeout (0 polls, -1 blocks)
+ * @return Number of threads made runnable
+ */
+int lwt_netpoll_poll(lwt_netpoll_t* netpoll, int timeout_ms);
+
+/**
+ * Watch an io_uring completion eventfd
+ * 
+ * When it fires, the poll reaps the ring and readies the completed threads.
+ * 
+ * @param netpoll Poller to use
+ * @param eventfd eventfd registered with the ring
+ * @param id Worker that owns the ring
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int lwt_netpoll_add_ring(lwt_netpoll_t* netpoll, int eventfd, int id);
+
+/**
+ * Interrupt a worker blocked in lwt_netpoll_poll
+ * 
+ * @param netpoll Poller to use
+ */
+void lwt_netpoll_break(lwt_netpoll_t* netpoll);
+
+/**
+ * Check whether any thread is parked on a descriptor
+ * 
+ * @param netpoll Poller to check
+ * @return Non-zero if there are waiters
+ */
+int lwt_netpoll_has_waiters(lwt_netpoll_t* netpoll);
+
+#endif /* LWTHREAD_NETPOLL_INTERNAL_H */
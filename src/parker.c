@@ -0,0 +1,119 @@
+/**
+ * @file parker.c
+ * @brief Futex-based parking for idle workers
+ */
+
+#include "parker.h"
+#include <errno.h>
+#include <time.h>
+
+#define LWT_PARKER_EMPTY 0
+#define LWT_PARKER_PARKED 1
+#define LWT_PARKER_NOTIFIED 2
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+int lwt_parker_init(lwt_parker_t* parker) {
+    atomic_init(&parker->state, LWT_PARKER_EMPTY);
+    return 0;
+}
+
+void lwt_parker_destroy(lwt_parker_t* parker) {
+    (void)parker;
+}
+
+void lwt_parker_park(lwt_parker_t* parker, uint64_t deadline) {
+    /* Consume a pending token without sleeping */
+    int expected = LWT_PARKER_NOTIFIED;
+    if (atomic_compare_exchange_strong_explicit(&parker->state, &expected, LWT_PARKER_EMPTY,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+    expected = LWT_PARKER_EMPTY;
+    if (!atomic_compare_exchange_strong_explicit(&parker->state, &expected, LWT_PARKER_PARKED,
+                                                 memory_order_relaxed, memory_order_relaxed)) {
+        /* Notified in between */
+        atomic_store_explicit(&parker->state, LWT_PARKER_EMPTY, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        return;
+    }
+
+    struct timespec ts;
+    if (deadline != UINT64_MAX) {
+        ts.tv_sec = (time_t)(deadline / 1000000000ull);
+        ts.tv_nsec = (long)(deadline % 1000000000ull);
+    }
+
+    /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+    syscall(SYS_futex, &parker->state, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+            LWT_PARKER_PARKED, deadline != UINT64_MAX ? &ts : NULL, NULL,
+            FUTEX_BITSET_MATCH_ANY);
+
+    /* Woken, timed out or interrupted: either way the token (if any) is ours */
+    atomic_exchange_explicit(&parker->state, LWT_PARKER_EMPTY, memory_order_acquire);
+}
+
+void lwt_parker_unpark(lwt_parker_t* parker) {
+    if (atomic_exchange_explicit(&parker->state, LWT_PARKER_NOTIFIED, memory_order_release) ==
+        LWT_PARKER_PARKED) {
+        syscall(SYS_futex, &parker->state, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL, NULL, 0);
+    }
+}
+
+#else /* !__linux__ */
+
+int lwt_parker_init(lwt_parker_t* parker) {
+    atomic_init(&parker->state, LWT_PARKER_EMPTY);
+    if (pthread_mutex_init(&parker->mutex, NULL) != 0) {
+        return -1;
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int rc = pthread_cond_init(&parker->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (rc != 0) {
+        pthread_mutex_destroy(&parker->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+void lwt_parker_destroy(lwt_parker_t* parker) {
+    pthread_cond_destroy(&parker->cond);
+    pthread_mutex_destroy(&parker->mutex);
+}
+
+void lwt_parker_park(lwt_parker_t* parker, uint64_t deadline) {
+    pthread_mutex_lock(&parker->mutex);
+    if (atomic_load_explicit(&parker->state, memory_order_relaxed) != LWT_PARKER_NOTIFIED) {
+        atomic_store_explicit(&parker->state, LWT_PARKER_PARKED, memory_order_relaxed);
+        if (UINT64_MAX == deadline) {
+            pthread_cond_wait(&parker->cond, &parker->mutex);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(deadline / 1000000000ull);
+            ts.tv_nsec = (long)(deadline % 1000000000ull);
+            pthread_cond_timedwait(&parker->cond, &parker->mutex, &ts);
+        }
+    }
+    atomic_store_explicit(&parker->state, LWT_PARKER_EMPTY, memory_order_relaxed);
+    pthread_mutex_unlock(&parker->mutex);
+}
+
+void lwt_parker_unpark(lwt_parker_t* parker) {
+    pthread_mutex_lock(&parker->mutex);
+    int state = atomic_load_explicit(&parker->state, memory_order_relaxed);
+    atomic_store_explicit(&parker->state, LWT_PARKER_NOTIFIED, memory_order_relaxed);
+    if (LWT_PARKER_PARKED == state) {
+        pthread_cond_signal(&parker->cond);
+    }
+    pthread_mutex_unlock(&parker->mutex);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,69 @@
+/**
+ * @file parker.h
+ * @brief Internal one-token parking primitive for idle workers
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_PARKER_INTERNAL_H
+#define LWTHREAD_PARKER_INTERNAL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifndef __linux__
+#include <pthread.h>
+#endif
+
+/**
+ * Parks one OS thread at a time
+ *
+ * lwt_parker_unpark() leaves a token that the next (or current)
+ * lwt_parker_park() consumes, so an unpark that races ahead of the park is
+ * not lost. On Linux this is a futex word; elsewhere a mutex and condition.
+ */
+typedef struct lwt_parker {
+    atomic_int state;               /* Empty, parked or notified */
+#ifndef __linux__
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} lwt_parker_t;
+
+/**
+ * Initialize a parker with no token
+ *
+ * @param parker Parker to initialize
+ * @return 0 on success, -1 on failure
+ */
+int lwt_parker_init(lwt_parker_t* parker);
+
+/**
+ * Destroy a parker
+ *
+ * @param parker Parker to destroy
+ */
+void lwt_parker_destroy(lwt_parker_t* parker);
+
+/**
+ * Block until the token is available or a deadline passes
+ *
+ * May also return spuriously; callers re-check their condition.
+ *
+ * @param parker Parker owned by the calling OS thread
+ * @param deadline CLOCK_MONOTONIC time in nanoseconds, or UINT64_MAX
+ */
+void lwt_parker_park(lwt_parker_t* parker, uint64_t deadline);
+
+/**
+ * Make the token available, waking the parked thread if there is one
+ *
+ * @param parker Parker to unpark
+ */
+void lwt_parker_unpark(lwt_parker_t* parker);
+
+#endif /* LWTHREAD_PARKER_INTERNAL_H */
@@ -0,0 +1,223 @@
+/**
+ * @file preempt.c
+ * @brief Sysmon thread and signal-based preemption
+ */
+
+#define _GNU_SOURCE
+#include "lwthread/lwthread.h"
+#include "preempt.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "timer.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define LWT_HAVE_PREEMPT 1
+#include <link.h>
+#include <sys/auxv.h>
+#include <ucontext.h>
+#endif
+
+#ifdef LWT_HAVE_PREEMPT
+
+/* Executable segments of the main program and the vDSO */
+#define LWT_PREEMPT_MAX_RANGES 8
+
+typedef struct lwt_text_range {
+    uintptr_t start;
+    uintptr_t end;
+} lwt_text_range_t;
+
+static lwt_text_range_t preempt_ranges[LWT_PREEMPT_MAX_RANGES];
+static int preempt_nranges;
+static int preempt_error;
+static pthread_once_t preempt_once = PTHREAD_ONCE_INIT;
+
+/*
+ * dl_iterate_phdr visits the main program first. Of the other objects only
+ * the vDSO is taken: its clock functions hold no locks, and CPU-bound loops
+ * that check the time spend much of theirs there.
+ */
+static int lwt_preempt_collect(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)size;
+    int* objects = (int*)data;
+    uintptr_t vdso = (uintptr_t)getauxval(AT_SYSINFO_EHDR);
+
+    int take = (0 == (*objects)++);
+    for (int i = 0; i < info->dlpi_phnum && !take && vdso != 0; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        uintptr_t start = (uintptr_t)info->dlpi_addr + phdr->p_vaddr;
+        take = (PT_LOAD == phdr->p_type && vdso >= start && vdso < start + phdr->p_memsz);
+    }
+    if (!take) {
+        return 0;
+    }
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (PT_LOAD == phdr->p_type && (phdr->p_flags & PF_X) &&
+            preempt_nranges < LWT_PREEMPT_MAX_RANGES) {
+            lwt_text_range_t* range = &preempt_ranges[preempt_nranges++];
+            range->start = (uintptr_t)info->dlpi_addr + phdr->p_vaddr;
+            range->end = range->start + phdr->p_memsz;
+        }
+    }
+    return 0;
+}
+
+static int lwt_preempt_in_program(uintptr_t pc) {
+    for (int i = 0; i < preempt_nranges; i++) {
+        if (pc >= preempt_ranges[i].start && pc < preempt_ranges[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Interrupted on the thread's own stack, in code that may be switched out */
+static int lwt_preempt_safe_point(struct lwt_thread* thread, void* ucontext) {
+    ucontext_t* uc = (ucontext_t*)ucontext;
+#if defined(__x86_64__)
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    uintptr_t sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+#else
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.pc;
+    uintptr_t sp = (uintptr_t)uc->uc_mcontext.sp;
+#endif
+    uintptr_t stack = (uintptr_t)thread->stack;
+    return sp > stack && sp <= stack + thread->stack_size && lwt_preempt_in_program(pc);
+}
+
+static void lwt_preempt_handler(int sig, siginfo_t* info, void* ucontext) {
+    (void)sig;
+    (void)info;
+    int saved_errno = errno;
+
+    struct lwt_worker* worker = lwt_scheduler_current_worker();
+    struct lwt_thread* thread = worker ? worker->running : NULL;
+    if (thread && 0 == thread->preempt_off && lwt_preempt_safe_point(thread, ucontext)) {
+        /*
+         * The signal frame on the thread's stack holds every interrupted
+         * register, so switching out from here is an ordinary yield; when
+         * the thread runs again, possibly on another worker, the handler
+         * returns and sigreturn resumes it where it was.
+         */
+        lwt_scheduler_yield();
+    }
+    errno = saved_errno;
+}
+
+static void lwt_preempt_install(void) {
+    int objects = 0;
+    dl_iterate_phdr(lwt_preempt_collect, &objects);
+
+    /* Linked into the program itself, our own code would look preemptible */
+    if (0 == preempt_nranges || lwt_preempt_in_program((uintptr_t)&lwt_preempt_handler)) {
+        preempt_error = ENOTSUP;
+        return;
+    }
+
+    /* SA_NODEFER: a handler that switches away must not leave the signal blocked */
+    struct sigaction action;
+    sigemptyset(&action.sa_mask);
+    action.sa_sigaction = lwt_preempt_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+    if (sigaction(LWT_PREEMPT_SIGNAL, &action, NULL) != 0) {
+        preempt_error = errno;
+    }
+}
+
+int lwt_preempt_init(void) {
+    pthread_once(&preempt_once, lwt_preempt_install);
+    if (preempt_error != 0) {
+        errno = preempt_error;
+        return -1;
+    }
+    return 0;
+}
+
+#else /* !LWT_HAVE_PREEMPT */
+
+int lwt_preempt_init(void) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif /* LWT_HAVE_PREEMPT */
+
+/* Check each worker's current run against the time slice, like Go's sysmon retake */
+static void* lwt_sysmon(void* arg) {
+    struct lwt_scheduler* scheduler = (struct lwt_scheduler*)arg;
+    uint64_t period = scheduler->time_slice / 2;
+    if (period < LWT_SYSMON_MIN_PERIOD) {
+        period = LWT_SYSMON_MIN_PERIOD;
+    } else if (period > LWT_SYSMON_MAX_PERIOD) {
+        period = LWT_SYSMON_MAX_PERIOD;
+    }
+
+    while (!atomic_load_explicit(&scheduler->sysmon_exit, memory_order_acquire)) {
+        lwt_parker_park(&scheduler->sysmon_parker, lwt_timer_now() + period);
+
+        /* Worker pthreads are only valid while armed */
+        pthread_mutex_lock(&scheduler->sysmon_mutex);
+        if (scheduler->sysmon_armed) {
+            uint64_t now = lwt_timer_now();
+            for (int i = 0; i < scheduler->num_workers; i++) {
+                struct lwt_worker* worker = &scheduler->workers[i];
+                uint64_t start = atomic_load_explicit(&worker->run_start, memory_order_relaxed);
+                if (start != 0 && now - start >= scheduler->time_slice) {
+                    /* Not at a safe point? The handler does nothing and we retry next period */
+                    pthread_kill(worker->pthread, LWT_PREEMPT_SIGNAL);
+                }
+            }
+        }
+        pthread_mutex_unlock(&scheduler->sysmon_mutex);
+    }
+    return NULL;
+}
+
+int lwt_sysmon_start(struct lwt_scheduler* scheduler) {
+    atomic_init(&scheduler->sysmon_exit, 0);
+    scheduler->sysmon_armed = 0;
+    int rc = pthread_mutex_init(&scheduler->sysmon_mutex, NULL);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    if (lwt_parker_init(&scheduler->sysmon_parker) != 0) {
+        pthread_mutex_destroy(&scheduler->sysmon_mutex);
+        return -1;
+    }
+    rc = pthread_create(&scheduler->sysmon, NULL, lwt_sysmon, scheduler);
+    if (rc != 0) {
+        lwt_parker_destroy(&scheduler->sysmon_parker);
+        pthread_mutex_destroy(&scheduler->sysmon_mutex);
+        errno = rc;
+        return -1;
+    }
+    scheduler->sysmon_started = 1;
+    return 0;
+}
+
+void lwt_sysmon_arm(struct lwt_scheduler* scheduler, int armed) {
+    if (!scheduler->sysmon_started) {
+        return;
+    }
+    pthread_mutex_lock(&scheduler->sysmon_mutex);
+    scheduler->sysmon_armed = armed;
+    pthread_mutex_unlock(&scheduler->sysmon_mutex);
+}
+
+void lwt_sysmon_stop(struct lwt_scheduler* scheduler) {
+    if (!scheduler->sysmon_started) {
+        return;
+    }
+    atomic_store_explicit(&scheduler->sysmon_exit, 1, memory_order_release);
+    lwt_parker_unpark(&scheduler->sysmon_parker);
+    pthread_join(scheduler->sysmon, NULL);
+    lwt_parker_destroy(&scheduler->sysmon_parker);
+    pthread_mutex_destroy(&scheduler->sysmon_mutex);
+    scheduler->sysmon_started = 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file preempt.h
+ * @brief Internal time-slice preemption of lightweight threads
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_PREEMPT_INTERNAL_H
+#define LWTHREAD_PREEMPT_INTERNAL_H
+
+#include <signal.h>
+
+/**
+ * Signal sent to a worker whose thread has used up its time slice
+ *
+ * Like Go, SIGURG: ignored by default and rarely used by applications.
+ */
+#define LWT_PREEMPT_SIGNAL SIGURG
+
+/**
+ * Shortest and longest interval between two sysmon checks, in ns
+ */
+#define LWT_SYSMON_MIN_PERIOD 20000ull
+#define LWT_SYSMON_MAX_PERIOD 10000000ull
+
+struct lwt_scheduler;
+
+/**
+ * Install the preemption signal handler (once per process)
+ *
+ * The handler only switches a thread out at a safe point: on the thread's
+ * own stack, with preemption not disabled, and executing code of the main
+ * executable or the vDSO rather than of this library, the C library or any
+ * other shared object, none of which expect to be interrupted mid-way.
+ *
+ * @return 0 on success, -1 with errno ENOTSUP if this platform or a
+ *         statically linked library cannot tell safe points apart
+ */
+int lwt_preempt_init(void);
+
+/**
+ * Start the sysmon thread that preempts threads overrunning their slice
+ *
+ * Sysmon lives as long as the scheduler, but only signals workers while
+ * armed by lwt_sysmon_arm().
+ *
+ * @param scheduler Scheduler with a non-zero time slice
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int lwt_sysmon_start(struct lwt_scheduler* scheduler);
+
+/**
+ * Let sysmon signal the workers, or stop it from doing so
+ *
+ * Disarming waits for a check in progress, so the workers may be joined
+ * afterwards. Does nothing if sysmon was not started.
+ *
+ * @param scheduler Scheduler whose sysmon to arm
+ * @param armed Non-zero once the workers are running, zero before joining them
+ */
+void lwt_sysmon_arm(struct lwt_scheduler* scheduler, int armed);
+
+/**
+ * Stop the sysmon thread before the scheduler is cleaned up
+ *
+ * @param scheduler Scheduler whose sysmon to stop
+ */
+void lwt_sysmon_stop(struct lwt_scheduler* scheduler);
+
+#endif /* LWTHREAD_PREEMPT_INTERNAL_H */
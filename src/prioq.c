@@ -0,0 +1,104 @@
+/**
+ * @file prioq.c
+ * @brief Priority run queue implementation
+ */
+
+#include "prioq.h"
+#include "thread.h"
+#include "timer.h"
+#include <string.h>
+
+void lwt_prioq_init(lwt_prioq_t* q) {
+    lwt_spin_init(&q->lock);
+    atomic_init(&q->bitmap, 0);
+    atomic_init(&q->count, 0);
+    memset(q->levels, 0, sizeof(q->levels));
+}
+
+/* Append a thread to a level (lock held) */
+static void lwt_prioq_append(lwt_prioq_t* q, int level, struct lwt_thread* thread) {
+    lwt_prio_level_t* l = &q->levels[level];
+    thread->next = NULL;
+    thread->prio_level = level;
+    if (l->tail) {
+        l->tail->next = thread;
+    } else {
+        l->head = thread;
+        atomic_fetch_or_explicit(&q->bitmap, 1u << level, memory_order_relaxed);
+    }
+    l->tail = thread;
+}
+
+/* Take the first thread of a non-empty level (lock held) */
+static struct lwt_thread* lwt_prioq_remove(lwt_prioq_t* q, int level) {
+    lwt_prio_level_t* l = &q->levels[level];
+    struct lwt_thread* thread = l->head;
+    l->head = thread->next;
+    if (NULL == l->head) {
+        l->tail = NULL;
+        atomic_fetch_and_explicit(&q->bitmap, ~(1u << level), memory_order_relaxed);
+    }
+    thread->next = NULL;
+    return thread;
+}
+
+void lwt_prioq_push(lwt_prioq_t* q, struct lwt_thread* thread) {
+    thread->ready_time = lwt_timer_now();
+    lwt_spin_lock(&q->lock);
+    lwt_prioq_append(q, thread->priority, thread);
+    lwt_spin_unlock(&q->lock);
+    atomic_fetch_add_explicit(&q->count, 1, memory_order_release);
+}
+
+/* Promote aged heads one level, top down so nobody moves twice (lock held) */
+static void lwt_prioq_age_locked(lwt_prioq_t* q, uint64_t now) {
+    unsigned int bits = atomic_load_explicit(&q->bitmap, memory_order_relaxed);
+    bits &= ~(1u << LWT_PRIO_MAX);
+    while (bits) {
+        int level = 31 - __builtin_clz(bits);
+        bits &= ~(1u << level);
+
+        struct lwt_thread* head;
+        while ((head = q->levels[level].head) != NULL &&
+               now - head->ready_time >= LWT_PRIO_AGE_NS) {
+            lwt_prioq_remove(q, level);
+            head->ready_time = now;
+            lwt_prioq_append(q, level + 1, head);
+        }
+    }
+}
+
+struct lwt_thread* lwt_prioq_pop(lwt_prioq_t* q, int min_level) {
+    if (lwt_prioq_top(q) < min_level) {
+        return NULL;
+    }
+
+    lwt_spin_lock(&q->lock);
+    unsigned int bits = atomic_load_explicit(&q->bitmap, memory_order_relaxed);
+    if (bits & (bits - 1)) {
+        /* Only worth the clock read while lower levels compete */
+        lwt_prioq_age_locked(q, lwt_timer_now());
+    }
+
+    struct lwt_thread* thread = NULL;
+    int level = lwt_prioq_top(q);
+    if (level >= min_level) {
+        thread = lwt_prioq_remove(q, level);
+    }
+    lwt_spin_unlock(&q->lock);
+
+    if (thread) {
+        atomic_fetch_sub_explicit(&q->count, 1, memory_order_relaxed);
+    }
+    return thread;
+}
+
+void lwt_prioq_age(lwt_prioq_t* q) {
+    if (0 == atomic_load_explicit(&q->count, memory_order_relaxed)) {
+        return;
+    }
+    uint64_t now = lwt_timer_now();
+    lwt_spin_lock(&q->lock);
+    lwt_prioq_age_locked(q, now);
+    lwt_spin_unlock(&q->lock);
+}
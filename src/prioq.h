@@ -0,0 +1,102 @@
+/**
+ * @file prioq.h
+ * @brief Internal run queue for threads above or below the normal priority
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_PRIOQ_INTERNAL_H
+#define LWTHREAD_PRIOQ_INTERNAL_H
+
+#include "lwthread/lwthread.h"
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Number of priority levels
+ */
+#define LWT_PRIO_LEVELS (LWT_PRIO_MAX + 1)
+
+/**
+ * Time a thread waits at one level before it moves up to the next, in ns
+ */
+#define LWT_PRIO_AGE_NS 10000000ull
+
+/**
+ * FIFO list of threads at one level, linked through next
+ */
+typedef struct lwt_prio_level {
+    struct lwt_thread* head;
+    struct lwt_thread* tail;
+} lwt_prio_level_t;
+
+/**
+ * Shared run queue with one FIFO per priority level
+ *
+ * Threads at LWT_PRIO_NORMAL never come here: they keep using the workers'
+ * lock-free deques, so the queue stays empty unless priorities are used.
+ * Bit p of bitmap is set while level p is non-empty, which lets workers
+ * find the highest ready level with a single load, without the lock.
+ *
+ * Waiting threads age: one that has waited LWT_PRIO_AGE_NS at the head of
+ * its level moves to the tail of the next higher one, so a steady stream
+ * of high priority work cannot starve lower levels for ever. A thread is
+ * always queued at its own priority again when it next becomes ready.
+ */
+typedef struct lwt_prioq {
+    lwt_spinlock_t lock;                        /* Protects levels */
+    atomic_uint bitmap;                         /* Non-empty levels */
+    atomic_int count;                           /* Queued threads */
+    lwt_prio_level_t levels[LWT_PRIO_LEVELS];   /* Queued threads per level */
+} lwt_prioq_t;
+
+/**
+ * Initialize a priority queue
+ *
+ * @param q Queue to initialize
+ */
+void lwt_prioq_init(lwt_prioq_t* q);
+
+/**
+ * Queue a thread at its priority
+ *
+ * @param q Queue to push to
+ * @param thread Thread to push
+ */
+void lwt_prioq_push(lwt_prioq_t* q, struct lwt_thread* thread);
+
+/**
+ * Take the first thread of the highest non-empty level
+ *
+ * Ages the waiting threads first.
+ *
+ * @param q Queue to pop from
+ * @param min_level Lowest level to take from
+ * @return Thread or NULL if no level from min_level up holds one
+ */
+struct lwt_thread* lwt_prioq_pop(lwt_prioq_t* q, int min_level);
+
+/**
+ * Move threads that have waited long enough up a level
+ *
+ * @param q Queue to age
+ */
+void lwt_prioq_age(lwt_prioq_t* q);
+
+/**
+ * Get the highest non-empty level without taking the lock
+ *
+ * @param q Queue to check
+ * @return Level, or -1 if the queue is empty
+ */
+static inline int lwt_prioq_top(lwt_prioq_t* q) {
+    unsigned int bits = atomic_load_explicit(&q->bitmap, memory_order_relaxed);
+    return bits ? 31 - __builtin_clz(bits) : -1;
+}
+
+#endif /* LWTHREAD_PRIOQ_INTERNAL_H */
@@ -57,6 +57,24 @@ void lwt_queue_push_locked(lwt_thread_queue_t* queue, struct lwt_thread* thread)
     queue->count++;
 }
 
+void lwt_queue_push_batch_locked(lwt_thread_queue_t* queue, struct lwt_thread** batch,
+                                 unsigned int n) {
+    if (0 == n) {
+        return;
+    }
+    for (unsigned int i = 0; i + 1 < n; i++) {
+        batch[i]->next = batch[i + 1];
+    }
+    batch[n - 1]->next = NULL;
+    if (queue->tail == NULL) {
+        queue->head = batch[0];
+    } else {
+        queue->tail->next = batch[0];
+    }
+    queue->tail = batch[n - 1];
+    queue->count += n;
+}
+
 struct lwt_thread* lwt_queue_pop(lwt_thread_queue_t* queue) {
     if (NULL == queue) {
         errno = EINVAL;
@@ -13,6 +13,7 @@
 #define LWTHREAD_QUEUE_INTERNAL_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 /**
  * Thread queue structure
@@ -21,7 +22,7 @@ typedef struct lwt_thread_queue {
     struct lwt_thread* head;   /* First thread in the queue */
     struct lwt_thread* tail;   /* Last thread in the queue */
     pthread_mutex_t mutex;     /* Queue lock */
-    int count;                 /* Number of threads in the queue */
+    atomic_int count;          /* Number of threads in the queue (readable without the lock) */
 } lwt_thread_queue_t;
 
 /**
@@ -56,6 +57,16 @@ int lwt_queue_push(lwt_thread_queue_t* queue, struct lwt_thread* thread);
  */
 void lwt_queue_push_locked(lwt_thread_queue_t* queue, struct lwt_thread* thread);
 
+/**
+ * Push a batch of threads onto the queue with the lock already held
+ * 
+ * @param queue Queue to push to
+ * @param batch Threads to push, in order
+ * @param n Number of threads in the batch
+ */
+void lwt_queue_push_batch_locked(lwt_thread_queue_t* queue, struct lwt_thread** batch,
+                                 unsigned int n);
+
 /**
  * Pop a thread from the queue
  * 
@@ -4,83 +4,821 @@
  */
 
 #include "scheduler.h"
+#include "select.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 
-/* Thread-local storage for worker ID */
-static __thread int current_worker_id = -1;
+/* Check the global queue first every this many rounds so it cannot starve */
+#define LWT_GLOBAL_QUEUE_INTERVAL 61
 
-void* lwt_worker_function(void* arg) {
-    int* id_ptr = (int*)arg;
-    int id = *id_ptr;
-    struct lwt_scheduler* scheduler = NULL;
-
-    lwt_scheduler_set_worker_id(id);
-
-    /* Find scheduler - it will be set when we run the first thread */
-    /* This is a bit of a hack, but works for our purposes */
-    struct lwt_thread* thread = NULL;
-    while (1) {
-        if (NULL == scheduler) {
-            sleep(1);
+/* Control blocks are allocated this many at a time and never unmapped */
+struct lwt_thread_slab {
+    struct lwt_thread_slab* next;
+    struct lwt_thread threads[LWT_THREAD_SLAB_SIZE];
+};
+
+/* Live schedulers, so that a descriptor can be forgotten by all of them */
+static struct lwt_scheduler* lwt_schedulers = NULL;
+static pthread_mutex_t lwt_schedulers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lwt_schedulers_cond = PTHREAD_COND_INITIALIZER;
+
+/* Thread-local storage for the worker running on this OS thread */
+static __thread struct lwt_worker* current_worker = NULL;
+
+/* Batch size for taking from a shared queue holding count threads */
+static int lwt_worker_batch(struct lwt_worker* worker, int count, int max) {
+    int n = count / worker->scheduler->num_workers + 1;
+    if (n > count) {
+        n = count;
+    }
+    if (max > 0 && n > max) {
+        n = max;
+    }
+    if (n > LWT_DEQUE_SIZE / 2) {
+        n = LWT_DEQUE_SIZE / 2;
+    }
+    return n;
+}
+
+/* Take a batch of threads readied off the workers, unless another worker is at it */
+static struct lwt_thread* lwt_worker_get_injected(struct lwt_worker* worker, int max) {
+    lwt_inject_t* q = &worker->scheduler->inject;
+    if (0 == lwt_inject_size(q) || !lwt_spin_trylock(&q->lock)) {
+        return NULL;
+    }
+
+    int n = lwt_worker_batch(worker, lwt_inject_size(q), max);
+    struct lwt_thread* thread = lwt_inject_pop(q);
+    for (int i = 1; thread && i < n; i++) {
+        struct lwt_thread* extra = lwt_inject_pop(q);
+        if (NULL == extra) {
+            break;
+        }
+        lwt_deque_push(&worker->deque, extra);
+    }
+    lwt_spin_unlock(&q->lock);
+    return thread;
+}
+
+/* Take a batch of threads from the shared queues, keeping the extras locally */
+static struct lwt_thread* lwt_worker_get_global(struct lwt_worker* worker, int max) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    lwt_thread_queue_t* queue = &scheduler->global_queue;
+
+    struct lwt_thread* injected = lwt_worker_get_injected(worker, max);
+    if (injected) {
+        return injected;
+    }
+    if (0 == atomic_load_explicit(&queue->count, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    int n = lwt_worker_batch(worker, queue->count, max);
+    struct lwt_thread* thread = lwt_queue_pop_locked(queue);
+    for (int i = 1; i < n; i++) {
+        lwt_deque_push(&worker->deque, lwt_queue_pop_locked(queue));
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return thread;
+}
+
+/* Local queue is full: move half of it plus the new thread to the global queue */
+static void lwt_worker_push_overflow(struct lwt_worker* worker, struct lwt_thread* thread) {
+    struct lwt_thread* batch[LWT_DEQUE_SIZE / 2 + 1];
+    unsigned int n = lwt_deque_grab(&worker->deque, batch);
+    batch[n++] = thread;
+
+    lwt_thread_queue_t* queue = &worker->scheduler->global_queue;
+    pthread_mutex_lock(&queue->mutex);
+    lwt_queue_push_batch_locked(queue, batch, n);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* Whether a ready thread waits in a deadline heap rather than a run queue */
+static int lwt_scheduler_by_deadline(struct lwt_scheduler* scheduler, struct lwt_thread* thread) {
+    return LWT_SCHED_EDF == scheduler->policy && thread->deadline != LWT_DEADLINE_NONE;
+}
+
+/* Take a worker off the idle list (scheduler mutex held) */
+static void lwt_worker_leave_idle_locked(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    struct lwt_worker** link = &scheduler->idle_workers;
+    while (*link != worker) {
+        link = &(*link)->idle_next;
+    }
+    *link = worker->idle_next;
+    worker->idle_next = NULL;
+    worker->idle = 0;
+    atomic_fetch_sub_explicit(&scheduler->nidle, 1, memory_order_relaxed);
+}
+
+/*
+ * Make sure a particular worker looks at its pinned queue
+ *
+ * The same handshake as lwt_scheduler_wakeup: the fence pairs with the
+ * one in lwt_worker_idle, so either we see the worker counted as idle or
+ * it sees the thread we queued.
+ */
+static void lwt_worker_wakeup(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler->nidle, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    int idle = worker->idle;
+    int polling = worker->polling;
+    if (idle) {
+        lwt_worker_leave_idle_locked(worker);
+        /* It wakes up as a spinning worker, as if unparked by lwt_scheduler_wakeup */
+        atomic_fetch_add_explicit(&scheduler->nspinning, 1, memory_order_seq_cst);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (idle) {
+        lwt_parker_unpark(&worker->parker);
+    } else if (polling) {
+        lwt_netpoll_break(&scheduler->netpoll);
+    }
+}
+
+/* Queue a shared-stack thread for its home worker, the only one that may run it */
+static void lwt_scheduler_add_pinned(struct lwt_thread* thread) {
+    struct lwt_worker* home = thread->home;
+    lwt_inject_push(&home->pinned, thread);
+    if (home != current_worker) {
+        lwt_worker_wakeup(home);
+    }
+}
+
+/* Whether we have shared-stack threads to run and are not backing off */
+static int lwt_worker_pinned_ready(struct lwt_worker* worker) {
+    if (0 == lwt_inject_size(&worker->pinned)) {
+        return 0;
+    }
+    if (worker->shared_retry) {
+        if (lwt_timer_now() < worker->shared_retry) {
+            return 0;
+        }
+        worker->shared_retry = 0;
+    }
+    return 1;
+}
+
+/* Take the oldest of our shared-stack threads (we are the queue's only consumer) */
+static struct lwt_thread* lwt_worker_pop_pinned(struct lwt_worker* worker) {
+    if (!lwt_worker_pinned_ready(worker)) {
+        return NULL;
+    }
+    return lwt_inject_pop(&worker->pinned);
+}
+
+/*
+ * Requeue a shared-stack thread whose frames could not be loaded for lack
+ * of memory, and run none of them for a while rather than retry at once
+ */
+static void lwt_worker_defer_pinned(struct lwt_worker* worker, struct lwt_thread* thread) {
+    lwt_inject_push(&worker->pinned, thread);
+    worker->shared_retry = lwt_timer_now() + LWT_SHARED_RETRY_NS;
+}
+
+#ifdef LWT_CONTEXT_STACK_COPY
+/*
+ * Put a shared-stack thread's frames on our shared stack, first saving
+ * those of the thread there now. Never called on the shared stack itself.
+ */
+static int lwt_worker_load_shared(struct lwt_worker* worker, struct lwt_thread* thread) {
+    struct lwt_thread* owner = worker->shared_owner;
+    if (owner == thread) {
+        return 0;
+    }
+
+    char* top = (char*)worker->shared_stack + worker->scheduler->shared_stack_size;
+    if (owner && lwt_thread_save_stack(owner, top) != 0) {
+        return -1;
+    }
+    lwt_thread_load_stack(thread, top);
+    worker->shared_owner = thread;
+    return 0;
+}
+#else
+static int lwt_worker_load_shared(struct lwt_worker* worker, struct lwt_thread* thread) {
+    /* lwt_thread_setup_shared fails here, so there are no such threads */
+    (void)worker;
+    (void)thread;
+    return -1;
+}
+#endif
+
+/* Push a thread onto a worker's local queue (worker's own OS thread only) */
+static void lwt_worker_push(struct lwt_worker* worker, struct lwt_thread* thread) {
+    if (thread->home) {
+        lwt_scheduler_add_pinned(thread);
+    } else if (lwt_scheduler_by_deadline(worker->scheduler, thread)) {
+        lwt_edf_push(&worker->edf, thread);
+    } else if (thread->priority != LWT_PRIO_NORMAL) {
+        lwt_prioq_push(&worker->scheduler->prioq, thread);
+    } else if (lwt_deque_push(&worker->deque, thread) != 0) {
+        lwt_worker_push_overflow(worker, thread);
+    }
+}
+
+/* Take the runnext thread, unless it has had its turn too often in a row */
+static struct lwt_thread* lwt_worker_take_runnext(struct lwt_worker* worker) {
+    if (NULL == atomic_load_explicit(&worker->runnext, memory_order_relaxed)) {
+        worker->runnext_streak = 0;
+        return NULL;
+    }
+
+    struct lwt_thread* thread = atomic_exchange_explicit(&worker->runnext, NULL,
+                                                         memory_order_acquire);
+    if (thread && ++worker->runnext_streak > LWT_RUNNEXT_STREAK) {
+        /* Threads handing off to each other would starve the local queue */
+        worker->runnext_streak = 0;
+        lwt_worker_push(worker, thread);
+        return NULL;
+    }
+    return thread;
+}
+
+/* Next thread of our own: runnext, then the local queue */
+static struct lwt_thread* lwt_worker_pop_local(struct lwt_worker* worker) {
+    struct lwt_thread* thread = lwt_worker_take_runnext(worker);
+    return thread ? thread : lwt_deque_pop(&worker->deque);
+}
+
+/*
+ * Last resort before parking: take a thread another worker was going to
+ * run next. Like Go, give the owner a moment to get to it first, so that
+ * a thread handing off to another does not lose it to a thief.
+ */
+static struct lwt_thread* lwt_worker_steal_runnext(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        struct lwt_worker* victim = &scheduler->workers[i];
+        if (victim == worker ||
+            NULL == atomic_load_explicit(&victim->runnext, memory_order_relaxed)) {
             continue;
         }
-        pthread_mutex_lock(&scheduler->mutex);
-        while (scheduler->running_flag && scheduler->ready_queue.head == NULL) {
-            pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+        uint64_t until = lwt_timer_now() + LWT_RUNNEXT_GRACE;
+        while (atomic_load_explicit(&victim->runnext, memory_order_relaxed) &&
+               lwt_timer_now() < until) {
+            LWT_CPU_RELAX();
         }
+        struct lwt_thread* thread = atomic_load_explicit(&victim->runnext, memory_order_relaxed);
+        if (thread && atomic_compare_exchange_strong_explicit(&victim->runnext, &thread, NULL,
+                                                              memory_order_acquire,
+                                                              memory_order_relaxed)) {
+            return thread;
+        }
+    }
+    return NULL;
+}
 
-        if (!scheduler->running_flag) {
-            pthread_mutex_unlock(&scheduler->mutex);
-            break;
+static struct lwt_thread* lwt_worker_steal(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    int n = scheduler->num_workers;
+    if (n < 2) {
+        return NULL;
+    }
+
+    /* xorshift32 to pick a random starting victim */
+    unsigned int x = worker->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->rand = x;
+
+    for (int i = 0; i < n; i++) {
+        int victim = (int)((x + (unsigned int)i) % (unsigned int)n);
+        if (victim == worker->id) {
+            continue;
+        }
+        /* Threads with a deadline are the most urgent to move */
+        struct lwt_thread* thread = lwt_edf_pop(&scheduler->workers[victim].edf);
+        if (NULL == thread) {
+            thread = lwt_deque_steal(&worker->deque, &scheduler->workers[victim].deque);
+        }
+        if (thread) {
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Make sure someone will look at newly queued work
+ *
+ * If a worker is spinning it will find the work, so producers do nothing.
+ * Otherwise one idle worker is unparked as a spinning worker; the
+ * nspinning 0 -> 1 transition ensures only one producer pays for that.
+ */
+static void lwt_scheduler_wakeup(struct lwt_scheduler* scheduler) {
+    /* Pairs with the fences in lwt_worker_find_runnable and lwt_worker_idle */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler->nspinning, memory_order_relaxed) != 0 ||
+        atomic_load_explicit(&scheduler->nidle, memory_order_relaxed) == 0) {
+        return;
+    }
+    int expected = 0;
+    if (!atomic_compare_exchange_strong_explicit(&scheduler->nspinning, &expected, 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    struct lwt_worker* worker = scheduler->idle_workers;
+    if (worker) {
+        scheduler->idle_workers = worker->idle_next;
+        worker->idle_next = NULL;
+        worker->idle = 0;
+        atomic_fetch_sub_explicit(&scheduler->nidle, 1, memory_order_relaxed);
+    }
+    int blocked = scheduler->netpoll.blocked;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (worker) {
+        /* It wakes up as the spinning worker we just counted */
+        lwt_parker_unpark(&worker->parker);
+        return;
+    }
+
+    /* Only the worker in epoll_wait is idle */
+    atomic_fetch_sub_explicit(&scheduler->nspinning, 1, memory_order_relaxed);
+    if (blocked) {
+        lwt_netpoll_break(&scheduler->netpoll);
+    }
+}
+
+/* Collect ready descriptors without blocking; woken threads land on our queue */
+static struct lwt_thread* lwt_worker_poll_network(struct lwt_worker* worker) {
+    lwt_netpoll_t* netpoll = &worker->scheduler->netpoll;
+    if (lwt_netpoll_has_waiters(netpoll) && lwt_netpoll_poll(netpoll, 0) > 0) {
+        return lwt_worker_pop_local(worker);
+    }
+    return NULL;
+}
+
+/* Milliseconds until a monotonic time, rounded up, for epoll_wait */
+static int lwt_timeout_ms(uint64_t wake_time) {
+    if (UINT64_MAX == wake_time) {
+        return -1;
+    }
+    uint64_t now = lwt_timer_now();
+    if (wake_time <= now) {
+        return 0;
+    }
+    uint64_t ms = (wake_time - now + 999999) / 1000000;
+    return ms > 0x7fffffff ? 0x7fffffff : (int)ms;
+}
+
+/* Move sleeping threads whose time has come onto the local queue */
+static void lwt_worker_run_timers(struct lwt_worker* worker) {
+    lwt_spin_lock(&worker->timers.lock);
+    if (0 == worker->timers.count) {
+        lwt_spin_unlock(&worker->timers.lock);
+        return;
+    }
+
+    uint64_t now = lwt_timer_now();
+    int woken = 0;
+    struct lwt_thread* thread;
+    while ((thread = lwt_timer_pop_expired(&worker->timers, now)) != NULL) {
+        if (thread->select_timeout) {
+            /* Fired under the wheel lock: the selector cannot unwind until we drop it */
+            thread = lwt_select_fire(thread->select_timeout);
+            if (NULL == thread) {
+                continue;
+            }
         }
-        
-        thread = lwt_queue_pop_locked(&scheduler->ready_queue);
+        thread->state = LWT_STATE_READY;
+        lwt_worker_push(worker, thread);
+        woken++;
+    }
+    lwt_spin_unlock(&worker->timers.lock);
+    if (woken > 1) {
+        lwt_scheduler_wakeup(worker->scheduler);
+    }
+}
+
+/* Find a runnable thread without blocking */
+static struct lwt_thread* lwt_worker_next(struct lwt_worker* worker) {
+    struct lwt_thread* thread;
+
+    /* Completions are a memory read away, so check the ring every round */
+    if (worker->uring.fd >= 0) {
+        lwt_scheduler_complete_ring(worker->scheduler, worker->id);
+    }
+
+    /*
+     * Deadlines, then higher priorities first, except on fair rounds so
+     * normal work cannot starve
+     */
+    worker->schedtick++;
+    if (worker->schedtick % LWT_GLOBAL_QUEUE_INTERVAL != 0) {
+        thread = lwt_edf_pop(&worker->edf);
+        if (thread) {
+            return thread;
+        }
+        thread = lwt_prioq_pop(&worker->scheduler->prioq, LWT_PRIO_NORMAL + 1);
+        if (thread) {
+            return thread;
+        }
+    } else {
+        lwt_prioq_age(&worker->scheduler->prioq);
+        lwt_uring_flush(&worker->uring);
+        thread = lwt_worker_get_global(worker, 1);
+        if (thread) {
+            return thread;
+        }
+        thread = lwt_worker_pop_pinned(worker);
         if (thread) {
-            thread->state = LWT_STATE_RUNNING;
-            scheduler->running[id] = thread;
-            pthread_mutex_unlock(&scheduler->mutex);
-            lwt_thread_set_current(thread);
-            swapcontext(&scheduler->main_contexts[id], &thread->context);
+            return thread;
+        }
+        /* Busy workers never go idle, so look at the network here too */
+        thread = lwt_worker_poll_network(worker);
+        if (thread) {
+            return thread;
+        }
+    }
+
+    thread = lwt_worker_pop_local(worker);
+    if (thread) {
+        return thread;
+    }
+    thread = lwt_worker_pop_pinned(worker);
+    if (thread) {
+        return thread;
+    }
+
+    /* Out of local work: submit the I/O our threads queued meanwhile in one go */
+    lwt_uring_flush(&worker->uring);
+
+    thread = lwt_worker_get_global(worker, 0);
+    if (thread) {
+        return thread;
+    }
+
+    /* Fair rounds skip deadlines and higher levels too, so look at everything */
+    thread = lwt_edf_pop(&worker->edf);
+    if (thread) {
+        return thread;
+    }
+    thread = lwt_prioq_pop(&worker->scheduler->prioq, LWT_PRIO_MIN);
+    if (thread) {
+        return thread;
+    }
+
+    thread = lwt_worker_poll_network(worker);
+    if (thread) {
+        return thread;
+    }
+
+    return lwt_worker_steal(worker);
+}
+
+/* Whether any queue holds work (approximate, used before going idle) */
+static int lwt_scheduler_has_work(struct lwt_scheduler* scheduler) {
+    if (lwt_inject_size(&scheduler->inject) > 0 ||
+        atomic_load_explicit(&scheduler->global_queue.count, memory_order_relaxed) > 0 ||
+        atomic_load_explicit(&scheduler->prioq.count, memory_order_relaxed) > 0) {
+        return 1;
+    }
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        if (lwt_deque_size(&scheduler->workers[i].deque) > 0 ||
+            atomic_load_explicit(&scheduler->workers[i].runnext, memory_order_relaxed) ||
+            atomic_load_explicit(&scheduler->workers[i].edf.count, memory_order_relaxed) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether any queue this worker may take from holds work */
+static int lwt_worker_has_work(struct lwt_worker* worker) {
+    return lwt_worker_pinned_ready(worker) || lwt_scheduler_has_work(worker->scheduler);
+}
+
+/* Whether another worker may start spinning (at most half of the busy ones, as in Go) */
+static int lwt_scheduler_may_spin(struct lwt_scheduler* scheduler) {
+    int nspinning = atomic_load_explicit(&scheduler->nspinning, memory_order_relaxed);
+    int nidle = atomic_load_explicit(&scheduler->nidle, memory_order_relaxed);
+    return 2 * nspinning < scheduler->num_workers - nidle;
+}
+
+/* Leave the spinning state; returns whether we were the last spinning worker */
+static int lwt_worker_stop_spinning(struct lwt_worker* worker) {
+    worker->spinning = 0;
+    return atomic_fetch_sub_explicit(&worker->scheduler->nspinning, 1, memory_order_seq_cst) == 1;
+}
+
+/* Park an idle worker until it is handed work or its earliest timer is due */
+static void lwt_worker_idle(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    lwt_netpoll_t* netpoll = &scheduler->netpoll;
+    lwt_spin_lock(&worker->timers.lock);
+    uint64_t wake_time = lwt_timer_next(&worker->timers);
+    lwt_spin_unlock(&worker->timers.lock);
+    if (worker->shared_retry && worker->shared_retry < wake_time) {
+        wake_time = worker->shared_retry;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    atomic_fetch_add_explicit(&scheduler->nidle, 1, memory_order_relaxed);
+    int poll_network = lwt_netpoll_has_waiters(netpoll) && !netpoll->blocked;
+    if (poll_network) {
+        /* One idle worker waits in epoll_wait instead of on its parker */
+        netpoll->blocked = 1;
+        worker->polling = 1;
+    } else {
+        worker->idle_next = scheduler->idle_workers;
+        scheduler->idle_workers = worker;
+        worker->idle = 1;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    /*
+     * Producers push and then check nidle; we bump nidle and then check
+     * the queues. With a full fence on both sides at least one of us
+     * sees the other, so a wakeup cannot be lost.
+     */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler->running_flag, memory_order_acquire) &&
+        !lwt_worker_has_work(worker)) {
+        if (poll_network) {
+            lwt_netpoll_poll(netpoll, lwt_timeout_ms(wake_time));
         } else {
-            pthread_mutex_unlock(&scheduler->mutex);
+            lwt_parker_park(&worker->parker, wake_time);
         }
     }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (poll_network) {
+        netpoll->blocked = 0;
+        worker->polling = 0;
+        atomic_fetch_sub_explicit(&scheduler->nidle, 1, memory_order_relaxed);
+    } else if (worker->idle) {
+        /* Timer due, work spotted, or shutdown: nobody took us off the list */
+        lwt_worker_leave_idle_locked(worker);
+    } else {
+        /* Unparked by lwt_scheduler_wakeup, which counted us as spinning */
+        worker->spinning = 1;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/* Find a runnable thread, waiting for one if necessary. NULL on shutdown. */
+static struct lwt_thread* lwt_worker_find_runnable(struct lwt_worker* worker) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+
+    while (atomic_load_explicit(&scheduler->running_flag, memory_order_acquire)) {
+        lwt_worker_run_timers(worker);
+
+        struct lwt_thread* thread = lwt_worker_next(worker);
+        if (!thread && (worker->spinning || lwt_scheduler_may_spin(scheduler))) {
+            /* Keep stealing for a while: parking and unparking cost a syscall each */
+            if (!worker->spinning) {
+                worker->spinning = 1;
+                atomic_fetch_add_explicit(&scheduler->nspinning, 1, memory_order_seq_cst);
+            }
+            for (int i = 0; i < LWT_SPIN_ROUNDS && !thread; i++) {
+                LWT_CPU_RELAX();
+                thread = lwt_worker_next(worker);
+            }
+            if (!thread) {
+                thread = lwt_worker_steal_runnext(worker);
+            }
+        }
+
+        if (thread) {
+            /*
+             * A spinning worker that found work stops spinning; if it was the
+             * last one, or it left stealable work behind, get someone else
+             * looking.
+             */
+            int last = worker->spinning && lwt_worker_stop_spinning(worker);
+            if (last || lwt_deque_size(&worker->deque) > 0) {
+                lwt_scheduler_wakeup(scheduler);
+            }
+            return thread;
+        }
+
+        if (worker->spinning) {
+            /*
+             * Producers skip the wakeup while we spin, so look once more
+             * after we stop being counted.
+             */
+            lwt_worker_stop_spinning(worker);
+            if (lwt_worker_has_work(worker)) {
+                continue;
+            }
+        }
+
+        lwt_worker_idle(worker);
+    }
+
+    if (worker->spinning) {
+        lwt_worker_stop_spinning(worker);
+    }
     return NULL;
 }
 
-int lwt_scheduler_init(struct lwt_scheduler* scheduler, int num_workers) {
-    if (NULL == scheduler || num_workers <= 0 || num_workers > LWT_MAX_WORKERS) {
+/* Make a thread the one running on a worker, just before switching to it */
+static void lwt_worker_set_running(struct lwt_worker* worker, struct lwt_thread* thread) {
+    thread->state = LWT_STATE_RUNNING;
+    worker->running = thread;
+    lwt_thread_set_current(thread);
+    if (worker->scheduler->time_slice) {
+        atomic_store_explicit(&worker->run_start, lwt_timer_now(), memory_order_relaxed);
+    }
+}
+
+/*
+ * Run a thread until the worker gets control back, then finish the park
+ * request of whichever thread handed it back. Threads switch among
+ * themselves meanwhile, so that may not be the thread we started.
+ */
+static void lwt_worker_execute(struct lwt_worker* worker, struct lwt_thread* thread) {
+    if (thread->home && lwt_worker_load_shared(worker, thread) != 0) {
+        /* No memory to move the shared stack's occupant off it yet */
+        lwt_worker_defer_pinned(worker, thread);
+        return;
+    }
+
+    lwt_worker_set_running(worker, thread);
+    lwt_context_switch(&worker->main_context, &thread->context);
+
+    if (worker->scheduler->time_slice) {
+        atomic_store_explicit(&worker->run_start, 0, memory_order_relaxed);
+    }
+    lwt_thread_set_current(NULL);
+    worker->running = NULL;
+
+    lwt_park_fn fn = worker->park_fn;
+    worker->park_fn = NULL;
+    if (fn) {
+        fn(worker->park_arg);
+    }
+}
+
+void* lwt_worker_function(void* arg) {
+    struct lwt_worker* worker = (struct lwt_worker*)arg;
+    current_worker = worker;
+
+    struct lwt_thread* thread;
+    while ((thread = lwt_worker_find_runnable(worker)) != NULL) {
+        lwt_worker_execute(worker, thread);
+    }
+
+    current_worker = NULL;
+    return NULL;
+}
+
+/* Give every worker an io_uring registered with the poller */
+static int lwt_scheduler_init_rings(struct lwt_scheduler* scheduler,
+                                    const lwt_scheduler_attr_t* attr) {
+    /* Completions are noticed through the poller */
+    if (scheduler->netpoll.epfd < 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        lwt_uring_t* ring = &scheduler->workers[i].uring;
+        if (lwt_uring_init(ring, attr->uring_entries, attr->uring_sqpoll) != 0 ||
+            lwt_netpoll_add_ring(&scheduler->netpoll, ring->eventfd, i) != 0) {
+            int error = errno;
+            for (int j = 0; j <= i; j++) {
+                lwt_uring_destroy(&scheduler->workers[j].uring);
+            }
+            errno = error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int lwt_scheduler_init(struct lwt_scheduler* scheduler, const lwt_scheduler_attr_t* attr) {
+    if (NULL == scheduler || NULL == attr ||
+        attr->num_threads <= 0 || attr->num_threads > LWT_MAX_WORKERS) {
         errno = EINVAL;
         return -1;
     }
+    int num_workers = attr->num_threads;
 
     memset(scheduler, 0, sizeof(struct lwt_scheduler));
     scheduler->num_workers = num_workers;
-    scheduler->running_flag = 0;
-    scheduler->next_thread_id = 1;
+    scheduler->time_slice = (uint64_t)attr->time_slice_us * 1000ull;
+    scheduler->policy = attr->policy;
+    scheduler->shared_stack_size = attr->shared_stack_size ? attr->shared_stack_size
+                                                           : LWT_SHARED_STACK_SIZE;
+    atomic_init(&scheduler->running_flag, 0);
+    atomic_init(&scheduler->nidle, 0);
+    atomic_init(&scheduler->nspinning, 0);
+    atomic_init(&scheduler->next_thread_id, 1);
 
-    if (lwt_queue_init(&scheduler->ready_queue) != 0) {
+    if (lwt_queue_init(&scheduler->global_queue) != 0) {
         return -1;
     }
+    lwt_prioq_init(&scheduler->prioq);
+    lwt_inject_init(&scheduler->inject);
 
     if (pthread_mutex_init(&scheduler->mutex, NULL) != 0) {
-        lwt_queue_destroy(&scheduler->ready_queue);
+        lwt_queue_destroy(&scheduler->global_queue);
         return -1;
     }
 
-    if (pthread_cond_init(&scheduler->cond, NULL) != 0) {
+    if (pthread_cond_init(&scheduler->join_cond, NULL) != 0) {
         pthread_mutex_destroy(&scheduler->mutex);
-        lwt_queue_destroy(&scheduler->ready_queue);
+        lwt_queue_destroy(&scheduler->global_queue);
         return -1;
     }
 
+    if (pthread_mutex_init(&scheduler->cache_mutex, NULL) != 0) {
+        pthread_cond_destroy(&scheduler->join_cond);
+        pthread_mutex_destroy(&scheduler->mutex);
+        lwt_queue_destroy(&scheduler->global_queue);
+        return -1;
+    }
+    lwt_stack_cache_init(&scheduler->stacks);
+    lwt_thread_cache_init(&scheduler->threads);
+
+    if (lwt_iopool_init(&scheduler->iopool, scheduler) != 0) {
+        pthread_mutex_destroy(&scheduler->cache_mutex);
+        pthread_cond_destroy(&scheduler->join_cond);
+        pthread_mutex_destroy(&scheduler->mutex);
+        lwt_queue_destroy(&scheduler->global_queue);
+        return -1;
+    }
+
+    if (lwt_netpoll_init(&scheduler->netpoll, scheduler) != 0) {
+        lwt_iopool_destroy(&scheduler->iopool);
+        pthread_mutex_destroy(&scheduler->cache_mutex);
+        pthread_cond_destroy(&scheduler->join_cond);
+        pthread_mutex_destroy(&scheduler->mutex);
+        lwt_queue_destroy(&scheduler->global_queue);
+        return -1;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        struct lwt_worker* worker = &scheduler->workers[i];
+        lwt_deque_init(&worker->deque);
+        lwt_edf_init(&worker->edf);
+        lwt_inject_init(&worker->pinned);
+        atomic_init(&worker->runnext, NULL);
+        lwt_timer_init(&worker->timers);
+        lwt_stack_cache_init(&worker->stacks);
+        lwt_thread_cache_init(&worker->threads);
+        lwt_uring_clear(&worker->uring);
+        worker->scheduler = scheduler;
+        worker->id = i;
+        worker->rand = 2654435761u * (unsigned int)(i + 1);
+        if (lwt_parker_init(&worker->parker) != 0) {
+            /* Cleanup only sees the workers set up so far */
+            scheduler->num_workers = i;
+            lwt_scheduler_cleanup(scheduler);
+            return -1;
+        }
+    }
+
+#ifdef LWT_CONTEXT_STACK_COPY
+    /* Only address space until a shared-stack thread runs on it */
     for (int i = 0; i < num_workers; i++) {
-        scheduler->worker_ids[i] = i;
+        size_t size = scheduler->shared_stack_size;
+        scheduler->workers[i].shared_stack = lwt_stack_alloc(&scheduler->workers[i].stacks, &size);
+        if (NULL == scheduler->workers[i].shared_stack) {
+            lwt_scheduler_cleanup(scheduler);
+            errno = ENOMEM;
+            return -1;
+        }
+        scheduler->shared_stack_size = size;
+    }
+#endif
+
+    scheduler->io_backend = LWT_IO_EPOLL;
+    if (attr->io_backend != LWT_IO_EPOLL) {
+        if (lwt_scheduler_init_rings(scheduler, attr) == 0) {
+            scheduler->io_backend = LWT_IO_URING;
+        } else if (LWT_IO_URING == attr->io_backend) {
+            int error = errno;
+            lwt_scheduler_cleanup(scheduler);
+            errno = error;
+            return -1;
+        }
     }
+
+    pthread_mutex_lock(&lwt_schedulers_mutex);
+    scheduler->closers = 0;
+    scheduler->unlisting = 0;
+    scheduler->next_scheduler = lwt_schedulers;
+    lwt_schedulers = scheduler;
+    pthread_mutex_unlock(&lwt_schedulers_mutex);
     return 0;
 }
 
@@ -89,12 +827,68 @@ void lwt_scheduler_cleanup(struct lwt_scheduler* scheduler) {
         return;
     }
     
+    /* Not registered yet if init failed; otherwise wait for closers using us */
+    pthread_mutex_lock(&lwt_schedulers_mutex);
+    for (struct lwt_scheduler** link = &lwt_schedulers; *link; link = &(*link)->next_scheduler) {
+        if (*link == scheduler) {
+            scheduler->unlisting = 1;
+            while (scheduler->closers > 0) {
+                pthread_cond_wait(&lwt_schedulers_cond, &lwt_schedulers_mutex);
+            }
+            *link = scheduler->next_scheduler;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lwt_schedulers_mutex);
+
+    /* Pool threads ready threads through the scheduler, so they go first */
+    lwt_iopool_destroy(&scheduler->iopool);
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        lwt_uring_destroy(&scheduler->workers[i].uring);
+    }
+
     /* Clean up synchronization primitives */
     pthread_mutex_destroy(&scheduler->mutex);
-    pthread_cond_destroy(&scheduler->cond);
+    pthread_cond_destroy(&scheduler->join_cond);
+    pthread_mutex_destroy(&scheduler->cache_mutex);
+    lwt_netpoll_destroy(&scheduler->netpoll);
     
-    /* Clean up queue */
-    lwt_queue_destroy(&scheduler->ready_queue);
+    /* Clean up queues and caches */
+    lwt_queue_destroy(&scheduler->global_queue);
+    lwt_stack_cache_destroy(&scheduler->stacks);
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        struct lwt_worker* worker = &scheduler->workers[i];
+        lwt_parker_destroy(&worker->parker);
+        lwt_timer_destroy(&worker->timers);
+        if (worker->shared_stack) {
+            lwt_stack_free(&worker->stacks, worker->shared_stack, scheduler->shared_stack_size);
+        }
+        lwt_stack_cache_destroy(&worker->stacks);
+    }
+    while (scheduler->slabs) {
+        struct lwt_thread_slab* slab = scheduler->slabs;
+        scheduler->slabs = slab->next;
+        free(slab);
+    }
+}
+
+/* Queue a thread that has a deadline or priority; 0 if it is an ordinary one */
+static int lwt_scheduler_add_special(struct lwt_scheduler* scheduler, struct lwt_worker* worker,
+                                     struct lwt_thread* thread) {
+    if (lwt_scheduler_by_deadline(scheduler, thread)) {
+        if (NULL == worker || worker->scheduler != scheduler) {
+            unsigned int n = atomic_fetch_add_explicit(&scheduler->edf_next, 1,
+                                                       memory_order_relaxed);
+            worker = &scheduler->workers[n % (unsigned int)scheduler->num_workers];
+        }
+        lwt_edf_push(&worker->edf, thread);
+        return 1;
+    }
+    if (thread->priority != LWT_PRIO_NORMAL) {
+        lwt_prioq_push(&scheduler->prioq, thread);
+        return 1;
+    }
+    return 0;
 }
 
 int lwt_scheduler_add_thread(struct lwt_scheduler* scheduler, struct lwt_thread* thread) {
@@ -103,24 +897,432 @@ int lwt_scheduler_add_thread(struct lwt_scheduler* scheduler, struct lwt_thread*
         return -1;
     }
     
-    /* Add thread to ready queue */
     thread->state = LWT_STATE_READY;
-    if (lwt_queue_push(&scheduler->ready_queue, thread) != 0) {
-        return -1;
+    if (thread->home) {
+        lwt_scheduler_add_pinned(thread);
+        return 0;
+    }
+
+    struct lwt_worker* worker = current_worker;
+    if (lwt_scheduler_add_special(scheduler, worker, thread)) {
+        /* Queued by deadline or priority */
+    } else if (worker && worker->scheduler == scheduler) {
+        /* Run it next, where the waker's data is still in cache */
+        struct lwt_thread* old = atomic_exchange_explicit(&worker->runnext, thread,
+                                                          memory_order_release);
+        if (old) {
+            lwt_worker_push(worker, old);
+        }
+    } else {
+        lwt_inject_push(&scheduler->inject, thread);
     }
     
     /* Signal workers that a new thread is ready */
-    pthread_mutex_lock(&scheduler->mutex);
-    pthread_cond_signal(&scheduler->cond);
-    pthread_mutex_unlock(&scheduler->mutex);
-    
+    lwt_scheduler_wakeup(scheduler);
     return 0;
 }
 
-int lwt_scheduler_get_worker_id(void) {
-    return current_worker_id;
+void lwt_scheduler_add_threads(struct lwt_scheduler* scheduler, struct lwt_thread* first) {
+    struct lwt_worker* worker = current_worker;
+    struct lwt_thread* head = NULL;
+    struct lwt_thread** tail = &head;
+    int count = 0;
+
+    while (first) {
+        struct lwt_thread* thread = first;
+        first = thread->next;
+        thread->state = LWT_STATE_READY;
+        if (thread->home) {
+            lwt_scheduler_add_pinned(thread);
+        } else if (!lwt_scheduler_add_special(scheduler, worker, thread)) {
+            *tail = thread;
+            tail = &thread->next;
+            count++;
+        }
+    }
+    *tail = NULL;
+
+    /* Spinning workers that find work wake further ones, so one wakeup starts enough */
+    if (count > 0) {
+        lwt_inject_push_list(&scheduler->inject, head, count);
+    }
+    lwt_scheduler_wakeup(scheduler);
+}
+
+struct lwt_worker* lwt_scheduler_pick_home(struct lwt_scheduler* scheduler) {
+    unsigned int n = atomic_fetch_add_explicit(&scheduler->home_next, 1, memory_order_relaxed);
+    return &scheduler->workers[n % (unsigned int)scheduler->num_workers];
+}
+
+void lwt_scheduler_deadline_done(struct lwt_thread* thread) {
+    if (LWT_DEADLINE_NONE == thread->deadline) {
+        return;
+    }
+
+    /* Only this worker writes its counters, so a plain load and store will do */
+    struct lwt_worker* worker = current_worker;
+    _Atomic uint64_t* counter = lwt_timer_now() > thread->deadline ?
+        &worker->deadlines_missed : &worker->deadlines_met;
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+uint64_t lwt_scheduler_alloc_ids(struct lwt_scheduler* scheduler, int count) {
+    struct lwt_worker* worker = current_worker;
+    if (NULL == worker || worker->scheduler != scheduler || count > LWT_THREAD_ID_BLOCK) {
+        return atomic_fetch_add_explicit(&scheduler->next_thread_id, (uint64_t)count,
+                                         memory_order_relaxed);
+    }
+
+    if (worker->id_end - worker->id_next < (uint64_t)count) {
+        worker->id_next = atomic_fetch_add_explicit(&scheduler->next_thread_id,
+                                                    LWT_THREAD_ID_BLOCK, memory_order_relaxed);
+        worker->id_end = worker->id_next + LWT_THREAD_ID_BLOCK;
+    }
+    uint64_t id = worker->id_next;
+    worker->id_next += (uint64_t)count;
+    return id;
+}
+
+/* Take a control block from the shared cache, growing it by a slab if empty */
+static struct lwt_thread* lwt_scheduler_alloc_thread_locked(struct lwt_scheduler* scheduler) {
+    struct lwt_thread* thread = lwt_thread_cache_get(&scheduler->threads);
+    if (thread) {
+        return thread;
+    }
+
+    struct lwt_thread_slab* slab = calloc(1, sizeof(struct lwt_thread_slab));
+    if (NULL == slab) {
+        return NULL;
+    }
+    slab->next = scheduler->slabs;
+    scheduler->slabs = slab;
+    for (int i = LWT_THREAD_SLAB_SIZE - 1; i > 0; i--) {
+        lwt_thread_cache_put(&scheduler->threads, &slab->threads[i]);
+    }
+    return &slab->threads[0];
+}
+
+struct lwt_thread* lwt_scheduler_alloc_thread(struct lwt_scheduler* scheduler) {
+    struct lwt_worker* worker = current_worker;
+    struct lwt_thread* thread;
+    if (worker && worker->scheduler == scheduler) {
+        thread = lwt_thread_cache_get(&worker->threads);
+        if (thread) {
+            return thread;
+        }
+    }
+
+    pthread_mutex_lock(&scheduler->cache_mutex);
+    thread = lwt_scheduler_alloc_thread_locked(scheduler);
+    if (thread && worker && worker->scheduler == scheduler) {
+        /* Refill our own cache so the next spawns skip the lock */
+        struct lwt_thread* extra;
+        for (int i = 0; i < LWT_THREAD_SLAB_SIZE / 2 &&
+                        (extra = lwt_thread_cache_get(&scheduler->threads)) != NULL; i++) {
+            lwt_thread_cache_put(&worker->threads, extra);
+        }
+    }
+    pthread_mutex_unlock(&scheduler->cache_mutex);
+    return thread;
 }
 
-void lwt_scheduler_set_worker_id(int id) {
-    current_worker_id = id;
-}
\ No newline at end of file
+int lwt_scheduler_alloc_many(struct lwt_scheduler* scheduler, struct lwt_thread** threads,
+                             void** stacks, int n, size_t* stack_size) {
+    struct lwt_worker* worker = current_worker;
+    int own = worker && worker->scheduler == scheduler;
+    size_t size = *stack_size;
+    int i = 0;
+    int rc = 0;
+    if (own) {
+        while (i < n && (threads[i] = lwt_thread_cache_get(&worker->threads)) != NULL) {
+            i++;
+        }
+        if (stacks) {
+            rc = lwt_stack_alloc_many(&worker->stacks, &size, stacks, n);
+        }
+    }
+
+    /* One trip to the shared caches for whatever is still missing */
+    if (i < n || (!own && stacks)) {
+        pthread_mutex_lock(&scheduler->cache_mutex);
+        while (i < n && (threads[i] = lwt_scheduler_alloc_thread_locked(scheduler)) != NULL) {
+            i++;
+        }
+        if (!own && stacks) {
+            rc = lwt_stack_alloc_many(&scheduler->stacks, &size, stacks, n);
+        }
+        pthread_mutex_unlock(&scheduler->cache_mutex);
+    }
+
+    if (i < n || rc != 0) {
+        while (i > 0) {
+            lwt_scheduler_free_thread(scheduler, threads[--i]);
+        }
+        for (int j = 0; stacks && 0 == rc && j < n; j++) {
+            lwt_scheduler_free_stack(scheduler, stacks[j], size);
+        }
+        errno = ENOMEM;
+        return -1;
+    }
+    *stack_size = size;
+    return 0;
+}
+
+void lwt_scheduler_free_thread(struct lwt_scheduler* scheduler, struct lwt_thread* thread) {
+    struct lwt_worker* worker = current_worker;
+    if (worker && worker->scheduler == scheduler &&
+        worker->threads.count < LWT_THREAD_CACHE_WATERMARK) {
+        lwt_thread_cache_put(&worker->threads, thread);
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler->cache_mutex);
+    lwt_thread_cache_put(&scheduler->threads, thread);
+    pthread_mutex_unlock(&scheduler->cache_mutex);
+}
+
+void* lwt_scheduler_alloc_stack(struct lwt_scheduler* scheduler, size_t* size) {
+    struct lwt_worker* worker = current_worker;
+    if (worker && worker->scheduler == scheduler) {
+        return lwt_stack_alloc(&worker->stacks, size);
+    }
+
+    pthread_mutex_lock(&scheduler->cache_mutex);
+    void* stack = lwt_stack_alloc(&scheduler->stacks, size);
+    pthread_mutex_unlock(&scheduler->cache_mutex);
+    return stack;
+}
+
+void lwt_scheduler_free_stack(struct lwt_scheduler* scheduler, void* stack, size_t size) {
+    struct lwt_worker* worker = current_worker;
+    if (worker && worker->scheduler == scheduler &&
+        !lwt_stack_cache_full(&worker->stacks, size)) {
+        lwt_stack_free(&worker->stacks, stack, size);
+        return;
+    }
+
+    /* Spill to the shared cache, where non-worker spawners can reuse it */
+    pthread_mutex_lock(&scheduler->cache_mutex);
+    lwt_stack_free(&scheduler->stacks, stack, size);
+    pthread_mutex_unlock(&scheduler->cache_mutex);
+}
+
+/* Park function for lwt_yield: put the thread back behind the local queue */
+static void lwt_scheduler_requeue(void* arg) {
+    struct lwt_thread* thread = (struct lwt_thread*)arg;
+    thread->state = LWT_STATE_READY;
+    lwt_worker_push(current_worker, thread);
+}
+
+/*
+ * Not inlined: we may have moved to another OS thread since the caller
+ * last looked, and the compiler must not reuse its TLS address.
+ */
+__attribute__((noinline)) void lwt_scheduler_switched(void) {
+    struct lwt_worker* worker = current_worker;
+    lwt_park_fn fn = worker->park_fn;
+    if (fn) {
+        worker->park_fn = NULL;
+        fn(worker->park_arg);
+    }
+}
+
+/*
+ * Pick the next thread on a parking thread's stack
+ *
+ * The parking thread may still hold a lock that only fn releases, such
+ * as a descriptor's, so this looks at nothing but the worker's own run
+ * queues: timers, the poller, rings and other workers are left to the
+ * worker loop, which also gets control on fair rounds and when a timer
+ * is due so that none of them waits behind threads switching among
+ * themselves.
+ */
+static struct lwt_thread* lwt_worker_next_direct(struct lwt_worker* worker) {
+    if ((worker->schedtick + 1) % LWT_GLOBAL_QUEUE_INTERVAL == 0 ||
+        lwt_timer_due(&worker->timers)) {
+        return NULL;
+    }
+
+    struct lwt_thread* thread = lwt_edf_pop(&worker->edf);
+    if (NULL == thread) {
+        thread = lwt_prioq_pop(&worker->scheduler->prioq, LWT_PRIO_NORMAL + 1);
+    }
+    if (NULL == thread) {
+        thread = lwt_worker_pop_local(worker);
+    }
+    if (NULL == thread && NULL == worker->running->home) {
+        /* We are not on the shared stack, so it can be swapped from here */
+        thread = lwt_worker_pop_pinned(worker);
+        if (thread && lwt_worker_load_shared(worker, thread) != 0) {
+            lwt_worker_defer_pinned(worker, thread);
+            thread = NULL;
+        }
+    }
+    if (thread) {
+        worker->schedtick++;
+    }
+    return thread;
+}
+
+void lwt_scheduler_park(lwt_park_fn fn, void* arg) {
+    struct lwt_worker* worker = current_worker;
+    struct lwt_thread* thread = worker->running;
+
+    worker->park_fn = fn;
+    worker->park_arg = arg;
+
+    /* Switch straight to the next thread, or to the worker to find one */
+    struct lwt_thread* next = lwt_worker_next_direct(worker);
+    if (next) {
+        lwt_worker_set_running(worker, next);
+        lwt_context_switch(&thread->context, &next->context);
+    } else {
+        lwt_context_switch(&thread->context, &worker->main_context);
+    }
+
+    /* Resumed by the worker, which has run fn already, or directly by a thread */
+    lwt_scheduler_switched();
+}
+
+void lwt_scheduler_yield(void) {
+    struct lwt_worker* worker = current_worker;
+    lwt_scheduler_park(lwt_scheduler_requeue, worker->running);
+}
+
+/* Take a thread out of whichever runnext slot holds it, ours first */
+static int lwt_scheduler_claim_runnext(struct lwt_worker* worker, struct lwt_thread* thread) {
+    struct lwt_scheduler* scheduler = worker->scheduler;
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        struct lwt_worker* owner = &scheduler->workers[(worker->id + i) % scheduler->num_workers];
+        struct lwt_thread* expected = thread;
+        if (atomic_compare_exchange_strong_explicit(&owner->runnext, &expected, NULL,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int lwt_scheduler_yield_to(struct lwt_thread* thread) {
+    struct lwt_worker* worker = current_worker;
+    struct lwt_thread* self = worker->running;
+    if (!lwt_scheduler_claim_runnext(worker, thread)) {
+        lwt_scheduler_yield();
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* Hand the worker over; thread requeues us once our context is saved */
+    worker->park_fn = lwt_scheduler_requeue;
+    worker->park_arg = self;
+    lwt_worker_set_running(worker, thread);
+    lwt_context_switch(&self->context, &thread->context);
+
+    lwt_scheduler_switched();
+    return 0;
+}
+
+/* Park function for sleeping: file the thread in this worker's timer wheel */
+static void lwt_scheduler_add_timer(void* arg) {
+    struct lwt_thread* thread = (struct lwt_thread*)arg;
+    struct lwt_worker* worker = current_worker;
+    lwt_spin_lock(&worker->timers.lock);
+    lwt_timer_add(&worker->timers, thread);
+    lwt_spin_unlock(&worker->timers.lock);
+}
+
+void lwt_scheduler_sleep_until(uint64_t wake_time) {
+    struct lwt_thread* thread = current_worker->running;
+    thread->wake_time = wake_time;
+    thread->state = LWT_STATE_BLOCKED;
+    lwt_scheduler_park(lwt_scheduler_add_timer, thread);
+}
+
+/* Park function for I/O: hand the request to the ring or the blocking pool */
+static void lwt_scheduler_submit_parked(void* arg) {
+    lwt_io_request_t* req = (lwt_io_request_t*)arg;
+    struct lwt_worker* worker = current_worker;
+    struct lwt_scheduler* scheduler = worker->scheduler;
+
+    int rc;
+    if (worker->uring.fd >= 0) {
+        /* Counted as a poller waiter so that an idle worker watches the ring's eventfd */
+        atomic_fetch_add_explicit(&scheduler->netpoll.waiters, 1, memory_order_relaxed);
+        rc = lwt_uring_submit(&worker->uring, req);
+        if (rc != 0) {
+            atomic_fetch_sub_explicit(&scheduler->netpoll.waiters, 1, memory_order_relaxed);
+        }
+    } else {
+        rc = lwt_iopool_submit(&scheduler->iopool, req);
+    }
+
+    if (rc != 0) {
+        req->result = -errno;
+        req->thread->state = LWT_STATE_READY;
+        lwt_worker_push(worker, req->thread);
+    }
+}
+
+long lwt_scheduler_submit_io(lwt_io_request_t* req) {
+    struct lwt_thread* thread = current_worker->running;
+    req->thread = thread;
+    thread->state = LWT_STATE_BLOCKED;
+    lwt_scheduler_park(lwt_scheduler_submit_parked, req);
+    return req->result;
+}
+
+int lwt_scheduler_complete_ring(struct lwt_scheduler* scheduler, int id) {
+    struct lwt_thread* thread = lwt_uring_reap(&scheduler->workers[id].uring);
+    int woken = 0;
+    while (thread) {
+        /* next is reused once the thread is queued */
+        struct lwt_thread* next = thread->next;
+        atomic_fetch_sub_explicit(&scheduler->netpoll.waiters, 1, memory_order_relaxed);
+        lwt_scheduler_add_thread(scheduler, thread);
+        thread = next;
+        woken++;
+    }
+    return woken;
+}
+
+void lwt_scheduler_close_fd(int fd) {
+    pthread_mutex_lock(&lwt_schedulers_mutex);
+    for (struct lwt_scheduler* scheduler = lwt_schedulers; scheduler;
+         scheduler = scheduler->next_scheduler) {
+        /* The poller tracks every descriptor used, rings included */
+        if (scheduler->unlisting || !lwt_netpoll_known(&scheduler->netpoll, fd)) {
+            continue;
+        }
+
+        /* While we hold a closer count the scheduler stays listed */
+        scheduler->closers++;
+        pthread_mutex_unlock(&lwt_schedulers_mutex);
+
+        lwt_pollfd_t* pd = lwt_netpoll_state(&scheduler->netpoll, fd);
+        if (LWT_IO_URING == scheduler->io_backend && pd &&
+            atomic_load_explicit(&pd->inflight, memory_order_relaxed) > 0) {
+            /* Requests may be queued on any worker's ring */
+            for (int i = 0; i < scheduler->num_workers; i++) {
+                lwt_uring_cancel_fd(&scheduler->workers[i].uring, fd);
+            }
+        }
+        /* Shared-stack threads use the poller even with io_uring */
+        lwt_netpoll_close(&scheduler->netpoll, fd);
+
+        pthread_mutex_lock(&lwt_schedulers_mutex);
+        if (0 == --scheduler->closers) {
+            pthread_cond_broadcast(&lwt_schedulers_cond);
+        }
+    }
+    pthread_mutex_unlock(&lwt_schedulers_mutex);
+}
+
+struct lwt_worker* lwt_scheduler_current_worker(void) {
+    return current_worker;
+}
+
+int lwt_scheduler_get_worker_id(void) {
+    return current_worker ? current_worker->id : -1;
+}
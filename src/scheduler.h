@@ -12,35 +12,152 @@
 #ifndef LWTHREAD_SCHEDULER_INTERNAL_H
 #define LWTHREAD_SCHEDULER_INTERNAL_H
 
+#include "context.h"
+#include "deque.h"
+#include "edf.h"
+#include "inject.h"
+#include "io.h"
+#include "iopool.h"
+#include "netpoll.h"
+#include "parker.h"
+#include "preempt.h"
+#include "prioq.h"
 #include "queue.h"
+#include "stack.h"
 #include "thread.h"
+#include "timer.h"
+#include "uring.h"
 #include <pthread.h>
-#include <ucontext.h>
+#include <stdatomic.h>
 
 /**
  * Maximum number of worker threads
  */
 #define LWT_MAX_WORKERS 64
 
+/**
+ * Size of a cache line, used to keep per-worker state apart
+ */
+#define LWT_CACHE_LINE 64
+
+/**
+ * Rounds of stealing an idle worker does before it parks
+ */
+#define LWT_SPIN_ROUNDS 4
+
+/**
+ * Consecutive threads a worker takes from its runnext slot before it lets
+ * its local queue have a turn
+ */
+#define LWT_RUNNEXT_STREAK 16
+
+/**
+ * How long a thief gives a busy worker to take its own runnext thread
+ * before stealing it, in ns
+ */
+#define LWT_RUNNEXT_GRACE 3000
+
+/**
+ * Thread IDs a worker claims from the scheduler at a time
+ */
+#define LWT_THREAD_ID_BLOCK 256
+
+/**
+ * Size of each worker's shared stack unless configured: 1MB
+ */
+#define LWT_SHARED_STACK_SIZE (1024 * 1024)
+
+/**
+ * How long a worker leaves its shared-stack threads alone after it had no
+ * memory to save the shared stack's occupant, in ns
+ */
+#define LWT_SHARED_RETRY_NS 1000000
+
+/**
+ * Function run by the worker once a thread has switched out
+ */
+typedef void (*lwt_park_fn)(void* arg);
+
+/**
+ * Per-worker state
+ */
+struct lwt_worker {
+    _Alignas(LWT_CACHE_LINE)
+    lwt_deque_t deque;                  /* Local run queue */
+    struct lwt_thread* _Atomic runnext; /* Woken thread to run after the current one */
+    unsigned int runnext_streak;        /* Threads in a row taken from runnext */
+    lwt_edf_heap_t edf;                 /* Ready threads with a deadline (LWT_SCHED_EDF) */
+    lwt_inject_t pinned;                /* Ready shared-stack threads, which only we run */
+    void* shared_stack;                 /* Stack our shared-stack threads run on */
+    struct lwt_thread* shared_owner;    /* Thread whose frames are on shared_stack, or NULL */
+    uint64_t shared_retry;              /* No pinned thread is run before this, or 0 */
+    lwt_context_t main_context;         /* Worker's scheduling context */
+    lwt_timer_wheel_t timers;           /* Threads sleeping on this worker */
+    lwt_stack_cache_t stacks;           /* Stacks freed on this worker */
+    lwt_thread_cache_t threads;         /* Control blocks freed on this worker */
+    lwt_uring_t uring;                  /* io_uring, unused with the epoll backend */
+    lwt_parker_t parker;                /* Idle workers sleep here */
+    struct lwt_worker* idle_next;       /* Next idle worker (scheduler mutex) */
+    int idle;                           /* On the idle list (scheduler mutex) */
+    int polling;                        /* Idle in epoll_wait (scheduler mutex) */
+    int spinning;                       /* Counted in nspinning */
+    struct lwt_scheduler* scheduler;    /* Back-reference to scheduler */
+    struct lwt_thread* running;         /* Currently running thread */
+    lwt_park_fn park_fn;                /* Run after the current thread switches out */
+    void* park_arg;                     /* Argument to park_fn */
+    _Atomic uint64_t run_start;         /* When running was switched in (preemption only), else 0 */
+    _Atomic uint64_t deadlines_met;     /* Written by this worker only */
+    _Atomic uint64_t deadlines_missed;  /* Written by this worker only */
+    pthread_t pthread;                  /* OS worker thread */
+    unsigned int schedtick;             /* Number of scheduling rounds */
+    unsigned int rand;                  /* Victim selection state for stealing */
+    uint64_t id_next;                   /* Next of this worker's claimed thread IDs */
+    uint64_t id_end;                    /* End of this worker's claimed thread IDs */
+    int id;                             /* Worker index */
+};
+
 /**
  * Scheduler structure
  */
 struct lwt_scheduler {
-    lwt_thread_queue_t ready_queue;                 /* Queue of ready threads */
-    pthread_t workers[LWT_MAX_WORKERS];             /* OS worker threads */
-    int worker_ids[LWT_MAX_WORKERS];                /* Worker thread IDs */
+    struct lwt_worker workers[LWT_MAX_WORKERS];     /* Per-worker state */
+    lwt_inject_t inject;                            /* Threads readied by non-worker threads */
+    lwt_thread_queue_t global_queue;                /* Overflow from full local queues */
+    lwt_prioq_t prioq;                              /* Ready threads not at LWT_PRIO_NORMAL */
     int num_workers;                                /* Number of worker threads */
-    struct lwt_thread* running[LWT_MAX_WORKERS];    /* Currently running threads */
-    ucontext_t main_contexts[LWT_MAX_WORKERS];      /* Main contexts for workers */
-    pthread_mutex_t mutex;                          /* Mutex for scheduler state */
-    pthread_cond_t cond;                            /* Condition for signaling workers */
-    int running_flag;                               /* Whether scheduler is running */
-    int next_thread_id;                             /* For generating unique thread IDs */
+    pthread_mutex_t mutex;                          /* Mutex for idle workers and joiners */
+    struct lwt_worker* idle_workers;                /* Parked workers, most recent first */
+    pthread_cond_t join_cond;                       /* Condition for non-lwt joiners */
+    lwt_netpoll_t netpoll;                          /* Descriptor readiness poller */
+    lwt_io_backend_t io_backend;                    /* LWT_IO_EPOLL or LWT_IO_URING */
+    lwt_sched_policy_t policy;                      /* How ready threads are ordered */
+    atomic_uint edf_next;                           /* Spreads deadline threads readied off-worker */
+    atomic_uint home_next;                          /* Spreads shared-stack threads over workers */
+    size_t shared_stack_size;                       /* Usable size of each worker's shared stack */
+    lwt_iopool_t iopool;                            /* Blocking file I/O without io_uring */
+    lwt_stack_cache_t stacks;                       /* Stacks for non-worker threads */
+    lwt_thread_cache_t threads;                     /* Control blocks for non-worker threads */
+    struct lwt_thread_slab* slabs;                  /* Every control block slab, for cleanup */
+    pthread_mutex_t cache_mutex;                    /* Protects stacks, threads and slabs */
+    atomic_int nidle;                               /* Parked workers, plus the one in epoll_wait */
+    atomic_int nspinning;                           /* Workers looking for work without parking */
+    atomic_int running_flag;                        /* Whether scheduler is running */
+    uint64_t time_slice;                            /* Preemption time slice in ns, 0 if off */
+    pthread_t sysmon;                               /* Preempts threads overrunning their slice */
+    lwt_parker_t sysmon_parker;                     /* Sysmon sleeps here between checks */
+    int sysmon_started;                             /* Whether sysmon is running */
+    atomic_int sysmon_exit;                         /* Tells sysmon to return */
+    pthread_mutex_t sysmon_mutex;                   /* Protects sysmon_armed */
+    int sysmon_armed;                               /* Workers are up and may be signalled */
+    _Atomic uint64_t next_thread_id;                /* First thread ID not yet handed out */
+    struct lwt_scheduler* next_scheduler;           /* Next live scheduler in the process */
+    int closers;                                    /* lwt_close calls working on us unlisted */
+    int unlisting;                                  /* Being destroyed: no new closers */
 };
 
 /**
  * Worker thread function
- * @param arg Worker thread argument (pointer to worker ID)
+ * @param arg Worker thread argument (pointer to struct lwt_worker)
  * @return Always returns NULL
  */
 void* lwt_worker_function(void* arg);
@@ -49,10 +166,10 @@ void* lwt_worker_function(void* arg);
  * Initialize the scheduler
  * 
  * @param scheduler Scheduler to initialize
- * @param num_workers Number of worker threads
+ * @param attr Validated creation attributes
  * @return 0 on success, -1 on failure
  */
-int lwt_scheduler_init(struct lwt_scheduler* scheduler, int num_workers);
+int lwt_scheduler_init(struct lwt_scheduler* scheduler, const lwt_scheduler_attr_t* attr);
 
 /**
  * Clean up scheduler resources
@@ -62,7 +179,17 @@ int lwt_scheduler_init(struct lwt_scheduler* scheduler, int num_workers);
 void lwt_scheduler_cleanup(struct lwt_scheduler* scheduler);
 
 /**
- * Add a thread to the scheduler's ready queue
+ * Make a thread runnable
+ * 
+ * From a worker of the same scheduler the thread goes into that worker's
+ * runnext slot, so that it runs as soon as the current thread switches
+ * out, and a thread already in the slot moves to the local queue. From
+ * anywhere else it goes onto the injection queue. Threads
+ * with a priority other than LWT_PRIO_NORMAL go onto the shared priority
+ * queue instead, and under LWT_SCHED_EDF threads with a deadline go onto
+ * a worker's deadline heap. An idle worker is woken if there is one.
+ * Shared-stack threads always go onto their home worker's pinned queue,
+ * and wake that worker.
  * 
  * @param scheduler Scheduler to add to
  * @param thread Thread to add
@@ -71,17 +198,198 @@ void lwt_scheduler_cleanup(struct lwt_scheduler* scheduler);
 int lwt_scheduler_add_thread(struct lwt_scheduler* scheduler, struct lwt_thread* thread);
 
 /**
- * Get the worker ID for the current thread
+ * Make a chain of new threads runnable at once
  * 
- * @return Worker ID or -1 if not a worker
+ * Threads routed as by lwt_scheduler_add_thread() to the priority queue
+ * or a deadline heap go there one by one; the rest are spliced onto the
+ * injection queue with a single exchange, and one idle worker is woken.
+ * Workers that find work while spinning wake further ones as needed.
+ * 
+ * @param scheduler Scheduler to add to
+ * @param first First thread, the rest linked through next (clobbered)
  */
-int lwt_scheduler_get_worker_id(void);
+void lwt_scheduler_add_threads(struct lwt_scheduler* scheduler, struct lwt_thread* first);
+
+/**
+ * Pick the worker a new shared-stack thread will live on
+ * 
+ * @param scheduler Scheduler the thread belongs to
+ * @return Worker, chosen round-robin
+ */
+struct lwt_worker* lwt_scheduler_pick_home(struct lwt_scheduler* scheduler);
+
+/**
+ * Count a thread's deadline as met or missed (on a worker)
+ * 
+ * @param thread Thread whose deadline is over, with or without one
+ */
+void lwt_scheduler_deadline_done(struct lwt_thread* thread);
+
+/**
+ * Reserve a range of unique thread IDs
+ * 
+ * A worker hands out IDs from a block it claimed earlier and claims the
+ * next block with an atomic add; other callers and ranges larger than a
+ * block go to the scheduler's counter directly. IDs are unique but not
+ * ordered by creation across workers.
+ * 
+ * @param scheduler Scheduler the threads belong to
+ * @param count Number of IDs
+ * @return First ID of the range
+ */
+uint64_t lwt_scheduler_alloc_ids(struct lwt_scheduler* scheduler, int count);
+
+/**
+ * Allocate a thread control block
+ * 
+ * Recycles a block from the calling worker's cache, then the shared
+ * cache, and carves a new slab when both are empty.
+ * 
+ * @param scheduler Scheduler the thread will belong to
+ * @return Uninitialized control block, or NULL on failure
+ */
+struct lwt_thread* lwt_scheduler_alloc_thread(struct lwt_scheduler* scheduler);
+
+/**
+ * Allocate several thread control blocks and stacks together
+ * 
+ * Takes what the calling worker's caches hold, then everything else with
+ * a single acquisition of the shared caches' lock.
+ * 
+ * @param scheduler Scheduler the threads will belong to
+ * @param threads Receives n uninitialized control blocks
+ * @param stacks Receives n stacks, or NULL for control blocks only
+ * @param n Number of threads
+ * @param stack_size In: requested size; out: usable size of every stack
+ * @return 0 on success, -1 on failure (errno set to ENOMEM, nothing allocated)
+ */
+int lwt_scheduler_alloc_many(struct lwt_scheduler* scheduler, struct lwt_thread** threads,
+                             void** stacks, int n, size_t* stack_size);
 
 /**
- * Set the worker ID for the current thread
+ * Recycle a thread control block
  * 
- * @param id Worker ID
+ * @param scheduler Scheduler the thread belongs to
+ * @param thread Control block to recycle (its stack must be released)
  */
-void lwt_scheduler_set_worker_id(int id);
+void lwt_scheduler_free_thread(struct lwt_scheduler* scheduler, struct lwt_thread* thread);
+
+/**
+ * Allocate a thread stack
+ * 
+ * Reuses a stack from the calling worker's cache when called on one of
+ * this scheduler's workers, otherwise from the scheduler's shared cache.
+ * 
+ * @param scheduler Scheduler the thread belongs to
+ * @param size In: requested size; out: usable size
+ * @return Lowest usable address of the stack, or NULL on failure
+ */
+void* lwt_scheduler_alloc_stack(struct lwt_scheduler* scheduler, size_t* size);
+
+/**
+ * Release a thread stack for reuse
+ * 
+ * @param scheduler Scheduler the thread belongs to
+ * @param stack Stack returned by lwt_scheduler_alloc_stack
+ * @param size Usable size returned by lwt_scheduler_alloc_stack
+ */
+void lwt_scheduler_free_stack(struct lwt_scheduler* scheduler, void* stack, size_t size);
+
+/**
+ * Switch the calling lightweight thread out to its worker
+ * 
+ * The caller sets its own state beforehand. fn(arg) runs on the worker
+ * after the thread's context has been saved, so it may safely publish the
+ * thread to other workers (requeue it, release a lock a waker needs, ...).
+ * Returns when the thread is next scheduled, possibly on another worker.
+ * 
+ * @param fn Function to run on the worker, or NULL
+ * @param arg Argument to fn
+ */
+void lwt_scheduler_park(lwt_park_fn fn, void* arg);
+
+/**
+ * Requeue the calling lightweight thread behind its worker's local queue
+ * and switch out
+ */
+void lwt_scheduler_yield(void);
+
+/**
+ * Switch the calling lightweight thread straight to another one
+ * 
+ * Only a thread waiting in a runnext slot can be taken out of the run
+ * queues safely, so any other thread makes this an ordinary yield. The
+ * caller is requeued as by lwt_scheduler_yield().
+ * 
+ * @param thread Thread to run
+ * @return 0 if thread ran, -1 with errno EAGAIN if we yielded instead
+ */
+int lwt_scheduler_yield_to(struct lwt_thread* thread);
+
+/**
+ * Finish a switch on the side of the thread switched to
+ * 
+ * Runs the park function left by the thread switched from. Called by
+ * every lightweight thread whenever it resumes or first starts.
+ */
+void lwt_scheduler_switched(void);
+
+/**
+ * Park the calling lightweight thread until a monotonic time
+ * 
+ * The thread sleeps in its worker's timer wheel; the worker keeps running
+ * other threads and wakes it once the time has passed.
+ * 
+ * @param wake_time CLOCK_MONOTONIC time in nanoseconds
+ */
+void lwt_scheduler_sleep_until(uint64_t wake_time);
+
+/**
+ * Park the calling lightweight thread on an I/O request
+ * 
+ * The request goes to the worker's io_uring, or to the blocking pool with
+ * the epoll backend, once the thread has switched out.
+ * 
+ * @param req Request to run
+ * @return Request result, or -errno on failure
+ */
+long lwt_scheduler_submit_io(lwt_io_request_t* req);
+
+/**
+ * Ready the threads whose requests completed on a worker's ring
+ * 
+ * Any worker may call this, e.g. when the ring's eventfd fires.
+ * 
+ * @param scheduler Scheduler to use
+ * @param id Worker that owns the ring
+ * @return Number of threads made runnable
+ */
+int lwt_scheduler_complete_ring(struct lwt_scheduler* scheduler, int id);
+
+/**
+ * Forget a descriptor that is about to be closed, in every scheduler
+ * 
+ * Fails the waits pending on it and cancels its ring requests, so that
+ * a later descriptor with the same number starts afresh. Any thread may
+ * call this. Schedulers that have never seen the descriptor cost a table
+ * lookup, and rings are only entered when requests are in flight.
+ * 
+ * @param fd Descriptor
+ */
+void lwt_scheduler_close_fd(int fd);
+
+/**
+ * Get the worker running on the current OS thread
+ * 
+ * @return Worker or NULL if not a worker
+ */
+struct lwt_worker* lwt_scheduler_current_worker(void);
+
+/**
+ * Get the worker ID for the current thread
+ * 
+ * @return Worker ID or -1 if not a worker
+ */
+int lwt_scheduler_get_worker_id(void);
 
-#endif /* LWTHREAD_SCHEDULER_INTERNAL_H */
\ No newline at end of file
+#endif /* LWTHREAD_SCHEDULER_INTERNAL_H */
@@ -0,0 +1,418 @@
+/**
+ * @file select.c
+ * @brief Waiting on several sources at once, and events
+ */
+
+#include "lwthread/lwthread.h"
+#include "netpoll.h"
+#include "scheduler.h"
+#include "select.h"
+#include "thread.h"
+#include "timer.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sources whose entries fit on the stack */
+#define LWT_SELECT_STACK_ENTRIES 8
+
+void lwt_select_link(lwt_select_entry_t** head, lwt_select_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = *head;
+    if (*head) {
+        (*head)->prev = entry;
+    }
+    *head = entry;
+    entry->linked = 1;
+}
+
+void lwt_select_unlink(lwt_select_entry_t** head, lwt_select_entry_t* entry) {
+    if (!entry->linked) {
+        return;
+    }
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        *head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+    entry->linked = 0;
+}
+
+/* Try to make index the winning source */
+static int lwt_select_claim(lwt_selector_t* sel, int index) {
+    int expected = -1;
+    return atomic_compare_exchange_strong_explicit(&sel->fired, &expected, index,
+                                                   memory_order_acq_rel, memory_order_acquire);
+}
+
+struct lwt_thread* lwt_select_fire(lwt_select_entry_t* entry) {
+    lwt_selector_t* sel = entry->selector;
+    if (!lwt_select_claim(sel, entry->index)) {
+        return NULL;    /* Another source won */
+    }
+
+    if (sel->thread) {
+        /* Second to arrive: the thread has switched out and is ours to run */
+        if (atomic_fetch_sub_explicit(&sel->pending, 1, memory_order_acq_rel) == 1) {
+            return sel->thread;
+        }
+        return NULL;
+    }
+
+    lwt_spin_lock(&sel->lock);
+    sel->done = 1;
+    lwt_parker_unpark(sel->parker);
+    lwt_spin_unlock(&sel->lock);
+    return NULL;
+}
+
+void lwt_select_fire_list(lwt_select_entry_t** head, int mode, struct lwt_thread** ready) {
+    lwt_select_entry_t* entry = *head;
+    while (entry) {
+        lwt_select_entry_t* next = entry->next;
+        if (mode < 0 || entry->mode == mode) {
+            lwt_select_unlink(head, entry);
+            struct lwt_thread* thread = lwt_select_fire(entry);
+            if (thread) {
+                thread->next = *ready;
+                *ready = thread;
+            }
+        }
+        entry = next;
+    }
+}
+
+int lwt_select_ready(struct lwt_thread* threads) {
+    int count = 0;
+    while (threads) {
+        struct lwt_thread* thread = threads;
+        threads = thread->next;
+        thread->next = NULL;
+        lwt_scheduler_add_thread(thread->scheduler, thread);
+        count++;
+    }
+    return count;
+}
+
+/* Link an entry into a source's list (source lock held) */
+static void lwt_select_attach(lwt_select_entry_t* entry, lwt_spinlock_t* lock,
+                              lwt_select_entry_t** head) {
+    entry->source_lock = lock;
+    entry->source = head;
+    lwt_select_link(head, entry);
+}
+
+/* Register with a descriptor; only lightweight threads have a poller to use */
+static int lwt_select_register_fd(lwt_select_entry_t* entry, const lwt_select_source_t* source,
+                             struct lwt_worker* worker) {
+    if (NULL == worker || worker->scheduler->netpoll.epfd < 0) {
+        errno = (NULL == worker) ? EINVAL : ENOSYS;
+        return -1;
+    }
+
+    lwt_netpoll_t* netpoll = &worker->scheduler->netpoll;
+    lwt_pollfd_t* pd = lwt_netpoll_fd(netpoll, source->fd);
+    if (NULL == pd) {
+        if (errno != EPERM) {
+            return -1;
+        }
+        /* Regular files cannot be polled because they are always ready */
+        lwt_select_claim(entry->selector, entry->index);
+        return 0;
+    }
+
+    entry->mode = (LWT_SELECT_READ == source->type) ? LWT_POLL_READ : LWT_POLL_WRITE;
+    lwt_spin_lock(&pd->lock);
+    lwt_select_attach(entry, &pd->lock, &pd->selectors);
+    lwt_spin_unlock(&pd->lock);
+    atomic_fetch_add_explicit(&netpoll->waiters, 1, memory_order_relaxed);
+
+    /* Edges from now on fire the entry; this catches readiness from before */
+    struct pollfd pfd;
+    pfd.fd = source->fd;
+    pfd.events = (LWT_POLL_READ == entry->mode) ? POLLIN : POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) > 0) {
+        lwt_select_claim(entry->selector, entry->index);
+    }
+    return 0;
+}
+
+static int lwt_select_register(lwt_select_entry_t* entry, const lwt_select_source_t* source,
+                               struct lwt_worker* worker) {
+    switch (source->type) {
+    case LWT_SELECT_THREAD: {
+        lwt_thread_t* thread = source->thread;
+        if (NULL == thread) {
+            break;
+        }
+        lwt_spin_lock(&thread->lock);
+        if (LWT_STATE_FINISHED == thread->state || LWT_STATE_FREE == thread->state) {
+            lwt_select_claim(entry->selector, entry->index);
+        } else {
+            /* Held until unregistered, as we take its lock again then */
+            lwt_select_attach(entry, &thread->lock, &thread->selectors);
+            thread->holds++;
+        }
+        lwt_spin_unlock(&thread->lock);
+        return 0;
+    }
+    case LWT_SELECT_READ:
+    case LWT_SELECT_WRITE:
+        return lwt_select_register_fd(entry, source, worker);
+    case LWT_SELECT_EVENT: {
+        lwt_event_t* event = source->event;
+        if (NULL == event) {
+            break;
+        }
+        lwt_spin_lock(&event->lock);
+        if (event->set) {
+            lwt_select_claim(entry->selector, entry->index);
+        } else {
+            lwt_select_attach(entry, &event->lock, &event->selectors);
+        }
+        lwt_spin_unlock(&event->lock);
+        return 0;
+    }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/* Take an entry off its source; afterwards no source can touch the selector through it */
+static void lwt_select_unregister(lwt_select_entry_t* entry, const lwt_select_source_t* source,
+                                  struct lwt_worker* worker) {
+    if (NULL == entry->source_lock) {
+        return;
+    }
+    lwt_spin_lock(entry->source_lock);
+    lwt_select_unlink(entry->source, entry);
+    lwt_spin_unlock(entry->source_lock);
+
+    if (LWT_SELECT_THREAD == source->type) {
+        lwt_thread_drop_hold(source->thread);
+    } else if (LWT_SELECT_READ == source->type || LWT_SELECT_WRITE == source->type) {
+        atomic_fetch_sub_explicit(&worker->scheduler->netpoll.waiters, 1, memory_order_relaxed);
+    }
+}
+
+/* Park function for lwt_select: arm the timeout, then see who readies the thread */
+static void lwt_select_commit(void* arg) {
+    lwt_selector_t* sel = (lwt_selector_t*)arg;
+    struct lwt_thread* thread = sel->thread;
+
+    if (sel->deadline != LWT_DEADLINE_NONE &&
+        -1 == atomic_load_explicit(&sel->fired, memory_order_acquire)) {
+        struct lwt_worker* worker = lwt_scheduler_current_worker();
+        lwt_spin_lock(&worker->timers.lock);
+        thread->wake_time = sel->deadline;
+        lwt_timer_add(&worker->timers, thread);
+        lwt_spin_unlock(&worker->timers.lock);
+    }
+
+    if (atomic_fetch_sub_explicit(&sel->pending, 1, memory_order_acq_rel) == 1) {
+        lwt_scheduler_add_thread(thread->scheduler, thread);
+    }
+}
+
+/* Wait in a lightweight thread; returns once a source has fired */
+static void lwt_select_park(lwt_selector_t* sel, lwt_select_entry_t* timeout) {
+    struct lwt_thread* self = sel->thread;
+    if (sel->deadline != LWT_DEADLINE_NONE) {
+        self->select_timeout = timeout;
+    }
+    self->state = LWT_STATE_BLOCKED;
+    lwt_scheduler_park(lwt_select_commit, sel);
+
+    if (sel->deadline != LWT_DEADLINE_NONE) {
+        /* Once we hold the wheel lock the timer can no longer be firing */
+        lwt_timer_wheel_t* wheel = self->timer_wheel;
+        if (wheel) {
+            lwt_spin_lock(&wheel->lock);
+            lwt_timer_remove(wheel, self);
+            lwt_spin_unlock(&wheel->lock);
+        }
+        self->select_timeout = NULL;
+    }
+}
+
+/* Wait in an OS thread; returns once a source has fired or the deadline passed */
+static void lwt_select_sleep(lwt_selector_t* sel, int timeout_index) {
+    for (;;) {
+        lwt_spin_lock(&sel->lock);
+        int done = sel->done;
+        lwt_spin_unlock(&sel->lock);
+        if (done) {
+            return;
+        }
+        if (sel->deadline != LWT_DEADLINE_NONE && lwt_timer_now() >= sel->deadline &&
+            lwt_select_claim(sel, timeout_index)) {
+            return;
+        }
+        /* If a source won in between, its unpark is on the way */
+        lwt_parker_park(sel->parker, sel->deadline);
+    }
+}
+
+int lwt_select(const lwt_select_source_t* sources, int count, int timeout_ms) {
+    lwt_deadline_t deadline = LWT_DEADLINE_NONE;
+    if (timeout_ms >= 0) {
+        deadline = lwt_timer_now() + (uint64_t)timeout_ms * 1000000ull;
+    }
+    return lwt_select_until(sources, count, deadline);
+}
+
+int lwt_select_until(const lwt_select_source_t* sources, int count, lwt_deadline_t deadline) {
+    if (count < 0 || (count > 0 && NULL == sources) ||
+        (0 == count && LWT_DEADLINE_NONE == deadline)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct lwt_thread* self = lwt_thread_self();
+    struct lwt_worker* worker = self ? lwt_scheduler_current_worker() : NULL;
+    if (NULL == worker) {
+        self = NULL;
+    }
+
+    /*
+     * Sources write to the selector and entries while we are parked. A
+     * shared-stack thread's frames may be copied away by then, so it keeps
+     * them on the heap, as does a select over many sources.
+     */
+    lwt_selector_t stack_sel;
+    lwt_select_entry_t stack_entries[LWT_SELECT_STACK_ENTRIES + 1];
+    lwt_selector_t* sel = &stack_sel;
+    lwt_select_entry_t* entries = stack_entries;
+    void* heap = NULL;
+    if (count > LWT_SELECT_STACK_ENTRIES || (self && self->home)) {
+        heap = malloc(sizeof(lwt_selector_t) + ((size_t)count + 1) * sizeof(lwt_select_entry_t));
+        if (NULL == heap) {
+            return -1;
+        }
+        sel = heap;
+        entries = (lwt_select_entry_t*)(sel + 1);
+    }
+
+    atomic_init(&sel->fired, -1);
+    atomic_init(&sel->pending, 2);
+    sel->thread = self;
+    sel->parker = NULL;
+    lwt_spin_init(&sel->lock);
+    sel->done = 0;
+    sel->deadline = deadline;
+
+    /* The timeout is the entry after the sources */
+    lwt_select_entry_t* timeout = &entries[count];
+    memset(timeout, 0, sizeof(lwt_select_entry_t));
+    timeout->selector = sel;
+    timeout->index = count;
+
+    lwt_parker_t parker;
+    if (NULL == self) {
+        if (lwt_parker_init(&parker) != 0) {
+            free(heap);
+            errno = ENOMEM;
+            return -1;
+        }
+        sel->parker = &parker;
+    }
+
+    /* Register everywhere, stopping early once something has fired */
+    int registered = 0;
+    int rc = 0;
+    for (int i = 0; i < count && -1 == atomic_load_explicit(&sel->fired, memory_order_acquire); i++) {
+        memset(&entries[i], 0, sizeof(lwt_select_entry_t));
+        entries[i].selector = sel;
+        entries[i].index = i;
+        entries[i].mode = -1;
+        registered = i + 1;
+        if (lwt_select_register(&entries[i], &sources[i], worker) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+
+    if (0 == rc) {
+        if (deadline != LWT_DEADLINE_NONE && lwt_timer_now() >= deadline) {
+            lwt_select_claim(sel, count);
+        }
+        /*
+         * Nothing to wait for if a source has already fired: either we
+         * claimed it ourselves, or its winner will find pending still at 2
+         * and leave the thread alone.
+         */
+        if (-1 == atomic_load_explicit(&sel->fired, memory_order_acquire)) {
+            if (self) {
+                lwt_select_park(sel, timeout);
+            } else {
+                lwt_select_sleep(sel, count);
+            }
+        }
+    }
+
+    /* A winner still firing holds its source's lock, so this also waits for it */
+    int saved_errno = errno;
+    for (int i = 0; i < registered; i++) {
+        lwt_select_unregister(&entries[i], &sources[i], worker);
+    }
+    if (NULL == self) {
+        lwt_parker_destroy(&parker);
+    }
+    int fired = atomic_load_explicit(&sel->fired, memory_order_acquire);
+    free(heap);
+    if (rc != 0) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (fired == count) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return fired;
+}
+
+lwt_event_t* lwt_event_create(void) {
+    lwt_event_t* event = calloc(1, sizeof(lwt_event_t));
+    if (NULL == event) {
+        return NULL;
+    }
+    lwt_spin_init(&event->lock);
+    return event;
+}
+
+void lwt_event_destroy(lwt_event_t* event) {
+    free(event);
+}
+
+void lwt_event_set(lwt_event_t* event) {
+    struct lwt_thread* ready = NULL;
+    lwt_spin_lock(&event->lock);
+    if (!event->set) {
+        event->set = 1;
+        lwt_select_fire_list(&event->selectors, -1, &ready);
+    }
+    lwt_spin_unlock(&event->lock);
+    lwt_select_ready(ready);
+}
+
+void lwt_event_reset(lwt_event_t* event) {
+    lwt_spin_lock(&event->lock);
+    event->set = 0;
+    lwt_spin_unlock(&event->lock);
+}
+
+int lwt_event_wait(lwt_event_t* event) {
+    lwt_select_source_t source;
+    memset(&source, 0, sizeof(source));
+    source.type = LWT_SELECT_EVENT;
+    source.event = event;
+    return lwt_select(&source, 1, -1) < 0 ? -1 : 0;
+}
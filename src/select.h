@@ -0,0 +1,111 @@
+/**
+ * @file select.h
+ * @brief Internal multi-source wait used by lwt_select and events
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_SELECT_INTERNAL_H
+#define LWTHREAD_SELECT_INTERNAL_H
+
+#include "lwthread/lwthread.h"
+#include "parker.h"
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+struct lwt_thread;
+
+/**
+ * One lwt_select call, on the selecting thread's stack or the heap
+ *
+ * Sources race to set fired with a CAS, so exactly one of them wins. A
+ * lightweight thread may still be switching out when the winner fires, so
+ * pending starts at 2: the winner and the park function each take one,
+ * and whichever comes second makes the thread runnable. An OS thread
+ * sleeps on its parker instead and waits for done, which the winner sets
+ * under lock.
+ */
+typedef struct lwt_selector {
+    atomic_int fired;                   /* Index of the winning source, -1 while waiting */
+    atomic_int pending;                 /* Parties left before the thread may run */
+    struct lwt_thread* thread;          /* Selecting lightweight thread, or NULL */
+    lwt_parker_t* parker;               /* Selecting OS thread when thread is NULL */
+    lwt_spinlock_t lock;                /* Protects done */
+    int done;                           /* Winner has finished with an OS thread's selector */
+    lwt_deadline_t deadline;            /* Monotonic timeout in ns, or LWT_DEADLINE_NONE */
+} lwt_selector_t;
+
+/**
+ * Registration of a selector with one source
+ *
+ * Linked into the source's list under the source's lock. Whoever unlinks
+ * an entry does so under that lock, and the selector unlinks every entry
+ * before returning, so a source never sees a stale entry.
+ */
+typedef struct lwt_select_entry {
+    lwt_selector_t* selector;           /* Selector to fire */
+    int index;                          /* Source index reported by lwt_select */
+    int mode;                           /* lwt_poll_mode_t for descriptor sources */
+    int linked;                         /* On a source's list */
+    lwt_spinlock_t* source_lock;        /* Lock of the source registered with, or NULL */
+    struct lwt_select_entry** source;   /* That source's list */
+    struct lwt_select_entry* prev;
+    struct lwt_select_entry* next;
+} lwt_select_entry_t;
+
+/**
+ * Event structure
+ */
+struct lwt_event {
+    lwt_spinlock_t lock;                /* Protects the fields below */
+    int set;                            /* Signalled and not yet reset */
+    lwt_select_entry_t* selectors;      /* Waiting selectors */
+};
+
+/**
+ * Add an entry to a source's list (source lock held)
+ *
+ * @param head Source's list
+ * @param entry Entry to add
+ */
+void lwt_select_link(lwt_select_entry_t** head, lwt_select_entry_t* entry);
+
+/**
+ * Remove an entry from a source's list if it is still there (source lock held)
+ *
+ * @param head Source's list
+ * @param entry Entry to remove
+ */
+void lwt_select_unlink(lwt_select_entry_t** head, lwt_select_entry_t* entry);
+
+/**
+ * Fire an entry (source lock held)
+ *
+ * @param entry Entry whose source has become ready
+ * @return Thread to make runnable once the source lock is dropped, or NULL
+ */
+struct lwt_thread* lwt_select_fire(lwt_select_entry_t* entry);
+
+/**
+ * Unlink and fire the entries of a list (source lock held)
+ *
+ * @param head Source's list
+ * @param mode Only fire descriptor entries waiting for this mode, or -1 for all
+ * @param ready Threads to pass to lwt_select_ready(), linked through next
+ */
+void lwt_select_fire_list(lwt_select_entry_t** head, int mode, struct lwt_thread** ready);
+
+/**
+ * Make the threads returned by lwt_select_fire_list runnable
+ *
+ * @param threads Threads linked through next
+ * @return Number of threads made runnable
+ */
+int lwt_select_ready(struct lwt_thread* threads);
+
+#endif /* LWTHREAD_SELECT_INTERNAL_H */
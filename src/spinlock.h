@@ -0,0 +1,74 @@
+/**
+ * @file spinlock.h
+ * @brief Internal spinlock used for short runtime critical sections
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_SPINLOCK_INTERNAL_H
+#define LWTHREAD_SPINLOCK_INTERNAL_H
+
+#include <sched.h>
+#include <stdatomic.h>
+
+/**
+ * Hint to the CPU that we are in a spin-wait loop
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define LWT_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define LWT_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define LWT_CPU_RELAX() ((void)0)
+#endif
+
+/**
+ * Number of relax iterations before a spinner gives up its CPU
+ */
+#define LWT_SPIN_LIMIT 128
+
+/**
+ * Spinlock structure
+ *
+ * Only used around a handful of loads and stores. A thread may hold one
+ * into lwt_scheduler_park() only if the park function releases it, which
+ * happens as soon as the thread is off its stack; it must not be held
+ * across any other switch. Unlike a pthread mutex, unlock is a single
+ * store, so the memory holding the lock is not touched again once another
+ * thread acquires it.
+ */
+typedef struct lwt_spinlock {
+    atomic_int locked;          /* 1 while held */
+} lwt_spinlock_t;
+
+static inline void lwt_spin_init(lwt_spinlock_t* lock) {
+    atomic_init(&lock->locked, 0);
+}
+
+static inline int lwt_spin_trylock(lwt_spinlock_t* lock) {
+    return !atomic_exchange_explicit(&lock->locked, 1, memory_order_acquire);
+}
+
+static inline void lwt_spin_lock(lwt_spinlock_t* lock) {
+    while (atomic_exchange_explicit(&lock->locked, 1, memory_order_acquire)) {
+        int spins = 0;
+        while (atomic_load_explicit(&lock->locked, memory_order_relaxed)) {
+            if (++spins < LWT_SPIN_LIMIT) {
+                LWT_CPU_RELAX();
+            } else {
+                spins = 0;
+                sched_yield();
+            }
+        }
+    }
+}
+
+static inline void lwt_spin_unlock(lwt_spinlock_t* lock) {
+    atomic_store_explicit(&lock->locked, 0, memory_order_release);
+}
+
+#endif /* LWTHREAD_SPINLOCK_INTERNAL_H */
@@ -0,0 +1,202 @@
+/**
+ * @file stack.c
+ * @brief Stack allocator implementation
+ */
+
+#include "stack.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Reserve address space only; pages are committed when first touched */
+#define LWT_STACK_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE)
+
+/*
+ * Free-list link, stored in the topmost bytes of a free stack. The top
+ * page is never trimmed, so the link survives MADV_DONTNEED.
+ */
+struct lwt_stack_node {
+    struct lwt_stack_node* next;
+};
+
+static size_t lwt_stack_page_size(void) {
+    static size_t page_size = 0;
+    if (0 == page_size) {
+        long size = sysconf(_SC_PAGESIZE);
+        page_size = size > 0 ? (size_t)size : 4096;
+    }
+    return page_size;
+}
+
+/* Size cls for a usable size, or -1 if too large to pool */
+static int lwt_stack_class(size_t size) {
+    size_t class_size = LWT_STACK_MIN_SIZE;
+    for (int i = 0; i < LWT_STACK_NUM_CLASSES; i++) {
+        if (size <= class_size) {
+            return i;
+        }
+        class_size <<= 1;
+    }
+    return -1;
+}
+
+static struct lwt_stack_node* lwt_stack_node(void* stack, size_t size) {
+    return (struct lwt_stack_node*)((char*)stack + size) - 1;
+}
+
+static void* lwt_stack_map(size_t size) {
+    size_t guard = lwt_stack_page_size();
+    char* base = mmap(NULL, size + guard, PROT_READ | PROT_WRITE, LWT_STACK_MAP_FLAGS, -1, 0);
+    if (MAP_FAILED == base) {
+        return NULL;
+    }
+    /* Stacks grow down: an overflow faults on the guard instead of corrupting memory */
+    if (mprotect(base, guard, PROT_NONE) != 0) {
+        munmap(base, size + guard);
+        return NULL;
+    }
+    return base + guard;
+}
+
+static void lwt_stack_unmap(void* stack, size_t size) {
+    size_t guard = lwt_stack_page_size();
+    munmap((char*)stack - guard, size + guard);
+}
+
+void lwt_stack_cache_init(lwt_stack_cache_t* cache) {
+    memset(cache, 0, sizeof(lwt_stack_cache_t));
+}
+
+void lwt_stack_cache_destroy(lwt_stack_cache_t* cache) {
+    size_t size = LWT_STACK_MIN_SIZE;
+    for (int i = 0; i < LWT_STACK_NUM_CLASSES; i++) {
+        struct lwt_stack_node* node = cache->free[i];
+        while (node) {
+            struct lwt_stack_node* next = node->next;
+            lwt_stack_unmap((char*)(node + 1) - size, size);
+            node = next;
+        }
+        cache->free[i] = NULL;
+        cache->count[i] = 0;
+        size <<= 1;
+    }
+}
+
+void* lwt_stack_alloc(lwt_stack_cache_t* cache, size_t* size) {
+    size_t page = lwt_stack_page_size();
+    int cls = lwt_stack_class(*size);
+    if (cls < 0) {
+        /* Too large to pool: map it directly */
+        *size = (*size + page - 1) & ~(page - 1);
+        return lwt_stack_map(*size);
+    }
+
+    *size = (size_t)LWT_STACK_MIN_SIZE << cls;
+    struct lwt_stack_node* node = cache->free[cls];
+    if (node) {
+        cache->free[cls] = node->next;
+        cache->count[cls]--;
+        return (char*)(node + 1) - *size;
+    }
+    return lwt_stack_map(*size);
+}
+
+int lwt_stack_alloc_many(lwt_stack_cache_t* cache, size_t* size, void** stacks, int n) {
+    size_t page = lwt_stack_page_size();
+    int cls = lwt_stack_class(*size);
+    *size = (cls < 0) ? (*size + page - 1) & ~(page - 1) : (size_t)LWT_STACK_MIN_SIZE << cls;
+
+    int i = 0;
+    while (i < n && cls >= 0 && cache->free[cls]) {
+        struct lwt_stack_node* node = cache->free[cls];
+        cache->free[cls] = node->next;
+        cache->count[cls]--;
+        stacks[i++] = (char*)(node + 1) - *size;
+    }
+    if (i == n) {
+        return 0;
+    }
+
+    /* One mapping for the rest; unmapping a stack later only splits it */
+    size_t span = *size + page;
+    char* base = mmap(NULL, span * (size_t)(n - i), PROT_READ | PROT_WRITE,
+                      LWT_STACK_MAP_FLAGS, -1, 0);
+    if (MAP_FAILED == base) {
+        goto fail;
+    }
+    for (char* start = base; i < n; i++, start += span) {
+        if (mprotect(start, page, PROT_NONE) != 0) {
+            munmap(start, span * (size_t)(n - i));
+            goto fail;
+        }
+        stacks[i] = start + page;
+    }
+    return 0;
+
+fail:
+    while (i > 0) {
+        lwt_stack_free(cache, stacks[--i], *size);
+    }
+    return -1;
+}
+
+void lwt_stack_free(lwt_stack_cache_t* cache, void* stack, size_t size) {
+    if (NULL == stack) {
+        return;
+    }
+
+    int cls = lwt_stack_class(size);
+    if (cls < 0 || cache->count[cls] >= LWT_STACK_CACHE_LIMIT) {
+        lwt_stack_unmap(stack, size);
+        return;
+    }
+
+    if (cache->count[cls] >= LWT_STACK_CACHE_WATERMARK) {
+        /* Keep the mapping but give back everything below the top page */
+        size_t page = lwt_stack_page_size();
+        madvise(stack, size - page, MADV_DONTNEED);
+    } else if (size > LWT_STACK_KEEP_SIZE) {
+        /* A deep call chain must not pin memory for the next thread */
+        madvise(stack, size - LWT_STACK_KEEP_SIZE, MADV_DONTNEED);
+    }
+
+    struct lwt_stack_node* node = lwt_stack_node(stack, size);
+    node->next = cache->free[cls];
+    cache->free[cls] = node;
+    cache->count[cls]++;
+}
+
+size_t lwt_stack_committed(void* stack, size_t size) {
+    size_t page = lwt_stack_page_size();
+    unsigned char vec[256];
+    size_t committed = 0;
+    for (size_t offset = 0; offset < size; offset += sizeof(vec) * page) {
+        size_t len = size - offset;
+        if (len > sizeof(vec) * page) {
+            len = sizeof(vec) * page;
+        }
+        if (mincore((char*)stack + offset, len, vec) != 0) {
+            break;
+        }
+        for (size_t i = 0; i < len / page; i++) {
+            committed += (vec[i] & 1) * page;
+        }
+    }
+    return committed;
+}
+
+int lwt_stack_cache_full(const lwt_stack_cache_t* cache, size_t size) {
+    int cls = lwt_stack_class(size);
+    return cls < 0 || cache->count[cls] >= LWT_STACK_CACHE_WATERMARK;
+}
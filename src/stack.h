@@ -0,0 +1,122 @@
+/**
+ * @file stack.h
+ * @brief Internal stack allocator with guard pages and per-worker reuse
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_STACK_INTERNAL_H
+#define LWTHREAD_STACK_INTERNAL_H
+
+#include <stddef.h>
+
+/**
+ * Smallest stack size class
+ */
+#define LWT_STACK_MIN_SIZE (16 * 1024)
+
+/**
+ * Number of power-of-two size classes (16KB up to 1MB)
+ */
+#define LWT_STACK_NUM_CLASSES 7
+
+/**
+ * Bytes at the top of a cached stack that stay committed; anything a
+ * thread touched below this is given back when its stack is freed
+ */
+#define LWT_STACK_KEEP_SIZE (64 * 1024)
+
+/**
+ * Cached stacks per class kept committed; further cached stacks
+ * have their pages returned to the kernel with MADV_DONTNEED
+ */
+#define LWT_STACK_CACHE_WATERMARK 16
+
+/**
+ * Maximum cached stacks per class; beyond this stacks are unmapped
+ */
+#define LWT_STACK_CACHE_LIMIT 256
+
+/**
+ * Cache of free stacks, one free-list per size class
+ *
+ * Not thread-safe: each worker owns one, and the scheduler guards the
+ * shared one used by non-worker threads with a mutex.
+ */
+typedef struct lwt_stack_cache {
+    struct lwt_stack_node* free[LWT_STACK_NUM_CLASSES];    /* Free-lists by class */
+    int count[LWT_STACK_NUM_CLASSES];                       /* Length of each list */
+} lwt_stack_cache_t;
+
+/**
+ * Initialize a stack cache
+ * 
+ * @param cache Cache to initialize
+ */
+void lwt_stack_cache_init(lwt_stack_cache_t* cache);
+
+/**
+ * Unmap every stack held by a cache
+ * 
+ * @param cache Cache to destroy
+ */
+void lwt_stack_cache_destroy(lwt_stack_cache_t* cache);
+
+/**
+ * Allocate a stack with a PROT_NONE guard page below it
+ * 
+ * Stacks are mapped with MAP_NORESERVE, so a large one costs address
+ * space only: memory is committed page by page as the thread touches it.
+ * 
+ * @param cache Cache to reuse a stack from
+ * @param size In: requested size; out: usable size (rounded up to its class)
+ * @return Lowest usable address of the stack, or NULL on failure
+ */
+void* lwt_stack_alloc(lwt_stack_cache_t* cache, size_t* size);
+
+/**
+ * Allocate several stacks of one size
+ * 
+ * Reuses cached stacks first and maps the rest as one region, carved into
+ * stacks that each keep their own guard page and can be freed one by one.
+ * 
+ * @param cache Cache to reuse stacks from
+ * @param size In: requested size; out: usable size (rounded up to its class)
+ * @param stacks Receives the n stacks
+ * @param n Number of stacks
+ * @return 0 on success, -1 on failure (no stack allocated)
+ */
+int lwt_stack_alloc_many(lwt_stack_cache_t* cache, size_t* size, void** stacks, int n);
+
+/**
+ * Return a stack to a cache, trimming or unmapping it past the watermarks
+ * 
+ * @param cache Cache to return the stack to
+ * @param stack Stack returned by lwt_stack_alloc
+ * @param size Usable size returned by lwt_stack_alloc
+ */
+void lwt_stack_free(lwt_stack_cache_t* cache, void* stack, size_t size);
+
+/**
+ * Count the bytes of a stack backed by memory
+ * 
+ * @param stack Stack returned by lwt_stack_alloc
+ * @param size Usable size returned by lwt_stack_alloc
+ * @return Resident bytes, not counting the guard page
+ */
+size_t lwt_stack_committed(void* stack, size_t size);
+
+/**
+ * Check whether a cache already holds its watermark of stacks of a size
+ * 
+ * @param cache Cache to check
+ * @param size Usable size returned by lwt_stack_alloc
+ * @return 1 if full (or the size is not pooled), 0 otherwise
+ */
+int lwt_stack_cache_full(const lwt_stack_cache_t* cache, size_t size);
+
+#endif /* LWTHREAD_STACK_INTERNAL_H */
@@ -5,36 +5,167 @@
 
 #include "thread.h"
 #include "scheduler.h"
+#include "select.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
-/* Default stack size: 64KB */
-#define LWT_DEFAULT_STACK_SIZE (64 * 1024)
-
 /* Thread-local storage for current thread */
 static __thread struct lwt_thread* current_thread = NULL;
 
+/*
+ * Park function run on the worker once a thread's function has returned.
+ * Only now is it safe to report the thread finished: a joiner may free it
+ * as soon as it sees the new state.
+ */
+static void lwt_thread_finish(void* arg) {
+    struct lwt_thread* thread = (struct lwt_thread*)arg;
+    struct lwt_scheduler* scheduler = thread->scheduler;
+
+    lwt_scheduler_deadline_done(thread);
+
+    /* Frames left on the shared stack are dead, so nothing needs saving */
+    struct lwt_worker* home = thread->home;
+    if (home && home->shared_owner == thread) {
+        home->shared_owner = NULL;
+    }
+
+    lwt_spin_lock(&thread->lock);
+    void* stack = thread->stack;
+    size_t stack_size = thread->stack_size;
+    void* stack_copy = thread->stack_copy;
+    thread->stack = NULL;
+    thread->stack_copy = NULL;
+    struct lwt_thread* waiting = thread->waiting;
+    int external = thread->external_joiners;
+    int reclaim = thread->detached && 0 == thread->holds;
+    thread->waiting = NULL;
+    thread->state = LWT_STATE_FINISHED;
+    struct lwt_thread* selectors = NULL;
+    lwt_select_fire_list(&thread->selectors, -1, &selectors);
+    lwt_spin_unlock(&thread->lock);
+
+    /* We are on the worker's own stack now, so the thread's can be reused */
+    if (home) {
+        free(stack_copy);
+    } else {
+        lwt_scheduler_free_stack(scheduler, stack, stack_size);
+    }
+
+    /* Unless detached, the thread must not be touched past this point */
+    if (reclaim) {
+        lwt_scheduler_free_thread(scheduler, thread);
+    }
+    while (waiting) {
+        struct lwt_thread* next = waiting->next;
+        waiting->next = NULL;
+        lwt_scheduler_add_thread(scheduler, waiting);
+        waiting = next;
+    }
+    lwt_select_ready(selectors);
+    if (external) {
+        pthread_mutex_lock(&scheduler->mutex);
+        pthread_cond_broadcast(&scheduler->join_cond);
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+}
+
 static void lwt_thread_start(void) {
     struct lwt_thread* thread = current_thread;
     if (NULL == thread) {
         return;
     }
+    lwt_scheduler_switched();
+
     /* Execute the thread function */
     thread->func(thread->arg);
-    pthread_mutex_lock(&thread->scheduler->mutex);
-    thread->state = LWT_STATE_FINISHED;
+    lwt_scheduler_park(lwt_thread_finish, thread);
+}
+
+int lwt_thread_setup(struct lwt_thread* thread, lwt_func_t func, void* arg,
+                     struct lwt_scheduler* scheduler, void* stack, size_t stack_size) {
+    /* The generation survives reuse so that stale handles stay stale */
+    unsigned long generation = atomic_load(&thread->generation);
+    memset(thread, 0, sizeof(struct lwt_thread));
+    atomic_init(&thread->generation, generation);
+    thread->func = func;
+    thread->arg = arg;
+    thread->scheduler = scheduler;
+    thread->state = LWT_STATE_NEW;
+    thread->timer_index = -1;
+    thread->priority = LWT_PRIO_NORMAL;
+    thread->deadline = LWT_DEADLINE_NONE;
+    lwt_spin_init(&thread->lock);
 
-    if (thread->waiting) {
-        thread->waiting->state = LWT_STATE_READY;
-        lwt_queue_push_locked(&thread->scheduler->ready_queue, thread->waiting);
-        thread->waiting = NULL;
-        pthread_cond_signal(&thread->scheduler->cond);
+    if (lwt_context_make(&thread->context, stack, stack_size, lwt_thread_start) != 0) {
+        return -1;
     }
-    pthread_mutex_unlock(&thread->scheduler->mutex);
-    lwt_yield();
+    thread->stack = stack;
+    thread->stack_size = stack_size;
+    return 0;
 }
 
+int lwt_thread_setup_shared(struct lwt_thread* thread, lwt_func_t func, void* arg,
+                            struct lwt_scheduler* scheduler, struct lwt_worker* home) {
+#ifdef LWT_CONTEXT_STACK_COPY
+    /* Build the first frame in scratch space, then keep just the frame */
+    char* scratch = aligned_alloc(16, LWT_THREAD_FRAME_SCRATCH);
+    if (NULL == scratch) {
+        return -1;
+    }
+    if (lwt_thread_setup(thread, func, arg, scheduler, scratch, LWT_THREAD_FRAME_SCRATCH) != 0) {
+        free(scratch);
+        return -1;
+    }
+    size_t size = (size_t)(scratch + LWT_THREAD_FRAME_SCRATCH - (char*)thread->context.sp);
+    memmove(scratch, thread->context.sp, size);
+
+    thread->home = home;
+    thread->stack = home->shared_stack;
+    thread->stack_size = scheduler->shared_stack_size;
+    thread->stack_copy = scratch;
+    thread->stack_copy_size = size;
+    atomic_store_explicit(&thread->stack_copy_capacity, LWT_THREAD_FRAME_SCRATCH,
+                          memory_order_relaxed);
+    return 0;
+#else
+    (void)thread;
+    (void)func;
+    (void)arg;
+    (void)scheduler;
+    (void)home;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+#ifdef LWT_CONTEXT_STACK_COPY
+int lwt_thread_save_stack(struct lwt_thread* thread, char* top) {
+    size_t size = (size_t)(top - (char*)thread->context.sp);
+    size_t capacity = atomic_load_explicit(&thread->stack_copy_capacity, memory_order_relaxed);
+
+    /* Keep the copy close to the live depth, growing it or halving it as needed */
+    if (size > capacity || size < capacity / 2) {
+        void* copy = realloc(thread->stack_copy, size);
+        if (copy) {
+            thread->stack_copy = copy;
+            atomic_store_explicit(&thread->stack_copy_capacity, size, memory_order_relaxed);
+        } else if (size > capacity) {
+            return -1;
+        }
+    }
+    memcpy(thread->stack_copy, thread->context.sp, size);
+    thread->stack_copy_size = size;
+    return 0;
+}
+
+void lwt_thread_load_stack(struct lwt_thread* thread, char* top) {
+    char* sp = top - thread->stack_copy_size;
+    memcpy(sp, thread->stack_copy, thread->stack_copy_size);
+    thread->context.sp = sp;
+}
+#endif
+
 int lwt_thread_init(struct lwt_thread* thread, lwt_func_t func, void* arg,
                     struct lwt_scheduler* scheduler, size_t stack_size) {
     if (NULL == thread || NULL == func || NULL == scheduler) {
@@ -46,54 +177,64 @@ int lwt_thread_init(struct lwt_thread* thread, lwt_func_t func, void* arg,
         stack_size = LWT_DEFAULT_STACK_SIZE;
     }
 
-    memset(thread, 0, sizeof(struct lwt_thread));
-    thread->func = func;
-    thread->arg = arg;
-    thread->scheduler = scheduler;
-    thread->state = LWT_STATE_NEW;
-    thread->stack_size = stack_size;
-    thread->stack = malloc(stack_size);
-    if (NULL == thread->stack) {
+    void* stack = lwt_scheduler_alloc_stack(scheduler, &stack_size);
+    if (NULL == stack) {
         return -1;
     }
-
-    if (getcontext(&thread->context) == -1) {
-        free(thread->stack);
-        thread->stack = NULL;
+    if (lwt_thread_setup(thread, func, arg, scheduler, stack, stack_size) != 0) {
+        lwt_scheduler_free_stack(scheduler, stack, stack_size);
         return -1;
     }
-
-    /*
-     * Configure thread execution context and stack
-     * 
-     * - Assigns the pre-allocated stack memory to this thread's context
-     * - Sets the stack size to the specified allocation size
-     * - Sets uc_link to NULL as we're implementing custom context switching
-     *   rather than using the default chain-of-execution mechanism
-     * 
-     * This setup is required before calling makecontext() to initialize
-     * the thread with its entry function.
-     */
-    thread->context.uc_stack.ss_sp = thread->stack;
-    thread->context.uc_stack.ss_size = stack_size;
-    thread->context.uc_link = NULL;
-
-    makecontext(&thread->context, lwt_thread_start, 0);
-    pthread_mutex_lock(&scheduler->mutex);
-    thread->id = scheduler->next_thread_id++;
-    pthread_mutex_unlock(&scheduler->mutex);
+    thread->id = lwt_scheduler_alloc_ids(scheduler, 1);
     return 0;
 }
 
+void lwt_thread_drop_hold(struct lwt_thread* thread) {
+    lwt_spin_lock(&thread->lock);
+    int reclaim = (0 == --thread->holds && thread->detached &&
+                   LWT_STATE_FINISHED == thread->state);
+    lwt_spin_unlock(&thread->lock);
+
+    if (reclaim) {
+        lwt_scheduler_free_thread(thread->scheduler, thread);
+    }
+}
+
 void lwt_thread_cleanup(struct lwt_thread* thread) {
     if (NULL == thread) {
         return;
     }
     
-    if (thread->stack) {
-        free(thread->stack);
-        thread->stack = NULL;
+    if (thread->home) {
+        free(thread->stack_copy);
+        thread->stack_copy = NULL;
+    } else if (thread->stack) {
+        lwt_scheduler_free_stack(thread->scheduler, thread->stack, thread->stack_size);
     }
+    thread->stack = NULL;
+}
+
+void lwt_thread_cache_init(lwt_thread_cache_t* cache) {
+    cache->free = NULL;
+    cache->count = 0;
+}
+
+struct lwt_thread* lwt_thread_cache_get(lwt_thread_cache_t* cache) {
+    struct lwt_thread* thread = cache->free;
+    if (thread) {
+        cache->free = thread->next;
+        cache->count--;
+        thread->next = NULL;
+    }
+    return thread;
+}
+
+void lwt_thread_cache_put(lwt_thread_cache_t* cache, struct lwt_thread* thread) {
+    thread->state = LWT_STATE_FREE;
+    atomic_fetch_add_explicit(&thread->generation, 1, memory_order_release);
+    thread->next = cache->free;
+    cache->free = thread;
+    cache->count++;
 }
 
 struct lwt_thread* lwt_thread_self(void) {
@@ -13,8 +13,11 @@
 #define LWTHREAD_THREAD_INTERNAL_H
 
 #include "lwthread/lwthread.h"
-#include <ucontext.h>
-
+#include "context.h"
+#include "inject.h"
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stdint.h>
 
 /**
  * Thread states
@@ -24,28 +27,110 @@ typedef enum {
     LWT_STATE_READY,    /* Thread is ready to run */
     LWT_STATE_RUNNING,  /* Thread is currently running */
     LWT_STATE_BLOCKED,  /* Thread is blocked (e.g., on join) */
-    LWT_STATE_FINISHED  /* Thread has completed execution */
+    LWT_STATE_FINISHED, /* Thread has completed execution */
+    LWT_STATE_FREE      /* Control block is in a free-list awaiting reuse */
 } lwt_state_t;
 
-/* Forward declaration */
+/* Forward declarations */
 struct lwt_scheduler;
+struct lwt_worker;
+struct lwt_timer_wheel;
+struct lwt_select_entry;
+
+/**
+ * Stack size of threads created without one: 64KB
+ */
+#define LWT_DEFAULT_STACK_SIZE (64 * 1024)
+
+/**
+ * Number of thread control blocks carved from one slab allocation
+ */
+#define LWT_THREAD_SLAB_SIZE 64
+
+/**
+ * Free control blocks a worker keeps before spilling to the shared cache
+ */
+#define LWT_THREAD_CACHE_WATERMARK 128
+
+/**
+ * Scratch space for building a shared-stack thread's first frame
+ */
+#define LWT_THREAD_FRAME_SCRATCH 256
 
 /**
  * Internal thread structure definition
  */
 struct lwt_thread {
-    ucontext_t context;                 /* Thread context (registers, stack, etc.) */
+    lwt_context_t context;              /* Saved execution context */
     void* stack;                        /* Thread stack */
     size_t stack_size;                  /* Size of the stack */
     lwt_state_t state;                  /* Current state */
     lwt_func_t func;                    /* Function to execute */
     void* arg;                          /* Argument to the function */
     struct lwt_thread* next;            /* For queue management */
-    struct lwt_thread* waiting;         /* Thread waiting on this one (for join) */
+    lwt_inject_link_t inject_link;      /* Link in the scheduler's injection queue */
+    struct lwt_thread* waiting;         /* Threads joining this one, linked through next */
     struct lwt_scheduler* scheduler;    /* Back-reference to scheduler */
-    int id;                             /* Unique thread ID */
+    lwt_spinlock_t lock;                /* Protects state, waiting and stack against finish */
+    int external_joiners;               /* Non-lwt threads blocked in lwt_join */
+    int holds;                          /* External joiners and lwt_select entries still to take lock */
+    int detached;                       /* Reclaim automatically when finished */
+    int preempt_off;                    /* lwt_preempt_disable() nesting depth */
+    int priority;                       /* LWT_PRIO_MIN to LWT_PRIO_MAX */
+    int prio_level;                     /* Level queued at in the priority queue, after aging */
+    uint64_t ready_time;                /* When queued at prio_level, in monotonic ns */
+    uint64_t deadline;                  /* Absolute monotonic deadline in ns, or LWT_DEADLINE_NONE */
+    struct lwt_thread* edf_child;       /* First child in a deadline heap */
+    struct lwt_thread* edf_sibling;     /* Next sibling in a deadline heap */
+    atomic_ulong generation;            /* Bumped each time the block is recycled */
+    uint64_t wake_time;                 /* Monotonic wake-up time in ns while sleeping */
+    struct lwt_timer_wheel* timer_wheel;    /* Wheel last slept in, for cancelling */
+    struct lwt_thread* timer_prev;      /* Neighbours in a timer wheel list */
+    struct lwt_thread* timer_next;
+    int timer_index;                    /* List in timer_wheel, -1 if not queued */
+    struct lwt_select_entry* select_timeout;    /* Fired instead of waking when the timer expires */
+    struct lwt_select_entry* selectors; /* lwt_select calls waiting for this thread to finish */
+    uint64_t id;                        /* Unique thread ID */
+    struct lwt_worker* home;            /* Worker whose shared stack we run on, or NULL */
+    void* stack_copy;                   /* Live part of the shared stack while moved off it */
+    size_t stack_copy_size;             /* Bytes in stack_copy */
+    atomic_size_t stack_copy_capacity;  /* Bytes allocated for stack_copy */
 };
 
+/**
+ * Free-list of recycled thread control blocks, linked through next
+ *
+ * Not thread-safe: each worker owns one, and the scheduler guards the
+ * shared one with a mutex.
+ */
+typedef struct lwt_thread_cache {
+    struct lwt_thread* free;            /* First free control block */
+    int count;                          /* Length of the free-list */
+} lwt_thread_cache_t;
+
+/**
+ * Initialize a control block cache
+ * 
+ * @param cache Cache to initialize
+ */
+void lwt_thread_cache_init(lwt_thread_cache_t* cache);
+
+/**
+ * Take a control block from a cache
+ * 
+ * @param cache Cache to take from
+ * @return Control block or NULL if the cache is empty
+ */
+struct lwt_thread* lwt_thread_cache_get(lwt_thread_cache_t* cache);
+
+/**
+ * Put a control block into a cache, invalidating handles to it
+ * 
+ * @param cache Cache to put into
+ * @param thread Control block to recycle
+ */
+void lwt_thread_cache_put(lwt_thread_cache_t* cache, struct lwt_thread* thread);
+
 /**
  * Initialize thread structure
  * 
@@ -59,6 +144,69 @@ struct lwt_thread {
 int lwt_thread_init(struct lwt_thread* thread, lwt_func_t func, void* arg, 
     struct lwt_scheduler* scheduler, size_t stack_size);
 
+/**
+ * Initialize thread structure on a stack allocated by the caller
+ * 
+ * Leaves the thread ID to the caller.
+ * 
+ * @param thread Thread to initialize
+ * @param func Function to execute
+ * @param arg Argument to the function
+ * @param scheduler Scheduler that will manage the thread
+ * @param stack Stack from lwt_scheduler_alloc_stack or lwt_scheduler_alloc_many
+ * @param stack_size Usable size of the stack
+ * @return 0 on success, -1 on failure (the stack stays the caller's)
+ */
+int lwt_thread_setup(struct lwt_thread* thread, lwt_func_t func, void* arg,
+                     struct lwt_scheduler* scheduler, void* stack, size_t stack_size);
+
+/**
+ * Initialize a thread that runs on a worker's shared stack
+ * 
+ * The thread starts out with its first frame in a heap copy, and only
+ * ever runs on home. Leaves the thread ID to the caller.
+ * 
+ * @param thread Thread to initialize
+ * @param func Function to execute
+ * @param arg Argument to the function
+ * @param scheduler Scheduler that will manage the thread
+ * @param home Worker whose shared stack the thread uses
+ * @return 0 on success, -1 on failure (errno set to ENOMEM, or ENOTSUP
+ *         with the ucontext fallback)
+ */
+int lwt_thread_setup_shared(struct lwt_thread* thread, lwt_func_t func, void* arg,
+                            struct lwt_scheduler* scheduler, struct lwt_worker* home);
+
+/**
+ * Move a switched-out thread's frames from its shared stack to its copy
+ * 
+ * Only available with LWT_CONTEXT_STACK_COPY, as is lwt_thread_load_stack.
+ * 
+ * @param thread Thread whose frames are on the shared stack
+ * @param top Top of the shared stack
+ * @return 0 on success, -1 if the copy could not be grown
+ */
+int lwt_thread_save_stack(struct lwt_thread* thread, char* top);
+
+/**
+ * Put a thread's saved frames back on its shared stack
+ * 
+ * @param thread Thread with its frames in its copy
+ * @param top Top of the shared stack
+ */
+void lwt_thread_load_stack(struct lwt_thread* thread, char* top);
+
+/**
+ * Drop a hold on a thread, taken under its lock
+ * 
+ * A released (detached or freed) thread that has finished is only
+ * recycled once nobody holds it, so external joiners and lwt_select
+ * entries can still take its lock. Whoever drops the last hold recycles it.
+ * 
+ * @param thread Thread to drop the hold on
+ */
+void lwt_thread_drop_hold(struct lwt_thread* thread);
+
 /**
  * Clean up thread resources
  * 
@@ -0,0 +1,211 @@
+/**
+ * @file timer.c
+ * @brief Timer wheel implementation
+ */
+
+#include "timer.h"
+#include "thread.h"
+#include <string.h>
+#include <time.h>
+
+/* Ticks spanned by one slot and by a whole level */
+#define LWT_TIMER_SLOT_TICKS(level) (1ull << ((level) * LWT_TIMER_LEVEL_BITS))
+#define LWT_TIMER_LEVEL_TICKS(level) (1ull << (((level) + 1) * LWT_TIMER_LEVEL_BITS))
+
+/* Ticks covered by the wheel */
+#define LWT_TIMER_RANGE LWT_TIMER_LEVEL_TICKS(LWT_TIMER_LEVELS - 1)
+
+/* Furthest a timer is filed ahead: the last slot of the top level */
+#define LWT_TIMER_HORIZON (LWT_TIMER_RANGE - LWT_TIMER_SLOT_TICKS(LWT_TIMER_LEVELS - 1))
+
+void lwt_timer_init(lwt_timer_wheel_t* wheel) {
+    lwt_spin_init(&wheel->lock);
+    wheel->elapsed = lwt_timer_now() >> LWT_TIMER_TICK_SHIFT;
+    memset(wheel->occupied, 0, sizeof(wheel->occupied));
+    memset(wheel->lists, 0, sizeof(wheel->lists));
+    wheel->count = 0;
+    atomic_init(&wheel->next, UINT64_MAX);
+}
+
+void lwt_timer_destroy(lwt_timer_wheel_t* wheel) {
+    /* Threads are linked in place, so there is nothing to free */
+    memset(wheel->lists, 0, sizeof(wheel->lists));
+    wheel->count = 0;
+}
+
+/* Tick at which a thread is due, rounded up so that it never fires early */
+static uint64_t lwt_timer_tick(const struct lwt_thread* thread) {
+    uint64_t mask = (1ull << LWT_TIMER_TICK_SHIFT) - 1;
+    if (thread->wake_time > UINT64_MAX - mask) {
+        return UINT64_MAX >> LWT_TIMER_TICK_SHIFT;
+    }
+    return (thread->wake_time + mask) >> LWT_TIMER_TICK_SHIFT;
+}
+
+/* Level whose slots tell tick apart from elapsed: the highest differing digit */
+static int lwt_timer_level_for(uint64_t elapsed, uint64_t tick) {
+    uint64_t masked = (elapsed ^ tick) | (LWT_TIMER_SLOTS - 1);
+    if (masked >= LWT_TIMER_RANGE) {
+        masked = LWT_TIMER_RANGE - 1;
+    }
+    return (63 - __builtin_clzll(masked)) / LWT_TIMER_LEVEL_BITS;
+}
+
+/* Push a thread onto one of the lists */
+static void lwt_timer_link(lwt_timer_wheel_t* wheel, int index, struct lwt_thread* thread) {
+    struct lwt_thread* head = wheel->lists[index];
+    thread->timer_prev = NULL;
+    thread->timer_next = head;
+    if (head) {
+        head->timer_prev = thread;
+    }
+    wheel->lists[index] = thread;
+    thread->timer_index = index;
+}
+
+/* File a thread in the slot for its tick, or as expired if that has passed */
+static void lwt_timer_insert(lwt_timer_wheel_t* wheel, struct lwt_thread* thread) {
+    uint64_t tick = lwt_timer_tick(thread);
+    if (tick <= wheel->elapsed) {
+        lwt_timer_link(wheel, LWT_TIMER_EXPIRED, thread);
+        return;
+    }
+    if (tick - wheel->elapsed > LWT_TIMER_HORIZON) {
+        tick = wheel->elapsed + LWT_TIMER_HORIZON;
+    }
+
+    int level = lwt_timer_level_for(wheel->elapsed, tick);
+    int slot = (int)((tick >> (level * LWT_TIMER_LEVEL_BITS)) & (LWT_TIMER_SLOTS - 1));
+    wheel->occupied[level] |= 1ull << slot;
+    lwt_timer_link(wheel, level * LWT_TIMER_SLOTS + slot, thread);
+}
+
+/**
+ * Find the earliest occupied slot
+ *
+ * Lower levels always come first: a timer only sits at a level because its
+ * tick lies beyond the current slot of every level below.
+ */
+static int lwt_timer_next_slot(lwt_timer_wheel_t* wheel, uint64_t* tick) {
+    for (int level = 0; level < LWT_TIMER_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (0 == occupied) {
+            continue;
+        }
+
+        /* Rotate so that the current slot is bit 0; later slots wrap round */
+        int now_slot = (int)((wheel->elapsed >> (level * LWT_TIMER_LEVEL_BITS)) &
+                             (LWT_TIMER_SLOTS - 1));
+        uint64_t rotated = now_slot ? (occupied >> now_slot) |
+                                      (occupied << (LWT_TIMER_SLOTS - now_slot))
+                                    : occupied;
+        int ahead = __builtin_ctzll(rotated);
+
+        uint64_t level_start = wheel->elapsed & ~(LWT_TIMER_LEVEL_TICKS(level) - 1);
+        *tick = level_start + (uint64_t)(now_slot + ahead) * LWT_TIMER_SLOT_TICKS(level);
+        return level * LWT_TIMER_SLOTS + (now_slot + ahead) % LWT_TIMER_SLOTS;
+    }
+    return -1;
+}
+
+/* Publish when the wheel next needs looking at */
+static void lwt_timer_update_next(lwt_timer_wheel_t* wheel) {
+    uint64_t next = UINT64_MAX;
+    uint64_t tick;
+    if (wheel->lists[LWT_TIMER_EXPIRED]) {
+        next = 0;
+    } else if (lwt_timer_next_slot(wheel, &tick) >= 0) {
+        next = tick << LWT_TIMER_TICK_SHIFT;
+    }
+    atomic_store_explicit(&wheel->next, next, memory_order_relaxed);
+}
+
+void lwt_timer_add(lwt_timer_wheel_t* wheel, struct lwt_thread* thread) {
+    thread->timer_wheel = wheel;
+    lwt_timer_insert(wheel, thread);
+    wheel->count++;
+    lwt_timer_update_next(wheel);
+}
+
+/* Unlink a thread from whichever list holds it */
+static void lwt_timer_unlink(lwt_timer_wheel_t* wheel, struct lwt_thread* thread) {
+    int index = thread->timer_index;
+    if (thread->timer_prev) {
+        thread->timer_prev->timer_next = thread->timer_next;
+    } else {
+        wheel->lists[index] = thread->timer_next;
+        if (NULL == wheel->lists[index] && index < LWT_TIMER_EXPIRED) {
+            wheel->occupied[index / LWT_TIMER_SLOTS] &= ~(1ull << (index % LWT_TIMER_SLOTS));
+        }
+    }
+    if (thread->timer_next) {
+        thread->timer_next->timer_prev = thread->timer_prev;
+    }
+    thread->timer_prev = NULL;
+    thread->timer_next = NULL;
+    thread->timer_index = -1;
+}
+
+int lwt_timer_remove(lwt_timer_wheel_t* wheel, struct lwt_thread* thread) {
+    if (thread->timer_index < 0 || thread->timer_wheel != wheel) {
+        return -1;
+    }
+    lwt_timer_unlink(wheel, thread);
+    wheel->count--;
+    lwt_timer_update_next(wheel);
+    return 0;
+}
+
+/* Empty a slot whose time has come, filing its threads again from there */
+static void lwt_timer_cascade(lwt_timer_wheel_t* wheel, int index, uint64_t tick) {
+    struct lwt_thread* thread = wheel->lists[index];
+    wheel->lists[index] = NULL;
+    wheel->occupied[index / LWT_TIMER_SLOTS] &= ~(1ull << (index % LWT_TIMER_SLOTS));
+    if (tick > wheel->elapsed) {
+        wheel->elapsed = tick;
+    }
+
+    while (thread) {
+        struct lwt_thread* next = thread->timer_next;
+        lwt_timer_insert(wheel, thread);
+        thread = next;
+    }
+}
+
+struct lwt_thread* lwt_timer_pop_expired(lwt_timer_wheel_t* wheel, uint64_t now) {
+    uint64_t now_tick = now >> LWT_TIMER_TICK_SHIFT;
+    while (NULL == wheel->lists[LWT_TIMER_EXPIRED]) {
+        uint64_t tick;
+        int index = lwt_timer_next_slot(wheel, &tick);
+        if (index < 0 || tick > now_tick) {
+            /* Nothing is filed before now, so the wheel can move up to it */
+            if (now_tick > wheel->elapsed) {
+                wheel->elapsed = now_tick;
+            }
+            lwt_timer_update_next(wheel);
+            return NULL;
+        }
+        lwt_timer_cascade(wheel, index, tick);
+    }
+
+    struct lwt_thread* thread = wheel->lists[LWT_TIMER_EXPIRED];
+    lwt_timer_unlink(wheel, thread);
+    wheel->count--;
+    lwt_timer_update_next(wheel);
+    return thread;
+}
+
+uint64_t lwt_timer_next(lwt_timer_wheel_t* wheel) {
+    return atomic_load_explicit(&wheel->next, memory_order_relaxed);
+}
+
+int lwt_timer_due(lwt_timer_wheel_t* wheel) {
+    uint64_t next = atomic_load_explicit(&wheel->next, memory_order_relaxed);
+    return next != UINT64_MAX && lwt_timer_now() >= next;
+}
+
+uint64_t lwt_timer_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file timer.h
+ * @brief Internal per-worker timer wheel for sleeping threads
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_TIMER_INTERNAL_H
+#define LWTHREAD_TIMER_INTERNAL_H
+
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Wheel geometry: 6 levels of 64 slots over ticks of 2^10 ns (about 1 us)
+ *
+ * Level n spans 64^(n+1) ticks, so the wheel covers about 19.5 hours;
+ * later timers wait in the last slot of the top level and are filed
+ * again when it comes round.
+ */
+#define LWT_TIMER_TICK_SHIFT 10
+#define LWT_TIMER_LEVEL_BITS 6
+#define LWT_TIMER_SLOTS (1 << LWT_TIMER_LEVEL_BITS)
+#define LWT_TIMER_LEVELS 6
+
+/**
+ * Index of the list of threads that are due but not yet popped
+ */
+#define LWT_TIMER_EXPIRED (LWT_TIMER_LEVELS * LWT_TIMER_SLOTS)
+
+/**
+ * Hierarchical timing wheel of sleeping threads ordered by wake_time
+ *
+ * Threads are linked into their slot's list through timer_prev and
+ * timer_next, so adding and cancelling are O(1) and never allocate.
+ * Popping walks the occupied slots with one bitmap per level, moving a
+ * higher level's slot down a level when its time comes, as in the Linux
+ * and Tokio timer wheels. Expiry is rounded up to the next tick.
+ *
+ * Owned by a single worker. Other workers only touch it to cancel a
+ * timeout, so the owner's lock is uncontended in practice. Callers hold
+ * the lock around every operation except init, destroy and due.
+ */
+typedef struct lwt_timer_wheel {
+    lwt_spinlock_t lock;                                /* Protects the fields below */
+    uint64_t elapsed;                                   /* Tick up to which slots have been processed */
+    uint64_t occupied[LWT_TIMER_LEVELS];                /* Non-empty slots of each level */
+    struct lwt_thread* lists[LWT_TIMER_EXPIRED + 1];    /* Slots, then the expired list */
+    int count;                                          /* Number of sleeping threads */
+    _Atomic uint64_t next;                              /* Next time to look, in ns, UINT64_MAX if empty
+                                                           (readable without the lock) */
+} lwt_timer_wheel_t;
+
+/**
+ * Initialize a timer wheel
+ *
+ * @param wheel Wheel to initialize
+ */
+void lwt_timer_init(lwt_timer_wheel_t* wheel);
+
+/**
+ * Tear down a timer wheel
+ *
+ * @param wheel Wheel to destroy
+ */
+void lwt_timer_destroy(lwt_timer_wheel_t* wheel);
+
+/**
+ * Add a sleeping thread, keyed by its wake_time
+ *
+ * Records the wheel in the thread so that the timer can be cancelled.
+ *
+ * @param wheel Wheel to add to
+ * @param thread Thread to add
+ */
+void lwt_timer_add(lwt_timer_wheel_t* wheel, struct lwt_thread* thread);
+
+/**
+ * Remove a thread before its wake_time
+ *
+ * @param wheel Wheel the thread was added to
+ * @param thread Thread to remove
+ * @return 0 on success, -1 if the thread has already been popped
+ */
+int lwt_timer_remove(lwt_timer_wheel_t* wheel, struct lwt_thread* thread);
+
+/**
+ * Remove a thread whose wake_time has passed
+ *
+ * @param wheel Wheel to check
+ * @param now Current monotonic time in nanoseconds
+ * @return Expired thread or NULL if none is due
+ */
+struct lwt_thread* lwt_timer_pop_expired(lwt_timer_wheel_t* wheel, uint64_t now);
+
+/**
+ * Get the next time the wheel needs looking at
+ *
+ * This is the start of the earliest occupied slot, which may come before
+ * any wake_time in it: higher levels are only moved down at that point.
+ *
+ * @param wheel Wheel to check
+ * @return Monotonic time in nanoseconds, or UINT64_MAX if empty
+ */
+uint64_t lwt_timer_next(lwt_timer_wheel_t* wheel);
+
+/**
+ * Check without the lock whether the wheel needs looking at
+ *
+ * @param wheel Wheel to check
+ * @return 1 if lwt_timer_next() has passed, 0 otherwise
+ */
+int lwt_timer_due(lwt_timer_wheel_t* wheel);
+
+/**
+ * Read the monotonic clock
+ *
+ * @return Current CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t lwt_timer_now(void);
+
+#endif /* LWTHREAD_TIMER_INTERNAL_H */
@@ -0,0 +1,388 @@
+/**
+ * @file uring.c
+ * @brief Per-worker io_uring rings, set up with raw system calls
+ */
+
+#include "uring.h"
+#include "thread.h"
+#include <errno.h>
+#include <string.h>
+
+void lwt_uring_clear(lwt_uring_t* ring) {
+    memset(ring, 0, sizeof(lwt_uring_t));
+    lwt_spin_init(&ring->lock);
+    ring->fd = -1;
+    ring->eventfd = -1;
+}
+
+#if defined(__linux__) && defined(LWT_HAVE_IO_URING)
+
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Largest transfer a single read or write SQE takes, as for read(2) */
+#define LWT_URING_MAX_RW 0x7ffff000u
+
+/* Kernel features the backend relies on: no dropped completions, reads at
+ * the current file position, and internal polling for sockets */
+#define LWT_URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+                            IORING_FEAT_RW_CUR_POS | IORING_FEAT_FAST_POLL)
+
+static int lwt_uring_setup(unsigned int entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int lwt_uring_enter(int fd, unsigned int to_submit, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, NULL, 0);
+}
+
+int lwt_uring_init(lwt_uring_t* ring, unsigned int entries, int sqpoll) {
+    lwt_uring_clear(ring);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP | (sqpoll ? IORING_SETUP_SQPOLL : 0);
+    int fd = lwt_uring_setup(entries, &params);
+    if (fd < 0 && sqpoll) {
+        /* Older kernels only allow SQPOLL with privileges */
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CLAMP;
+        fd = lwt_uring_setup(entries, &params);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    if ((params.features & LWT_URING_FEATURES) != LWT_URING_FEATURES) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+    ring->fd = fd;
+    ring->sqpoll = (params.flags & IORING_SETUP_SQPOLL) != 0;
+
+    /* With SINGLE_MMAP both rings share one mapping */
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq_ring) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    ring->cq_ring = ring->sq_ring;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sqes) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char* sq = ring->sq_ring;
+    ring->sq_head = (atomic_uint*)(sq + params.sq_off.head);
+    ring->sq_tail = (atomic_uint*)(sq + params.sq_off.tail);
+    ring->sq_flags = (atomic_uint*)(sq + params.sq_off.flags);
+    ring->sq_array = (unsigned int*)(sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned int*)(sq + params.sq_off.ring_entries);
+
+    char* cq = ring->cq_ring;
+    ring->cq_head = (atomic_uint*)(cq + params.cq_off.head);
+    ring->cq_tail = (atomic_uint*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    /* SQE i always sits in slot i, so the index array never changes */
+    for (unsigned int i = 0; i < ring->sq_entries; i++) {
+        ring->sq_array[i] = i;
+    }
+
+    /* Lets a worker blocked in epoll_wait notice completions */
+    ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->eventfd < 0 ||
+        syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &ring->eventfd, 1) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    lwt_uring_destroy(ring);
+    return -1;
+}
+
+void lwt_uring_destroy(lwt_uring_t* ring) {
+    if (ring->fd < 0) {
+        return;
+    }
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->eventfd >= 0) {
+        close(ring->eventfd);
+    }
+    close(ring->fd);
+    lwt_uring_clear(ring);
+}
+
+/* Hand queued submissions to the kernel (ring lock held) */
+static void lwt_uring_enter_locked(lwt_uring_t* ring) {
+    if (ring->sqpoll) {
+        /* The kernel thread picks them up unless it has gone to sleep */
+        atomic_store_explicit(&ring->pending, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(ring->sq_flags, memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+            lwt_uring_enter(ring->fd, 0, IORING_ENTER_SQ_WAKEUP);
+        }
+        return;
+    }
+
+    unsigned int pending;
+    while ((pending = atomic_load_explicit(&ring->pending, memory_order_relaxed)) > 0) {
+        int n = lwt_uring_enter(ring->fd, pending, 0);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            /* EBUSY or EAGAIN: the kernel is short of resources, retry on the next flush */
+            break;
+        }
+        atomic_fetch_sub_explicit(&ring->pending, (unsigned int)n, memory_order_relaxed);
+    }
+}
+
+/* Next free SQE, zeroed, or NULL if the submission queue is full (ring lock held) */
+static struct io_uring_sqe* lwt_uring_get_sqe(lwt_uring_t* ring) {
+    unsigned int head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    if (tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+/* Make the SQE from lwt_uring_get_sqe visible to the kernel (ring lock held) */
+static void lwt_uring_publish_locked(lwt_uring_t* ring) {
+    unsigned int tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->pending, 1, memory_order_relaxed);
+}
+
+/* Get an SQE, making room if the queue is full (ring lock held) */
+static struct io_uring_sqe* lwt_uring_reserve_locked(lwt_uring_t* ring) {
+    struct io_uring_sqe* sqe = lwt_uring_get_sqe(ring);
+    if (NULL == sqe) {
+        if (ring->sqpoll) {
+            lwt_uring_enter(ring->fd, 0, IORING_ENTER_SQ_WAIT);
+        } else {
+            lwt_uring_enter_locked(ring);
+        }
+        sqe = lwt_uring_get_sqe(ring);
+    }
+    if (NULL == sqe) {
+        errno = EBUSY;
+    }
+    return sqe;
+}
+
+static void lwt_uring_prep(struct io_uring_sqe* sqe, lwt_io_request_t* req) {
+    unsigned int len = req->len > LWT_URING_MAX_RW ? LWT_URING_MAX_RW : (unsigned int)req->len;
+
+    sqe->fd = req->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    switch (req->opcode) {
+    case LWT_IO_OP_READ:
+    case LWT_IO_OP_PREAD:
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = len;
+        /* An offset of -1 reads at the file position, like read(2) */
+        sqe->off = (LWT_IO_OP_READ == req->opcode) ? (uint64_t)-1 : (uint64_t)req->offset;
+        break;
+    case LWT_IO_OP_WRITE:
+    case LWT_IO_OP_PWRITE:
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = len;
+        sqe->off = (LWT_IO_OP_WRITE == req->opcode) ? (uint64_t)-1 : (uint64_t)req->offset;
+        break;
+    case LWT_IO_OP_FSYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        break;
+    case LWT_IO_OP_OPENAT:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->addr = (uint64_t)(uintptr_t)req->path;
+        sqe->len = (unsigned int)req->mode;
+        sqe->open_flags = (unsigned int)req->flags;
+        break;
+    case LWT_IO_OP_RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = len;
+        sqe->msg_flags = (unsigned int)req->flags;
+        break;
+    case LWT_IO_OP_SEND:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = len;
+        sqe->msg_flags = (unsigned int)req->flags;
+        break;
+    case LWT_IO_OP_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->addr = (uint64_t)(uintptr_t)req->addr;
+        sqe->addr2 = (uint64_t)(uintptr_t)req->addrlenp;
+        sqe->accept_flags = (unsigned int)req->flags;
+        break;
+    case LWT_IO_OP_CONNECT:
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->addr = (uint64_t)(uintptr_t)req->addr;
+        sqe->off = req->addrlen;
+        break;
+    case LWT_IO_OP_POLL:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = (uint32_t)req->flags;
+        break;
+    }
+}
+
+int lwt_uring_submit(lwt_uring_t* ring, lwt_io_request_t* req) {
+    lwt_spin_lock(&ring->lock);
+    struct io_uring_sqe* sqe = lwt_uring_reserve_locked(ring);
+    if (NULL == sqe) {
+        lwt_spin_unlock(&ring->lock);
+        return -1;
+    }
+    lwt_uring_prep(sqe, req);
+    lwt_uring_publish_locked(ring);
+
+    /* Otherwise submissions wait for the worker to run out of threads */
+    if (atomic_load_explicit(&ring->pending, memory_order_relaxed) >= LWT_URING_BATCH ||
+        ring->sqpoll) {
+        lwt_uring_enter_locked(ring);
+    }
+    lwt_spin_unlock(&ring->lock);
+    return 0;
+}
+
+void lwt_uring_cancel_fd(lwt_uring_t* ring, int fd) {
+#ifdef IORING_ASYNC_CANCEL_FD
+    if (ring->fd < 0) {
+        return;
+    }
+
+    lwt_spin_lock(&ring->lock);
+    struct io_uring_sqe* sqe = lwt_uring_reserve_locked(ring);
+    if (sqe) {
+        /* user_data 0: the completion has no thread to wake */
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        lwt_uring_publish_locked(ring);
+        lwt_uring_enter_locked(ring);
+    }
+    lwt_spin_unlock(&ring->lock);
+#else
+    (void)ring;
+    (void)fd;
+#endif
+}
+
+void lwt_uring_flush(lwt_uring_t* ring) {
+    if (ring->fd < 0 || 0 == atomic_load_explicit(&ring->pending, memory_order_relaxed)) {
+        return;
+    }
+    lwt_spin_lock(&ring->lock);
+    lwt_uring_enter_locked(ring);
+    lwt_spin_unlock(&ring->lock);
+}
+
+struct lwt_thread* lwt_uring_reap(lwt_uring_t* ring) {
+    if (ring->fd < 0) {
+        return NULL;
+    }
+
+    /* Completions the CQ had no room for wait in the kernel until we ask */
+    int overflow = (atomic_load_explicit(ring->sq_flags, memory_order_relaxed) &
+                    IORING_SQ_CQ_OVERFLOW) != 0;
+    if (!overflow && atomic_load_explicit(ring->cq_head, memory_order_relaxed) ==
+                     atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+        return NULL;
+    }
+
+    struct lwt_thread* head = NULL;
+    struct lwt_thread* tail = NULL;
+    lwt_spin_lock(&ring->lock);
+    if (overflow) {
+        lwt_uring_enter(ring->fd, 0, IORING_ENTER_GETEVENTS);
+    }
+    unsigned int cq_head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    unsigned int cq_tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+    for (; cq_head != cq_tail; cq_head++) {
+        struct io_uring_cqe* cqe = &ring->cqes[cq_head & ring->cq_mask];
+        lwt_io_request_t* req = (lwt_io_request_t*)(uintptr_t)cqe->user_data;
+        if (NULL == req) {
+            continue;
+        }
+
+        /* The request lives on the thread's stack: done with it once the result is in */
+        struct lwt_thread* thread = req->thread;
+        req->result = cqe->res;
+        thread->next = NULL;
+        if (tail) {
+            tail->next = thread;
+        } else {
+            head = thread;
+        }
+        tail = thread;
+    }
+    atomic_store_explicit(ring->cq_head, cq_head, memory_order_release);
+    lwt_spin_unlock(&ring->lock);
+    return head;
+}
+
+#else /* no io_uring */
+
+int lwt_uring_init(lwt_uring_t* ring, unsigned int entries, int sqpoll) {
+    (void)entries;
+    (void)sqpoll;
+    lwt_uring_clear(ring);
+    errno = ENOSYS;
+    return -1;
+}
+
+void lwt_uring_destroy(lwt_uring_t* ring) {
+    lwt_uring_clear(ring);
+}
+
+int lwt_uring_submit(lwt_uring_t* ring, lwt_io_request_t* req) {
+    (void)ring;
+    (void)req;
+    errno = ENOSYS;
+    return -1;
+}
+
+void lwt_uring_cancel_fd(lwt_uring_t* ring, int fd) {
+    (void)ring;
+    (void)fd;
+}
+
+void lwt_uring_flush(lwt_uring_t* ring) {
+    (void)ring;
+}
+
+struct lwt_thread* lwt_uring_reap(lwt_uring_t* ring) {
+    (void)ring;
+    return NULL;
+}
+
+#endif /* __linux__ && LWT_HAVE_IO_URING */
@@ -0,0 +1,121 @@
+/**
+ * @file uring.h
+ * @brief Internal per-worker io_uring rings
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_URING_INTERNAL_H
+#define LWTHREAD_URING_INTERNAL_H
+
+#include "io.h"
+#include "spinlock.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * Default number of submission queue entries per ring
+ */
+#define LWT_URING_ENTRIES 256
+
+/**
+ * Queued submissions that force an io_uring_enter without waiting for the
+ * worker to run out of threads
+ */
+#define LWT_URING_BATCH 32
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * An io_uring instance owned by one worker
+ *
+ * The owner queues submissions and reaps completions; other workers reap
+ * when the ring's eventfd fires and submit cancellations on close, hence
+ * the lock.
+ */
+typedef struct lwt_uring {
+    lwt_spinlock_t lock;            /* Protects both queues */
+    int fd;                         /* Ring descriptor, -1 if unused */
+    int eventfd;                    /* Signalled when completions are posted */
+    int sqpoll;                     /* A kernel thread polls the submission queue */
+    atomic_uint pending;            /* Queued submissions not yet passed to the kernel */
+    atomic_uint* sq_head;           /* Submission queue, shared with the kernel */
+    atomic_uint* sq_tail;
+    atomic_uint* sq_flags;
+    unsigned int* sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    struct io_uring_sqe* sqes;
+    atomic_uint* cq_head;           /* Completion queue, shared with the kernel */
+    atomic_uint* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;                  /* Mappings, for teardown */
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} lwt_uring_t;
+
+/**
+ * Mark a ring as unused
+ *
+ * @param ring Ring to clear
+ */
+void lwt_uring_clear(lwt_uring_t* ring);
+
+/**
+ * Set up a ring
+ *
+ * @param ring Ring to set up
+ * @param entries Submission queue size
+ * @param sqpoll Whether to ask for a kernel submission polling thread
+ * @return 0 on success, -1 on failure (errno ENOSYS without io_uring)
+ */
+int lwt_uring_init(lwt_uring_t* ring, unsigned int entries, int sqpoll);
+
+/**
+ * Tear down a ring
+ *
+ * @param ring Ring to tear down
+ */
+void lwt_uring_destroy(lwt_uring_t* ring);
+
+/**
+ * Queue a request; its completion is found by lwt_uring_reap
+ *
+ * @param ring Ring to use
+ * @param req Request, which must stay valid until it completes
+ * @return 0 on success, -1 on failure (errno set)
+ */
+int lwt_uring_submit(lwt_uring_t* ring, lwt_io_request_t* req);
+
+/**
+ * Cancel every request on a descriptor that is about to be closed
+ *
+ * @param ring Ring to use
+ * @param fd Descriptor
+ */
+void lwt_uring_cancel_fd(lwt_uring_t* ring, int fd);
+
+/**
+ * Pass queued submissions to the kernel
+ *
+ * @param ring Ring to flush
+ */
+void lwt_uring_flush(lwt_uring_t* ring);
+
+/**
+ * Collect completions, storing each result in its request
+ *
+ * @param ring Ring to reap
+ * @return Threads whose requests completed, linked through next
+ */
+struct lwt_thread* lwt_uring_reap(lwt_uring_t* ring);
+
+#endif /* LWTHREAD_URING_INTERNAL_H */
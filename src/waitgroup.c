@@ -0,0 +1,75 @@
+/**
+ * @file waitgroup.c
+ * @brief Wait group implementation
+ */
+
+#include "waitgroup.h"
+#include "lwthread/lwthread.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+lwt_waitgroup_t* lwt_waitgroup_create(void) {
+    lwt_waitgroup_t* wg = calloc(1, sizeof(lwt_waitgroup_t));
+    if (NULL == wg) {
+        return NULL;
+    }
+    atomic_init(&wg->count, 0);
+    lwt_spin_init(&wg->zero.lock);
+    wg->zero.set = 1;
+    return wg;
+}
+
+void lwt_waitgroup_destroy(lwt_waitgroup_t* wg) {
+    free(wg);
+}
+
+/* Set or clear the event to match the count after it crossed zero */
+static void lwt_waitgroup_sync(lwt_waitgroup_t* wg) {
+    struct lwt_thread* ready = NULL;
+    lwt_spin_lock(&wg->zero.lock);
+    if (0 == atomic_load_explicit(&wg->count, memory_order_acquire)) {
+        if (!wg->zero.set) {
+            wg->zero.set = 1;
+            lwt_select_fire_list(&wg->zero.selectors, -1, &ready);
+        }
+    } else {
+        wg->zero.set = 0;
+    }
+    lwt_spin_unlock(&wg->zero.lock);
+    lwt_select_ready(ready);
+}
+
+int lwt_waitgroup_add(lwt_waitgroup_t* wg, long delta) {
+    if (NULL == wg) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    long old = atomic_fetch_add_explicit(&wg->count, delta, memory_order_acq_rel);
+    long count = old + delta;
+    if (count < 0) {
+        atomic_fetch_sub_explicit(&wg->count, delta, memory_order_relaxed);
+        errno = EINVAL;
+        return -1;
+    }
+    if ((0 == old) != (0 == count)) {
+        lwt_waitgroup_sync(wg);
+    }
+    return 0;
+}
+
+int lwt_waitgroup_done(lwt_waitgroup_t* wg) {
+    return lwt_waitgroup_add(wg, -1);
+}
+
+int lwt_waitgroup_wait(lwt_waitgroup_t* wg) {
+    if (NULL == wg) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (0 == atomic_load_explicit(&wg->count, memory_order_acquire)) {
+        return 0;
+    }
+    return lwt_event_wait(&wg->zero);
+}
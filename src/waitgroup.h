@@ -0,0 +1,32 @@
+/**
+ * @file waitgroup.h
+ * @brief Internal wait group for lightweight threads
+ * @internal This header is not part of the public API
+ * This library provides a lightweight threading system inspired by Go's
+ * goroutines, allowing for efficient concurrency with minimal overhead.
+ *
+ * @copyright Copyright (c) 2025
+ * @license MIT License
+ */
+
+#ifndef LWTHREAD_WAITGROUP_INTERNAL_H
+#define LWTHREAD_WAITGROUP_INTERNAL_H
+
+#include "select.h"
+#include <stdatomic.h>
+
+/**
+ * Wait group structure
+ *
+ * Modelled on Go's sync.WaitGroup. Waiters wait on an event that is set
+ * while the count is zero. Adding and finishing only touch the atomic
+ * count, except when it moves to or from zero: then the event is brought
+ * in line with the count under its lock, so the last of several racing
+ * transitions always leaves it right.
+ */
+struct lwt_waitgroup {
+    atomic_long count;                  /* Outstanding tasks */
+    struct lwt_event zero;              /* Set while count is zero */
+};
+
+#endif /* LWTHREAD_WAITGROUP_INTERNAL_H */
@@ -0,0 +1,59 @@
+/**
+ * @file check.h
+ * @brief Helpers shared by the test programs
+ *
+ * Each test program is a table of cases, each returning 0 or -1. A failed
+ * check reports where it failed and makes its case return -1.
+ */
+
+#ifndef LWTHREAD_TEST_CHECK_H
+#define LWTHREAD_TEST_CHECK_H
+
+#include <stdio.h>
+
+/**
+ * Exit status that tells ctest a test was skipped
+ */
+#define LWT_TEST_SKIP 77
+
+/**
+ * Fail the current case unless cond holds
+ */
+#define LWT_CHECK(cond)                                                         \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,    \
+                    #cond);                                                     \
+            return -1;                                                          \
+        }                                                                       \
+    } while (0)
+
+/**
+ * A named test case
+ */
+typedef struct lwt_test_case {
+    const char* name;
+    int (*run)(void);
+} lwt_test_case_t;
+
+/**
+ * Run every case and report each one
+ *
+ * @param cases Cases to run
+ * @param count Number of cases
+ * @return Exit status: 0 if all passed, 1 otherwise
+ */
+static inline int lwt_test_run(const lwt_test_case_t* cases, size_t count) {
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        int rc = cases[i].run();
+        printf("%-48s %s\n", cases[i].name, 0 == rc ? "ok" : "FAILED");
+        fflush(stdout);
+        failed |= (rc != 0);
+    }
+    return failed;
+}
+
+#define LWT_TEST_RUN(cases) lwt_test_run(cases, sizeof(cases) / sizeof(cases[0]))
+
+#endif /* LWTHREAD_TEST_CHECK_H */
@@ -0,0 +1,280 @@
+/**
+ * @file test_chan.c
+ * @brief Channel close and lwt_select() races
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#define ROUNDS 200
+#define SENDERS 4
+#define RECEIVERS 3
+#define SELECTORS 8
+
+static lwt_scheduler_t* scheduler;
+
+/* Totals of one close race */
+static atomic_long sent_count;
+static atomic_long sent_sum;
+static atomic_long received_count;
+static atomic_long received_sum;
+static atomic_int failures;
+
+/* Sends increasing values until the channel is closed */
+static void sender_thread(void* arg) {
+    lwt_chan_t* chan = (lwt_chan_t*)arg;
+    for (long value = 1; ; value++) {
+        if (lwt_chan_send(chan, &value) != 0) {
+            if (errno != EPIPE) {
+                atomic_fetch_add(&failures, 1);
+            }
+            return;
+        }
+        atomic_fetch_add(&sent_count, 1);
+        atomic_fetch_add(&sent_sum, value);
+    }
+}
+
+/* Receives until the channel is closed and drained */
+static void receiver_thread(void* arg) {
+    lwt_chan_t* chan = (lwt_chan_t*)arg;
+    long value;
+    while (0 == lwt_chan_recv(chan, &value)) {
+        atomic_fetch_add(&received_count, 1);
+        atomic_fetch_add(&received_sum, value);
+    }
+    if (errno != EPIPE) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* Closes the channel after a while, racing senders and receivers */
+static void closer_thread(void* arg) {
+    lwt_sleep_ns(20000);
+    if (lwt_chan_close((lwt_chan_t*)arg) != 0) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* Every send that succeeded is received, whatever close interrupts */
+static int close_race(size_t capacity) {
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&sent_count, 0);
+        atomic_store(&sent_sum, 0);
+        atomic_store(&received_count, 0);
+        atomic_store(&received_sum, 0);
+        atomic_store(&failures, 0);
+
+        lwt_chan_t* chan = lwt_chan_create(sizeof(long), capacity);
+        LWT_CHECK(chan != NULL);
+        lwt_thread_t* threads[SENDERS + RECEIVERS + 1];
+        int n = 0;
+        for (int i = 0; i < SENDERS; i++) {
+            threads[n++] = lwt_create(scheduler, sender_thread, chan);
+        }
+        for (int i = 0; i < RECEIVERS; i++) {
+            threads[n++] = lwt_create(scheduler, receiver_thread, chan);
+        }
+        threads[n++] = lwt_create(scheduler, closer_thread, chan);
+        for (int i = 0; i < n; i++) {
+            LWT_CHECK(threads[i] != NULL);
+            lwt_join(threads[i]);
+            lwt_thread_free(threads[i]);
+        }
+
+        long value = 0;
+        LWT_CHECK(-1 == lwt_chan_trysend(chan, &value) && EPIPE == errno);
+        LWT_CHECK(-1 == lwt_chan_close(chan) && EPIPE == errno);
+        lwt_chan_destroy(chan);
+
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(atomic_load(&sent_count) == atomic_load(&received_count));
+        LWT_CHECK(atomic_load(&sent_sum) == atomic_load(&received_sum));
+    }
+    return 0;
+}
+
+static int close_race_unbuffered(void) {
+    return close_race(0);
+}
+
+static int close_race_buffered(void) {
+    return close_race(4);
+}
+
+/* Blocked receivers of an empty channel all fail once it is closed */
+static int close_wakes_receivers(void) {
+    for (int round = 0; round < ROUNDS / 10; round++) {
+        atomic_store(&failures, 0);
+        atomic_store(&received_count, 0);
+        lwt_chan_t* chan = lwt_chan_create(sizeof(long), round % 2);
+        LWT_CHECK(chan != NULL);
+        lwt_thread_t* receivers[RECEIVERS];
+        for (int i = 0; i < RECEIVERS; i++) {
+            receivers[i] = lwt_create(scheduler, receiver_thread, chan);
+            LWT_CHECK(receivers[i] != NULL);
+        }
+        lwt_sleep(1);
+        LWT_CHECK(0 == lwt_chan_close(chan));
+        for (int i = 0; i < RECEIVERS; i++) {
+            lwt_join(receivers[i]);
+            lwt_thread_free(receivers[i]);
+        }
+        lwt_chan_destroy(chan);
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(0 == atomic_load(&received_count));
+    }
+    return 0;
+}
+
+/* Sources of one select race */
+static lwt_event_t* events[2];
+static lwt_thread_t* target;
+static atomic_int selected[3];
+
+/* Sets an event after a few yields */
+static void setter_thread(void* arg) {
+    int yields = (int)(long)arg;
+    for (int i = 0; i < yields; i++) {
+        lwt_yield();
+    }
+    lwt_event_set(events[yields % 2]);
+}
+
+/* Finishes after a few yields */
+static void target_thread(void* arg) {
+    int yields = (int)(long)arg;
+    for (int i = 0; i < yields; i++) {
+        lwt_yield();
+    }
+}
+
+/* Waits for whichever source fires first, and checks that it really did */
+static void selector_thread(void* arg) {
+    (void)arg;
+    lwt_select_source_t sources[3] = {
+        { .type = LWT_SELECT_EVENT, .event = events[0] },
+        { .type = LWT_SELECT_EVENT, .event = events[1] },
+        { .type = LWT_SELECT_THREAD, .thread = target },
+    };
+    int index = lwt_select(sources, 3, -1);
+    if (index < 0 || index > 2) {
+        atomic_fetch_add(&failures, 1);
+        return;
+    }
+    if (2 == index && lwt_try_join(target) != 0) {
+        atomic_fetch_add(&failures, 1);
+    }
+    atomic_fetch_add(&selected[index], 1);
+}
+
+/* Several selectors wake for events and a thread finishing at about the same time */
+static int select_race(void) {
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&failures, 0);
+        for (int i = 0; i < 3; i++) {
+            atomic_store(&selected[i], 0);
+        }
+        events[0] = lwt_event_create();
+        events[1] = lwt_event_create();
+        LWT_CHECK(events[0] != NULL && events[1] != NULL);
+        target = lwt_create(scheduler, target_thread, (void*)(long)(round % 5));
+        LWT_CHECK(target != NULL);
+
+        lwt_thread_t* threads[SELECTORS + 2];
+        int n = 0;
+        for (int i = 0; i < SELECTORS; i++) {
+            threads[n++] = lwt_create(scheduler, selector_thread, NULL);
+        }
+        threads[n++] = lwt_create(scheduler, setter_thread, (void*)(long)(round % 4));
+        threads[n++] = lwt_create(scheduler, setter_thread, (void*)(long)(round % 4 + 1));
+        for (int i = 0; i < n; i++) {
+            LWT_CHECK(threads[i] != NULL);
+            lwt_join(threads[i]);
+            lwt_thread_free(threads[i]);
+        }
+        lwt_join(target);
+        lwt_thread_free(target);
+        lwt_event_destroy(events[0]);
+        lwt_event_destroy(events[1]);
+
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(SELECTORS == atomic_load(&selected[0]) + atomic_load(&selected[1]) +
+                               atomic_load(&selected[2]));
+    }
+    return 0;
+}
+
+/* Selects with a timeout of about as long as the setter takes */
+static void timed_selector_thread(void* arg) {
+    (void)arg;
+    lwt_select_source_t source = { .type = LWT_SELECT_EVENT, .event = events[0] };
+    int index = lwt_select(&source, 1, 1);
+    if (0 == index) {
+        atomic_fetch_add(&selected[0], 1);
+    } else if (index != -1 || errno != ETIMEDOUT) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* Sets the event at about the time the selectors give up */
+static void late_setter_thread(void* arg) {
+    (void)arg;
+    lwt_sleep_ns(1000000);
+    lwt_event_set(events[0]);
+}
+
+/* A timeout racing the event either reports the event or ETIMEDOUT, nothing else */
+static int select_timeout_race(void) {
+    for (int round = 0; round < ROUNDS / 10; round++) {
+        atomic_store(&failures, 0);
+        atomic_store(&selected[0], 0);
+        events[0] = lwt_event_create();
+        LWT_CHECK(events[0] != NULL);
+        lwt_thread_t* threads[SELECTORS + 1];
+        int n = 0;
+        for (int i = 0; i < SELECTORS; i++) {
+            threads[n++] = lwt_create(scheduler, timed_selector_thread, NULL);
+        }
+        threads[n++] = lwt_create(scheduler, late_setter_thread, NULL);
+        for (int i = 0; i < n; i++) {
+            LWT_CHECK(threads[i] != NULL);
+            lwt_join(threads[i]);
+            lwt_thread_free(threads[i]);
+        }
+        LWT_CHECK(0 == atomic_load(&failures));
+
+        /* Level-triggered: once set, a select reports it at once */
+        threads[0] = lwt_create(scheduler, timed_selector_thread, NULL);
+        LWT_CHECK(threads[0] != NULL);
+        lwt_join(threads[0]);
+        lwt_thread_free(threads[0]);
+        LWT_CHECK(atomic_load(&selected[0]) >= 1);
+        lwt_event_destroy(events[0]);
+    }
+    return 0;
+}
+
+int main() {
+    scheduler = lwt_scheduler_create(4);
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    lwt_scheduler_start(scheduler);
+
+    lwt_test_case_t cases[] = {
+        { "close against unbuffered senders", close_race_unbuffered },
+        { "close against buffered senders", close_race_buffered },
+        { "close wakes blocked receivers", close_wakes_receivers },
+        { "select on events and a finishing thread", select_race },
+        { "select timeout against an event", select_timeout_race },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file test_create_many.c
+ * @brief lwt_create_many(), and what a failure leaves behind
+ *
+ * A failure part-way through is provoked by lowering RLIMIT_AS until
+ * only the first few slabs of stacks can be mapped.
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define COUNT 1000
+#define STACK_SIZE (1024 * 1024)
+
+static lwt_scheduler_t* scheduler;
+static atomic_int ran;
+static atomic_long arg_sum;
+static lwt_thread_t* const sentinel = (lwt_thread_t*)&sentinel;
+
+/* Counts itself and its argument */
+static void counting_thread(void* arg) {
+    atomic_fetch_add(&ran, 1);
+    atomic_fetch_add(&arg_sum, (long)arg);
+}
+
+static void* args[COUNT];
+static lwt_thread_t* threads[COUNT];
+
+static void reset(void) {
+    atomic_store(&ran, 0);
+    atomic_store(&arg_sum, 0);
+    for (int i = 0; i < COUNT; i++) {
+        args[i] = (void*)(long)(i + 1);
+        threads[i] = sentinel;
+    }
+}
+
+/* Every thread runs once with its own argument and can be joined */
+static int joinable(void) {
+    reset();
+    LWT_CHECK(0 == lwt_create_many(scheduler, NULL, counting_thread, args, COUNT, threads));
+    for (int i = 0; i < COUNT; i++) {
+        LWT_CHECK(threads[i] != NULL && threads[i] != sentinel);
+        lwt_join(threads[i]);
+        lwt_thread_free(threads[i]);
+    }
+    LWT_CHECK(COUNT == atomic_load(&ran));
+    LWT_CHECK((long)COUNT * (COUNT + 1) / 2 == atomic_load(&arg_sum));
+    return 0;
+}
+
+/* Without a threads array they are detached, and still all run */
+static int detached(void) {
+    reset();
+    LWT_CHECK(0 == lwt_create_many(scheduler, NULL, counting_thread, NULL, COUNT, NULL));
+    for (int i = 0; i < 5000 && atomic_load(&ran) < COUNT; i++) {
+        usleep(1000);
+    }
+    LWT_CHECK(COUNT == atomic_load(&ran));
+    LWT_CHECK(0 == atomic_load(&arg_sum));
+    return 0;
+}
+
+/* Bad arguments fail before anything is created */
+static int bad_arguments(void) {
+    reset();
+    lwt_attr_t attr;
+    lwt_attr_init(&attr);
+    attr.priority = LWT_PRIO_MAX + 1;
+    LWT_CHECK(-1 == lwt_create_many(scheduler, &attr, counting_thread, args, COUNT, threads));
+    LWT_CHECK(EINVAL == errno);
+    LWT_CHECK(-1 == lwt_create_many(scheduler, NULL, NULL, args, COUNT, threads));
+    LWT_CHECK(EINVAL == errno);
+    LWT_CHECK(-1 == lwt_create_many(scheduler, NULL, counting_thread, args, -1, threads));
+    LWT_CHECK(EINVAL == errno);
+    LWT_CHECK(-1 == lwt_create_many(NULL, NULL, counting_thread, args, COUNT, threads));
+    LWT_CHECK(EINVAL == errno);
+    LWT_CHECK(0 == lwt_create_many(scheduler, NULL, counting_thread, args, 0, threads));
+    for (int i = 0; i < COUNT; i++) {
+        LWT_CHECK(sentinel == threads[i]);
+    }
+    usleep(10000);
+    LWT_CHECK(0 == atomic_load(&ran));
+    return 0;
+}
+
+/* Address space in use now, in bytes */
+static size_t address_space(void) {
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long pages = 0;
+    if (f) {
+        if (fscanf(f, "%lu", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Running out of memory after some slabs leaves no thread behind and threads[] untouched */
+static int failure_part_way(void) {
+    size_t used = address_space();
+    if (0 == used) {
+        printf("(no /proc/self/statm, skipped) ");
+        return 0;
+    }
+    reset();
+    lwt_attr_t attr;
+    lwt_attr_init(&attr);
+    attr.stack_size = STACK_SIZE;
+
+    /* Room for a few slabs of stacks, far fewer than COUNT */
+    struct rlimit old, limit;
+    LWT_CHECK(0 == getrlimit(RLIMIT_AS, &old));
+    limit = old;
+    limit.rlim_cur = used + 200 * (size_t)STACK_SIZE;
+    LWT_CHECK(0 == setrlimit(RLIMIT_AS, &limit));
+    int rc = lwt_create_many(scheduler, &attr, counting_thread, args, COUNT, threads);
+    int error = errno;
+    LWT_CHECK(0 == setrlimit(RLIMIT_AS, &old));
+
+    LWT_CHECK(-1 == rc);
+    LWT_CHECK(ENOMEM == error);
+    for (int i = 0; i < COUNT; i++) {
+        LWT_CHECK(sentinel == threads[i]);
+    }
+    usleep(10000);
+    LWT_CHECK(0 == atomic_load(&ran));
+
+    /* What was built and torn down is reusable */
+    LWT_CHECK(0 == lwt_create_many(scheduler, &attr, counting_thread, args, COUNT, threads));
+    for (int i = 0; i < COUNT; i++) {
+        lwt_join(threads[i]);
+        lwt_thread_free(threads[i]);
+    }
+    LWT_CHECK(COUNT == atomic_load(&ran));
+    return 0;
+}
+
+int main() {
+    scheduler = lwt_scheduler_create(2);
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    lwt_scheduler_start(scheduler);
+
+    lwt_test_case_t cases[] = {
+        { "joinable threads with arguments", joinable },
+        { "detached threads", detached },
+        { "bad arguments", bad_arguments },
+        { "failure part-way through", failure_part_way },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}
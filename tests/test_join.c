@@ -0,0 +1,176 @@
+/**
+ * @file test_join.c
+ * @brief lwt_join(), lwt_try_join() and lwt_join_timeout() with several joiners
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#define ROUNDS 20
+#define JOINERS 4
+#define TARGET_MS 50
+
+static lwt_scheduler_t* scheduler;
+static atomic_int finished;
+static atomic_int joined;
+static atomic_int timed_out;
+static atomic_int failures;
+
+/* Target: runs long enough for every joiner to be waiting */
+static void target_thread(void* arg) {
+    (void)arg;
+    lwt_sleep(TARGET_MS);
+    atomic_fetch_add(&finished, 1);
+}
+
+/* Joins without a limit; the target must have finished by then */
+static void joiner_thread(void* arg) {
+    lwt_join((lwt_thread_t*)arg);
+    if (atomic_load(&finished) != 1) {
+        atomic_fetch_add(&failures, 1);
+    }
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Joins with a limit far beyond the target's run time */
+static void patient_joiner_thread(void* arg) {
+    if (lwt_join_timeout((lwt_thread_t*)arg, 5000000000ull) != 0 ||
+        atomic_load(&finished) != 1) {
+        atomic_fetch_add(&failures, 1);
+    }
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Joins with a limit the target cannot meet, then waits for it after all */
+static void impatient_joiner_thread(void* arg) {
+    lwt_thread_t* target = (lwt_thread_t*)arg;
+    if (0 == lwt_join_timeout(target, 1000000)) {
+        atomic_fetch_add(&failures, 1);
+    } else if (ETIMEDOUT == errno) {
+        atomic_fetch_add(&timed_out, 1);
+    }
+    lwt_join(target);
+    atomic_fetch_add(&joined, 1);
+}
+
+/* Polls until the target has finished */
+static void polling_joiner_thread(void* arg) {
+    lwt_thread_t* target = (lwt_thread_t*)arg;
+    while (lwt_try_join(target) != 0) {
+        if (errno != EBUSY) {
+            atomic_fetch_add(&failures, 1);
+            break;
+        }
+        lwt_sleep(1);
+    }
+    atomic_fetch_add(&joined, 1);
+}
+
+static const lwt_func_t joiner_kinds[] = {
+    joiner_thread, patient_joiner_thread, impatient_joiner_thread, polling_joiner_thread,
+};
+
+#define KINDS (int)(sizeof(joiner_kinds) / sizeof(joiner_kinds[0]))
+
+static void reset(void) {
+    atomic_store(&finished, 0);
+    atomic_store(&joined, 0);
+    atomic_store(&timed_out, 0);
+    atomic_store(&failures, 0);
+}
+
+/* Lightweight joiners of every kind on one target, joined by the main thread last */
+static int lightweight_joiners(void) {
+    for (int round = 0; round < ROUNDS; round++) {
+        reset();
+        lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+        LWT_CHECK(target != NULL);
+        LWT_CHECK(-1 == lwt_try_join(target) && EBUSY == errno);
+
+        lwt_thread_t* joiners[KINDS * JOINERS];
+        for (int i = 0; i < KINDS * JOINERS; i++) {
+            joiners[i] = lwt_create(scheduler, joiner_kinds[i % KINDS], target);
+            LWT_CHECK(joiners[i] != NULL);
+        }
+        for (int i = 0; i < KINDS * JOINERS; i++) {
+            lwt_join(joiners[i]);
+            lwt_thread_free(joiners[i]);
+        }
+        LWT_CHECK(0 == lwt_try_join(target));
+        lwt_join(target);
+        lwt_thread_free(target);
+
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(KINDS * JOINERS == atomic_load(&joined));
+        LWT_CHECK(JOINERS == atomic_load(&timed_out));
+    }
+    return 0;
+}
+
+/* The main thread times out and then joins alongside lightweight joiners */
+static int external_and_lightweight_joiners(void) {
+    for (int round = 0; round < ROUNDS; round++) {
+        reset();
+        lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+        LWT_CHECK(target != NULL);
+        lwt_thread_t* joiners[KINDS];
+        for (int i = 0; i < KINDS; i++) {
+            joiners[i] = lwt_create(scheduler, joiner_kinds[i], target);
+            LWT_CHECK(joiners[i] != NULL);
+        }
+
+        LWT_CHECK(-1 == lwt_join_timeout(target, 0) && ETIMEDOUT == errno);
+        LWT_CHECK(-1 == lwt_join_timeout(target, 1000000) && ETIMEDOUT == errno);
+        LWT_CHECK(-1 == lwt_join_until(target, lwt_now_ns() - 1) && ETIMEDOUT == errno);
+        LWT_CHECK(0 == lwt_join_timeout(target, 5000000000ull));
+        LWT_CHECK(1 == atomic_load(&finished));
+
+        for (int i = 0; i < KINDS; i++) {
+            lwt_join(joiners[i]);
+            lwt_thread_free(joiners[i]);
+        }
+        lwt_thread_free(target);
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(KINDS == atomic_load(&joined));
+    }
+    return 0;
+}
+
+/* Joining a thread that has already finished returns at once, however it is done */
+static int already_finished(void) {
+    reset();
+    lwt_thread_t* target = lwt_create(scheduler, target_thread, NULL);
+    LWT_CHECK(target != NULL);
+    lwt_join(target);
+    LWT_CHECK(0 == lwt_try_join(target));
+    LWT_CHECK(0 == lwt_join_timeout(target, 0));
+    LWT_CHECK(0 == lwt_join_until(target, 0));
+    lwt_join(target);
+    lwt_thread_free(target);
+
+    LWT_CHECK(-1 == lwt_try_join(NULL) && EINVAL == errno);
+    LWT_CHECK(-1 == lwt_join_timeout(NULL, 0) && EINVAL == errno);
+    return 0;
+}
+
+int main() {
+    scheduler = lwt_scheduler_create(4);
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    lwt_scheduler_start(scheduler);
+
+    lwt_test_case_t cases[] = {
+        { "lightweight joiners of every kind", lightweight_joiners },
+        { "external and lightweight joiners", external_and_lightweight_joiners },
+        { "joining a finished thread", already_finished },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}
@@ -0,0 +1,279 @@
+/**
+ * @file test_netpoll.c
+ * @brief Reads and writes that park on a socketpair, and lwt_close() of parked descriptors
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define STREAM_BYTES (4 * 1024 * 1024)
+#define CHUNK 65536
+#define PINGS 2000
+#define ROUNDS 20
+
+static lwt_scheduler_t* scheduler;
+static atomic_int failures;
+
+/* Byte at a position of the test stream */
+static unsigned char pattern(size_t pos) {
+    return (unsigned char)(pos * 131 + (pos >> 9));
+}
+
+/* Writes the stream, parking whenever the socket buffer is full */
+static void stream_writer_thread(void* arg) {
+    int fd = *(int*)arg;
+    static unsigned char buf[CHUNK];
+    size_t pos = 0;
+    while (pos < STREAM_BYTES) {
+        size_t n = STREAM_BYTES - pos < CHUNK ? STREAM_BYTES - pos : CHUNK;
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = pattern(pos + i);
+        }
+        size_t done = 0;
+        while (done < n) {
+            ssize_t rc = lwt_write(fd, buf + done, n - done);
+            if (rc <= 0) {
+                atomic_fetch_add(&failures, 1);
+                return;
+            }
+            done += (size_t)rc;
+        }
+        pos += n;
+    }
+}
+
+/* Reads the stream back, parking whenever nothing is buffered */
+static void stream_reader_thread(void* arg) {
+    int fd = *(int*)arg;
+    static unsigned char buf[CHUNK];
+    size_t pos = 0;
+    while (pos < STREAM_BYTES) {
+        ssize_t rc = lwt_read(fd, buf, sizeof(buf));
+        if (rc <= 0) {
+            atomic_fetch_add(&failures, 1);
+            return;
+        }
+        for (ssize_t i = 0; i < rc; i++) {
+            if (buf[i] != pattern(pos + (size_t)i)) {
+                atomic_fetch_add(&failures, 1);
+                return;
+            }
+        }
+        pos += (size_t)rc;
+    }
+    /* The writer is done and nothing else was sent */
+    lwt_select_source_t source = { .type = LWT_SELECT_READ, .fd = fd };
+    if (lwt_select(&source, 1, 10) != -1 || errno != ETIMEDOUT) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* A stream larger than the socket buffers arrives intact */
+static int stream(void) {
+    atomic_store(&failures, 0);
+    int fds[2];
+    LWT_CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    lwt_thread_t* reader = lwt_create(scheduler, stream_reader_thread, &fds[1]);
+    lwt_thread_t* writer = lwt_create(scheduler, stream_writer_thread, &fds[0]);
+    LWT_CHECK(reader != NULL && writer != NULL);
+    lwt_join(writer);
+    lwt_join(reader);
+    lwt_thread_free(writer);
+    lwt_thread_free(reader);
+    LWT_CHECK(0 == lwt_close(fds[0]));
+    LWT_CHECK(0 == lwt_close(fds[1]));
+    LWT_CHECK(0 == atomic_load(&failures));
+    return 0;
+}
+
+/* Sends a byte and waits for it to come back, PINGS times */
+static void pinger_thread(void* arg) {
+    int fd = *(int*)arg;
+    for (int i = 0; i < PINGS; i++) {
+        char out = (char)i, in;
+        if (lwt_write(fd, &out, 1) != 1 || lwt_read(fd, &in, 1) != 1 || in != out) {
+            atomic_fetch_add(&failures, 1);
+            return;
+        }
+    }
+}
+
+/* Echoes bytes until the peer goes away */
+static void echo_thread(void* arg) {
+    int fd = *(int*)arg;
+    char c;
+    ssize_t rc;
+    while ((rc = lwt_read(fd, &c, 1)) == 1) {
+        if (lwt_write(fd, &c, 1) != 1) {
+            atomic_fetch_add(&failures, 1);
+            return;
+        }
+    }
+    if (rc != 0) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/*
+ * Round trips where each side parks for every byte, on a fresh pair each
+ * round so that descriptor numbers closed by lwt_close() are reused
+ */
+static int ping_pong(void) {
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&failures, 0);
+        int fds[2];
+        LWT_CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        lwt_thread_t* echo = lwt_create(scheduler, echo_thread, &fds[1]);
+        lwt_thread_t* pinger = lwt_create(scheduler, pinger_thread, &fds[0]);
+        LWT_CHECK(echo != NULL && pinger != NULL);
+        lwt_join(pinger);
+        lwt_thread_free(pinger);
+        LWT_CHECK(0 == lwt_close(fds[0]));
+        lwt_join(echo);
+        lwt_thread_free(echo);
+        LWT_CHECK(0 == lwt_close(fds[1]));
+        LWT_CHECK(0 == atomic_load(&failures));
+    }
+    return 0;
+}
+
+static atomic_int parked;
+static atomic_int closed_ok;
+
+/* Reads from a descriptor nobody writes to, until it is closed */
+static void blocked_reader_thread(void* arg) {
+    int fd = *(int*)arg;
+    char c;
+    atomic_fetch_add(&parked, 1);
+    if (-1 == lwt_read(fd, &c, 1) && EBADF == errno) {
+        atomic_fetch_add(&closed_ok, 1);
+    }
+}
+
+/* Writes to a descriptor until its buffer is full, then waits until it is closed */
+static void blocked_writer_thread(void* arg) {
+    int fd = *(int*)arg;
+    static char buf[CHUNK];
+    atomic_fetch_add(&parked, 1);
+    for (;;) {
+        if (lwt_write(fd, buf, sizeof(buf)) < 0) {
+            if (EBADF == errno) {
+                atomic_fetch_add(&closed_ok, 1);
+            }
+            return;
+        }
+    }
+}
+
+/* Closes a descriptor from a lightweight thread */
+static void closer_thread(void* arg) {
+    lwt_sleep(5);
+    if (lwt_close(*(int*)arg) != 0) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* Give started threads time to park on their descriptors */
+static void settle(int expected) {
+    struct timespec ts = { 0, 1000000 };
+    while (atomic_load(&parked) < expected) {
+        nanosleep(&ts, NULL);
+    }
+    ts.tv_nsec = 5000000;
+    nanosleep(&ts, NULL);
+}
+
+/* lwt_close() from an OS thread or a lightweight thread fails every parked thread with EBADF */
+static int close_while_parked(void) {
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&failures, 0);
+        atomic_store(&parked, 0);
+        atomic_store(&closed_ok, 0);
+        /*
+         * Several readers on one pair, a writer on another, so that no
+         * close wakes them with end of file or EPIPE instead of EBADF
+         */
+        int rpair[2], wpair[2];
+        LWT_CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, rpair));
+        LWT_CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, wpair));
+        int fds[2] = { rpair[0], wpair[0] };
+        int peers[2] = { rpair[1], wpair[1] };
+
+        lwt_thread_t* threads[4];
+        threads[0] = lwt_create(scheduler, blocked_reader_thread, &fds[0]);
+        threads[1] = lwt_create(scheduler, blocked_reader_thread, &fds[0]);
+        threads[2] = lwt_create(scheduler, blocked_reader_thread, &fds[0]);
+        threads[3] = lwt_create(scheduler, blocked_writer_thread, &fds[1]);
+        for (int i = 0; i < 4; i++) {
+            LWT_CHECK(threads[i] != NULL);
+        }
+        settle(4);
+
+        if (round % 2) {
+            LWT_CHECK(0 == lwt_close(fds[0]));
+            LWT_CHECK(0 == lwt_close(fds[1]));
+        } else {
+            lwt_thread_t* closers[2];
+            closers[0] = lwt_create(scheduler, closer_thread, &fds[0]);
+            closers[1] = lwt_create(scheduler, closer_thread, &fds[1]);
+            LWT_CHECK(closers[0] != NULL && closers[1] != NULL);
+            for (int i = 0; i < 2; i++) {
+                lwt_join(closers[i]);
+                lwt_thread_free(closers[i]);
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            lwt_join(threads[i]);
+            lwt_thread_free(threads[i]);
+        }
+        LWT_CHECK(0 == lwt_close(peers[0]));
+        LWT_CHECK(0 == lwt_close(peers[1]));
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(4 == atomic_load(&closed_ok));
+    }
+    return 0;
+}
+
+/* Runs every case on a scheduler with the given backend */
+static int run_backend(lwt_io_backend_t backend, const char* name) {
+    lwt_scheduler_attr_t attr;
+    lwt_scheduler_attr_init(&attr);
+    attr.num_threads = 2;
+    attr.io_backend = backend;
+    scheduler = lwt_scheduler_create_ex(&attr);
+    if (!scheduler && ENOSYS == errno) {
+        printf("(%s not available, skipped)\n", name);
+        return 0;
+    }
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    printf("%s:\n", name);
+    lwt_scheduler_start(scheduler);
+
+    lwt_test_case_t cases[] = {
+        { "stream through a socketpair", stream },
+        { "ping-pong with descriptor numbers reused", ping_pong },
+        { "close while parked fails with EBADF", close_while_parked },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}
+
+int main() {
+    /* Writes to a closed peer must fail, not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    int failed = run_backend(LWT_IO_EPOLL, "epoll");
+    failed |= run_backend(LWT_IO_URING, "io_uring");
+    return failed;
+}
@@ -0,0 +1,184 @@
+/**
+ * @file test_queues.c
+ * @brief Stress tests for the work-stealing deque and the injection queue
+ *
+ * Built together with deque.c and inject.c rather than against the
+ * library, and driven by plain pthreads, so that many producers and
+ * thieves can hammer the queues at once. Every item must come out exactly
+ * once, and the injection queue must keep each producer's items in order.
+ */
+
+#include "check.h"
+#include "deque.h"
+#include "inject.h"
+#include "thread.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define ITEMS 65536
+#define THIEVES 4
+#define PRODUCERS 4
+#define BATCH 8
+
+static struct lwt_thread* items;
+static atomic_int seen[ITEMS];
+static atomic_int consumed;
+
+/* Count an item as taken, once */
+static void take(struct lwt_thread* item) {
+    atomic_fetch_add(&seen[item - items], 1);
+    atomic_fetch_add(&consumed, 1);
+}
+
+/* Whether every item was taken exactly once */
+static int all_seen_once(void) {
+    for (int i = 0; i < ITEMS; i++) {
+        if (atomic_load(&seen[i]) != 1) {
+            fprintf(stderr, "item %d taken %d times\n", i, atomic_load(&seen[i]));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void reset(void) {
+    for (int i = 0; i < ITEMS; i++) {
+        atomic_store(&seen[i], 0);
+    }
+    atomic_store(&consumed, 0);
+}
+
+static lwt_deque_t victim;
+
+/* Thief: steals half of the victim's queue at a time into its own, then drains it */
+static void* thief(void* arg) {
+    lwt_deque_t* own = (lwt_deque_t*)arg;
+    while (atomic_load(&consumed) < ITEMS) {
+        struct lwt_thread* item = lwt_deque_steal(own, &victim);
+        if (NULL == item) {
+            sched_yield();
+            continue;
+        }
+        take(item);
+        while ((item = lwt_deque_pop(own)) != NULL) {
+            take(item);
+        }
+    }
+    return NULL;
+}
+
+/* The owner pushes everything, taking an item itself when its queue is full */
+static int deque_owner_and_thieves(void) {
+    reset();
+    lwt_deque_init(&victim);
+    lwt_deque_t* own = calloc(THIEVES, sizeof(lwt_deque_t));
+    LWT_CHECK(own != NULL);
+    pthread_t thieves[THIEVES];
+    for (int i = 0; i < THIEVES; i++) {
+        lwt_deque_init(&own[i]);
+        LWT_CHECK(0 == pthread_create(&thieves[i], NULL, thief, &own[i]));
+    }
+
+    for (int i = 0; i < ITEMS; i++) {
+        while (lwt_deque_push(&victim, &items[i]) != 0) {
+            struct lwt_thread* item = lwt_deque_pop(&victim);
+            if (item) {
+                take(item);
+            }
+        }
+        if (i % 7 == 0) {
+            struct lwt_thread* item = lwt_deque_pop(&victim);
+            if (item) {
+                take(item);
+            }
+        }
+    }
+    struct lwt_thread* item;
+    while ((item = lwt_deque_pop(&victim)) != NULL) {
+        take(item);
+    }
+
+    for (int i = 0; i < THIEVES; i++) {
+        pthread_join(thieves[i], NULL);
+    }
+    free(own);
+    LWT_CHECK(ITEMS == atomic_load(&consumed));
+    LWT_CHECK(all_seen_once());
+    return 0;
+}
+
+static lwt_inject_t inject;
+
+/* Producer: pushes its share one at a time and in lists, numbering them in order */
+static void* producer(void* arg) {
+    int id = (int)(long)arg;
+    int per = ITEMS / PRODUCERS;
+    struct lwt_thread* mine = &items[id * per];
+    for (int i = 0; i < per; ) {
+        mine[i].id = ((uint64_t)id << 32) | (uint64_t)i;
+        if (i % 3 != 0 || i + BATCH > per) {
+            lwt_inject_push(&inject, &mine[i]);
+            i++;
+            continue;
+        }
+        for (int j = 1; j < BATCH; j++) {
+            mine[i + j].id = ((uint64_t)id << 32) | (uint64_t)(i + j);
+            mine[i + j - 1].next = &mine[i + j];
+        }
+        mine[i + BATCH - 1].next = NULL;
+        lwt_inject_push_list(&inject, &mine[i], BATCH);
+        i += BATCH;
+    }
+    return NULL;
+}
+
+/* Many producers, one consumer that checks each producer's order */
+static int inject_producers(void) {
+    reset();
+    lwt_inject_init(&inject);
+    pthread_t producers[PRODUCERS];
+    for (long i = 0; i < PRODUCERS; i++) {
+        LWT_CHECK(0 == pthread_create(&producers[i], NULL, producer, (void*)i));
+    }
+
+    uint64_t expect[PRODUCERS] = { 0 };
+    while (atomic_load(&consumed) < ITEMS) {
+        struct lwt_thread* item = lwt_inject_pop(&inject);
+        if (NULL == item) {
+            sched_yield();
+            continue;
+        }
+        int id = (int)(item->id >> 32);
+        LWT_CHECK(id >= 0 && id < PRODUCERS);
+        LWT_CHECK((item->id & 0xffffffffu) == expect[id]);
+        expect[id]++;
+        take(item);
+    }
+
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    LWT_CHECK(NULL == lwt_inject_pop(&inject));
+    LWT_CHECK(0 == lwt_inject_size(&inject));
+    LWT_CHECK(all_seen_once());
+    return 0;
+}
+
+int main() {
+    items = calloc(ITEMS, sizeof(struct lwt_thread));
+    if (!items) {
+        perror("calloc");
+        return 1;
+    }
+
+    lwt_test_case_t cases[] = {
+        { "deque: owner against thieves", deque_owner_and_thieves },
+        { "inject: producers against one consumer", inject_producers },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    free(items);
+    return failed;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file test_shared_stack.c
+ * @brief Shared-stack threads that park deep in recursion
+ *
+ * Each thread fills a buffer in every frame on the way down, parks in
+ * several ways at the bottom and at some frames in between, and checks
+ * every buffer on the way back up. Their frames are copied off the
+ * worker's shared stack whenever another thread takes it, so a byte out
+ * of place shows up as a wrong checksum.
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#define THREADS 32
+#define DEPTH 200
+#define FRAME_BYTES 256
+#define PARK_EVERY 50
+
+static lwt_chan_t* chan;
+static atomic_int intact;
+static atomic_int failures;
+
+/* Byte i of the buffer at a depth of a thread */
+static unsigned char fill(int id, int depth, int i) {
+    return (unsigned char)(id * 31 + depth * 7 + i);
+}
+
+/* Parks in one of several ways, chosen by depth */
+static void park(int depth) {
+    switch (depth / PARK_EVERY % 3) {
+    case 0:
+        lwt_yield();
+        break;
+    case 1:
+        lwt_sleep_ns(10000);
+        break;
+    default: {
+        int token;
+        if (lwt_chan_recv(chan, &token) != 0) {
+            atomic_fetch_add(&failures, 1);
+        }
+        break;
+    }
+    }
+}
+
+/* Recurses to DEPTH, parking on the way, and returns whether every frame survived */
+static int descend(int id, int depth) {
+    volatile unsigned char buf[FRAME_BYTES];
+    for (int i = 0; i < FRAME_BYTES; i++) {
+        buf[i] = fill(id, depth, i);
+    }
+
+    int ok = 1;
+    if (depth < DEPTH) {
+        if (depth % PARK_EVERY == 0) {
+            park(depth);
+        }
+        ok = descend(id, depth + 1);
+    } else {
+        for (int i = 0; i < 3; i++) {
+            park(i * PARK_EVERY);
+        }
+    }
+
+    for (int i = 0; i < FRAME_BYTES; i++) {
+        if (buf[i] != fill(id, depth, i)) {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+static void recursing_thread(void* arg) {
+    if (descend((int)(long)arg, 0)) {
+        atomic_fetch_add(&intact, 1);
+    }
+}
+
+/* Feeds the threads waiting on the channel until told to stop */
+static void feeder_thread(void* arg) {
+    lwt_chan_t* done = (lwt_chan_t*)arg;
+    int token = 0;
+    while (lwt_chan_tryrecv(done, &token) != 0) {
+        if (lwt_chan_trysend(chan, &token) != 0) {
+            lwt_sleep_ns(20000);
+        }
+    }
+}
+
+/* Many threads share each worker's stack while parked deep down */
+static int deep_parks(void) {
+    lwt_scheduler_attr_t sattr;
+    lwt_scheduler_attr_init(&sattr);
+    sattr.num_threads = 2;
+    lwt_scheduler_t* scheduler = lwt_scheduler_create_ex(&sattr);
+    LWT_CHECK(scheduler != NULL);
+    lwt_scheduler_start(scheduler);
+
+    chan = lwt_chan_create(sizeof(int), 4);
+    lwt_chan_t* done = lwt_chan_create(sizeof(int), 1);
+    LWT_CHECK(chan != NULL && done != NULL);
+    atomic_store(&intact, 0);
+    atomic_store(&failures, 0);
+
+    lwt_attr_t attr;
+    lwt_attr_init(&attr);
+    attr.shared_stack = 1;
+    lwt_thread_t* threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        threads[i] = lwt_create_ex(scheduler, &attr, recursing_thread, (void*)(long)i);
+        if (NULL == threads[i] && ENOTSUP == errno && 0 == i) {
+            printf("(no shared stacks in this build, skipped) ");
+            lwt_scheduler_stop(scheduler);
+            lwt_scheduler_destroy(scheduler);
+            return LWT_TEST_SKIP;
+        }
+        LWT_CHECK(threads[i] != NULL);
+    }
+    lwt_thread_t* feeder = lwt_create(scheduler, feeder_thread, done);
+    LWT_CHECK(feeder != NULL);
+
+    for (int i = 0; i < THREADS; i++) {
+        lwt_join(threads[i]);
+        lwt_thread_free(threads[i]);
+    }
+    int token = 0;
+    LWT_CHECK(0 == lwt_chan_send(done, &token));
+    lwt_join(feeder);
+    lwt_thread_free(feeder);
+    lwt_chan_destroy(chan);
+    lwt_chan_destroy(done);
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+
+    LWT_CHECK(0 == atomic_load(&failures));
+    LWT_CHECK(THREADS == atomic_load(&intact));
+    return 0;
+}
+
+int main() {
+    int rc = deep_parks();
+    printf("%-48s %s\n", "deep parks on shared stacks",
+           0 == rc ? "ok" : LWT_TEST_SKIP == rc ? "skipped" : "FAILED");
+    return 0 == rc ? 0 : LWT_TEST_SKIP == rc ? LWT_TEST_SKIP : 1;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file test_timer.c
+ * @brief Sleep ordering across the levels of the timer wheel
+ *
+ * The wheel ticks about once a microsecond with 64 slots per level, so
+ * level 0 spans about 65us, level 1 about 4ms, level 2 about 268ms and
+ * level 3 about 17s. The sleeps below land on each of the first four
+ * levels and must cascade down without waking early or out of order.
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <stdatomic.h>
+
+#define COPIES 4
+#define LATE_NS 250000000ull        /* Lateness that can only mean a lost timer */
+#define ORDER_GAP_NS 20000000ull    /* Deadlines this far apart must wake in order */
+
+static const uint64_t durations[] = {
+    30000, 60000, 200000,               /* Level 0 and its edge */
+    1000000, 3000000,                   /* Level 1 */
+    8000000, 30000000, 100000000,       /* Level 2 */
+    280000000, 320000000, 600000000,    /* Level 3 */
+};
+
+#define SLEEPERS (COPIES * (int)(sizeof(durations) / sizeof(durations[0])))
+
+typedef struct sleeper {
+    lwt_deadline_t deadline;
+    lwt_deadline_t woke;
+    int order;
+} sleeper_t;
+
+static sleeper_t sleepers[SLEEPERS];
+static atomic_int wakeups;
+
+/* Sleeps until its deadline and records when and in which order it woke */
+static void sleeper_thread(void* arg) {
+    sleeper_t* sleeper = (sleeper_t*)arg;
+    lwt_sleep_until(sleeper->deadline);
+    sleeper->woke = lwt_now_ns();
+    sleeper->order = atomic_fetch_add(&wakeups, 1);
+}
+
+/* Checks the recorded wakeups against the deadlines */
+static int check_sleepers(void) {
+    LWT_CHECK(SLEEPERS == atomic_load(&wakeups));
+    for (int i = 0; i < SLEEPERS; i++) {
+        LWT_CHECK(sleepers[i].woke >= sleepers[i].deadline);
+        LWT_CHECK(sleepers[i].woke - sleepers[i].deadline < LATE_NS);
+        for (int j = 0; j < SLEEPERS; j++) {
+            if (sleepers[j].deadline >= sleepers[i].deadline + ORDER_GAP_NS) {
+                LWT_CHECK(sleepers[i].order < sleepers[j].order);
+            }
+        }
+    }
+    return 0;
+}
+
+/* Sleepers for every level start together, longest first */
+static int run_levels(lwt_scheduler_t* scheduler) {
+    atomic_store(&wakeups, 0);
+    lwt_thread_t* threads[SLEEPERS];
+    lwt_deadline_t base = lwt_now_ns() + 1000000;
+    for (int i = 0; i < SLEEPERS; i++) {
+        int d = (int)(sizeof(durations) / sizeof(durations[0])) - 1 - i / COPIES;
+        sleepers[i].deadline = base + durations[d] + (uint64_t)(i % COPIES) * 1000;
+        threads[i] = lwt_create(scheduler, sleeper_thread, &sleepers[i]);
+        LWT_CHECK(threads[i] != NULL);
+    }
+    for (int i = 0; i < SLEEPERS; i++) {
+        lwt_join(threads[i]);
+        lwt_thread_free(threads[i]);
+    }
+    return check_sleepers();
+}
+
+static int levels_one_worker(void) {
+    lwt_scheduler_t* scheduler = lwt_scheduler_create(1);
+    LWT_CHECK(scheduler != NULL);
+    lwt_scheduler_start(scheduler);
+    int rc = run_levels(scheduler);
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return rc;
+}
+
+static int levels_four_workers(void) {
+    lwt_scheduler_t* scheduler = lwt_scheduler_create(4);
+    LWT_CHECK(scheduler != NULL);
+    lwt_scheduler_start(scheduler);
+    int rc = run_levels(scheduler);
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return rc;
+}
+
+static atomic_int early;
+
+/* Sleeps of one to a few thousand ns, which fall inside a single tick */
+static void short_sleeper_thread(void* arg) {
+    (void)arg;
+    for (uint64_t ns = 1; ns < 3000; ns += 7) {
+        lwt_deadline_t start = lwt_now_ns();
+        lwt_sleep_ns(ns);
+        if (lwt_now_ns() - start < ns) {
+            atomic_fetch_add(&early, 1);
+        }
+    }
+}
+
+/* Sleeps shorter than a tick never end early */
+static int sub_tick_sleeps(void) {
+    atomic_store(&early, 0);
+    lwt_scheduler_t* scheduler = lwt_scheduler_create(2);
+    LWT_CHECK(scheduler != NULL);
+    lwt_scheduler_start(scheduler);
+    lwt_thread_t* threads[4];
+    for (int i = 0; i < 4; i++) {
+        threads[i] = lwt_create(scheduler, short_sleeper_thread, NULL);
+        LWT_CHECK(threads[i] != NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        lwt_join(threads[i]);
+        lwt_thread_free(threads[i]);
+    }
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    LWT_CHECK(0 == atomic_load(&early));
+    return 0;
+}
+
+int main() {
+    lwt_test_case_t cases[] = {
+        { "levels 0 to 3 on one worker", levels_one_worker },
+        { "levels 0 to 3 on four workers", levels_four_workers },
+        { "sleeps shorter than a tick", sub_tick_sleeps },
+    };
+    return LWT_TEST_RUN(cases);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file test_waitgroup.c
+ * @brief Wait groups with lightweight and OS waiters
+ */
+
+#include "check.h"
+#include <lwthread/lwthread.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ROUNDS 50
+#define TASKS 200
+#define WAITERS 4
+
+static lwt_scheduler_t* scheduler;
+static atomic_int finished;
+static atomic_int woken;
+static atomic_int failures;
+
+/* One task: yields a little so the tasks spread over the workers */
+static void task_thread(void* arg) {
+    lwt_waitgroup_t* wg = (lwt_waitgroup_t*)arg;
+    lwt_yield();
+    atomic_fetch_add(&finished, 1);
+    if (lwt_waitgroup_done(wg) != 0) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+/* Waits from a lightweight thread; every task must be done by then */
+static void waiter_thread(void* arg) {
+    if (lwt_waitgroup_wait((lwt_waitgroup_t*)arg) != 0 || atomic_load(&finished) != TASKS) {
+        atomic_fetch_add(&failures, 1);
+    }
+    atomic_fetch_add(&woken, 1);
+}
+
+/* Waits from a plain OS thread */
+static void* os_waiter(void* arg) {
+    waiter_thread(arg);
+    return NULL;
+}
+
+/* Several lightweight and OS waiters, reusing one wait group round after round */
+static int fan_in(void) {
+    lwt_waitgroup_t* wg = lwt_waitgroup_create();
+    LWT_CHECK(wg != NULL);
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&finished, 0);
+        atomic_store(&woken, 0);
+        atomic_store(&failures, 0);
+        LWT_CHECK(0 == lwt_waitgroup_add(wg, TASKS));
+
+        lwt_thread_t* waiters[WAITERS];
+        pthread_t os_waiters[WAITERS];
+        for (int i = 0; i < WAITERS; i++) {
+            waiters[i] = lwt_create(scheduler, waiter_thread, wg);
+            LWT_CHECK(waiters[i] != NULL);
+            LWT_CHECK(0 == pthread_create(&os_waiters[i], NULL, os_waiter, wg));
+        }
+        for (int i = 0; i < TASKS; i++) {
+            lwt_thread_t* task = lwt_create(scheduler, task_thread, wg);
+            LWT_CHECK(task != NULL);
+            LWT_CHECK(0 == lwt_detach(task));
+        }
+
+        LWT_CHECK(0 == lwt_waitgroup_wait(wg));
+        LWT_CHECK(TASKS == atomic_load(&finished));
+        for (int i = 0; i < WAITERS; i++) {
+            lwt_join(waiters[i]);
+            lwt_thread_free(waiters[i]);
+            pthread_join(os_waiters[i], NULL);
+        }
+        LWT_CHECK(0 == atomic_load(&failures));
+        LWT_CHECK(2 * WAITERS == atomic_load(&woken));
+    }
+    lwt_waitgroup_destroy(wg);
+    return 0;
+}
+
+/* Adds up to two more tasks before finishing, like a growing tree of work */
+static void spawning_task_thread(void* arg) {
+    lwt_waitgroup_t* wg = (lwt_waitgroup_t*)arg;
+    int n = atomic_fetch_add(&finished, 1);
+    if (n * 2 + 1 < TASKS) {
+        for (int i = 0; i < 2 && n * 2 + 1 + i < TASKS; i++) {
+            lwt_waitgroup_add(wg, 1);
+            lwt_detach(lwt_create(scheduler, spawning_task_thread, wg));
+        }
+    }
+    lwt_waitgroup_done(wg);
+}
+
+/* Tasks that add more tasks before finishing keep the count above zero */
+static int nested_adds(void) {
+    lwt_waitgroup_t* wg = lwt_waitgroup_create();
+    LWT_CHECK(wg != NULL);
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_store(&finished, 0);
+        LWT_CHECK(0 == lwt_waitgroup_add(wg, 1));
+        lwt_thread_t* root = lwt_create(scheduler, spawning_task_thread, wg);
+        LWT_CHECK(root != NULL);
+        LWT_CHECK(0 == lwt_waitgroup_wait(wg));
+        LWT_CHECK(TASKS == atomic_load(&finished));
+        lwt_join(root);
+        lwt_thread_free(root);
+    }
+    lwt_waitgroup_destroy(wg);
+    return 0;
+}
+
+/* A zero count does not wait, and the count never goes negative */
+static int counting(void) {
+    lwt_waitgroup_t* wg = lwt_waitgroup_create();
+    LWT_CHECK(wg != NULL);
+    LWT_CHECK(0 == lwt_waitgroup_wait(wg));
+    LWT_CHECK(-1 == lwt_waitgroup_done(wg) && EINVAL == errno);
+    LWT_CHECK(0 == lwt_waitgroup_add(wg, 2));
+    LWT_CHECK(-1 == lwt_waitgroup_add(wg, -3) && EINVAL == errno);
+    LWT_CHECK(0 == lwt_waitgroup_add(wg, -1));
+    LWT_CHECK(0 == lwt_waitgroup_done(wg));
+    LWT_CHECK(0 == lwt_waitgroup_wait(wg));
+    lwt_waitgroup_destroy(wg);
+    return 0;
+}
+
+int main() {
+    scheduler = lwt_scheduler_create(4);
+    if (!scheduler) {
+        perror("Failed to create scheduler");
+        return 1;
+    }
+    lwt_scheduler_start(scheduler);
+
+    lwt_test_case_t cases[] = {
+        { "fan-in with lightweight and OS waiters", fan_in },
+        { "tasks adding tasks", nested_adds },
+        { "counting", counting },
+    };
+    int failed = LWT_TEST_RUN(cases);
+
+    lwt_scheduler_stop(scheduler);
+    lwt_scheduler_destroy(scheduler);
+    return failed;
+}